@@ -0,0 +1,85 @@
+/**
+ * @File     : bench_format.c
+ * @Author   : Abdullah Younis
+ *
+ * This benchmark times constats_format_double against snprintf's "%.*f"
+ * on latency-shaped values, with and without a unit.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "constats_bench.h"
+
+#define CALLS 1000
+
+double values[CALLS];
+char buffer[CONSTATS_FORMAT_MAX];
+
+static void format_none ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		constats_format_double( values[i], buffer, 2, CONSTATS_UNIT_NONE );
+		__asm__ volatile ( "" : : "r"( buffer ) : "memory" );
+	}
+}
+
+static void format_time ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		constats_format_double( values[i], buffer, 2, CONSTATS_UNIT_TIME );
+		__asm__ volatile ( "" : : "r"( buffer ) : "memory" );
+	}
+}
+
+static void format_snprintf ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		snprintf( buffer, sizeof( buffer ), "%.*f", 2, values[i] );
+		__asm__ volatile ( "" : : "r"( buffer ) : "memory" );
+	}
+}
+
+int main ( void )
+{
+	static const struct { const char* name; void (*fn)( void* ); } variants[] =
+	{
+		{ "format_double", format_none },
+		{ "format_double (time)", format_time },
+		{ "snprintf", format_snprintf },
+	};
+
+	bench_t bench;
+	stats_t stat;
+	unsigned i;
+
+	// Latencies around 50us with a long tail, and their fractions
+	srand( 1 );
+	for ( i = 0; i < CALLS; ++i )
+		values[i] = ( 50000 + rand() % 10000 + ( rand() % 100 == 0 ? rand() % 10000000 : 0 ) ) / (double) ( 1 + rand() % 7 );
+
+	constats_bench_init( &bench, 1000, 0 );
+
+	for ( i = 0; i < sizeof( variants ) / sizeof( variants[0] ); ++i )
+	{
+		constats_bench_run( &bench, variants[i].fn, NULL );
+		constats_bench_calculate_stats( &bench, CONSTATS_BENCH_TIME, &stat );
+
+		printf ( "%-23s: %10.1f ns per call\n", variants[i].name, stat.norm_mean / CALLS );
+	}
+
+	constats_bench_destroy( &bench );
+	return 0;
+}
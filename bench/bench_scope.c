@@ -0,0 +1,122 @@
+/**
+ * @File     : bench_scope.c
+ * @Author   : Abdullah Younis
+ *
+ * This benchmark times a ~50ns function bare, under every kind of scope,
+ * and under a recorder macro. It is built twice, once as bench_scope and
+ * once with CONSTATS_DISABLE as bench_scope_disabled, where every
+ * instrumented variant should cost the same as the bare one.
+ */
+
+#include <stdint.h>
+
+#include "constats_bench.h"
+#include "constats_recorder.h"
+#include "constats_scope.h"
+
+#define CALLS 1000
+
+recorder_t recorder;
+volatile uint64_t sink;
+
+static inline uint64_t work ( uint64_t x )
+{
+	int i;
+
+	for ( i = 0; i < 16; ++i )
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+
+	return x;
+}
+
+static void bare ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+		sink = work( sink );
+}
+
+static void scoped ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		CONSTATS_SCOPE( "scoped" );
+		sink = work( sink );
+	}
+}
+
+static void sampled ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		CONSTATS_SCOPE_SAMPLED( "sampled", 64 );
+		sink = work( sink );
+	}
+}
+
+static void adaptive ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		CONSTATS_SCOPE_ADAPTIVE( "adaptive" );
+		sink = work( sink );
+	}
+}
+
+static void recorded ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		sink = work( sink );
+		CONSTATS_RECORD( &recorder, (int64_t) sink );
+	}
+
+	constats_recorder_reset( &recorder );
+}
+
+int main ( void )
+{
+	static const struct { const char* name; void (*fn)( void* ); } variants[] =
+	{
+		{ "bare", bare }, { "CONSTATS_SCOPE", scoped }, { "CONSTATS_SCOPE_SAMPLED 64", sampled },
+		{ "CONSTATS_SCOPE_ADAPTIVE", adaptive }, { "CONSTATS_RECORD", recorded },
+	};
+
+	bench_t bench;
+	stats_t stat;
+	unsigned i;
+
+	constats_recorder_init( &recorder, CALLS, CONSTATS_RECORDER_PREFAULT );
+	constats_bench_init( &bench, 2000, 0 );
+
+#ifdef CONSTATS_DISABLE
+	printf ( "Instrumentation        : disabled\n" );
+#else
+	printf ( "Instrumentation        : enabled\n" );
+#endif
+
+	for ( i = 0; i < sizeof( variants ) / sizeof( variants[0] ); ++i )
+	{
+		constats_bench_run( &bench, variants[i].fn, NULL );
+		constats_bench_calculate_stats( &bench, CONSTATS_BENCH_TIME, &stat );
+		printf ( "%-27s: %8.2f ns per call\n", variants[i].name, stat.norm_mean / CALLS );
+	}
+
+	constats_bench_destroy( &bench );
+	constats_recorder_destroy( &recorder );
+	return 0;
+}
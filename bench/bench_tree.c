@@ -0,0 +1,103 @@
+/**
+ * @File     : bench_tree.c
+ * @Author   : Abdullah Younis
+ *
+ * This benchmark times a ~50ns function bare, under one tree scope and
+ * under two nested tree scopes. It prints what each scope adds per call,
+ * and how much of that is left once its two clock reads are taken out.
+ */
+
+#include <stdint.h>
+
+#include "constats_bench.h"
+#include "constats_tree.h"
+
+#define CALLS 1000
+
+volatile uint64_t sink;
+
+static inline uint64_t work ( uint64_t x )
+{
+	int i;
+
+	for ( i = 0; i < 16; ++i )
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+
+	return x;
+}
+
+static void bare ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+		sink = work( sink );
+}
+
+static void scoped ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		CONSTATS_TREE_SCOPE( "scoped" );
+		sink = work( sink );
+	}
+}
+
+static void nested ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+	{
+		CONSTATS_TREE_SCOPE( "outer" );
+		{
+			CONSTATS_TREE_SCOPE( "inner" );
+			sink = work( sink );
+		}
+	}
+}
+
+int main ( void )
+{
+	static const struct { const char* name; void (*fn)( void* ); int scopes; } variants[] =
+	{
+		{ "bare", bare, 0 }, { "CONSTATS_TREE_SCOPE", scoped, 1 }, { "CONSTATS_TREE_SCOPE nested", nested, 2 },
+	};
+
+	bench_t bench;
+	stats_t stat;
+	double base = 0;
+	double reads = 2 * constats_clock_calibration( CONSTATS_CLOCK_TICKS )->overhead_ns;
+	unsigned i;
+
+	constats_bench_init( &bench, 2000, 0 );
+	printf ( "%-27s: %8.2f ns per scope\n", "Clock reads", reads );
+
+	for ( i = 0; i < sizeof( variants ) / sizeof( variants[0] ); ++i )
+	{
+		constats_bench_run( &bench, variants[i].fn, NULL );
+		constats_bench_calculate_stats( &bench, CONSTATS_BENCH_TIME, &stat );
+
+		double per_call = stat.norm_mean / CALLS;
+
+		if ( variants[i].scopes == 0 )
+		{
+			base = per_call;
+			printf ( "%-27s: %8.2f ns per call\n", variants[i].name, per_call );
+		}
+		else
+		{
+			double per_scope = ( per_call - base ) / variants[i].scopes;
+			printf ( "%-27s: %8.2f ns per call, %6.2f ns per scope, %6.2f ns besides the reads\n",
+			         variants[i].name, per_call, per_scope, per_scope - reads );
+		}
+	}
+
+	constats_bench_destroy( &bench );
+	return 0;
+}
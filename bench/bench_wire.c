@@ -0,0 +1,108 @@
+/**
+ * @File     : bench_wire.c
+ * @Author   : Abdullah Younis
+ *
+ * This benchmark times encoding and decoding an accumulator and a
+ * latency-shaped histogram, and prints the throughput of each.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "constats_bench.h"
+#include "constats_wire.h"
+
+#define CALLS 100
+
+accumulator_t acc;
+histogram_t hist, decoded;
+uint8_t acc_buffer[CONSTATS_WIRE_ACCUMULATOR_MAX];
+uint8_t hist_buffer[CONSTATS_WIRE_HISTOGRAM_MAX];
+uint64_t acc_length, hist_length;
+
+static void encode_accumulator ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+		constats_wire_encode_accumulator( &acc, acc_buffer, sizeof( acc_buffer ), &acc_length );
+}
+
+static void decode_accumulator ( void* unused )
+{
+	accumulator_t out;
+	int i;
+	(void) unused;
+
+	// The barrier keeps the compiler from merging the identical decodes
+	for ( i = 0; i < CALLS; ++i )
+	{
+		constats_wire_decode_accumulator( &out, acc_buffer, acc_length );
+		__asm__ volatile ( "" : : "r"( &out ) : "memory" );
+	}
+}
+
+static void encode_histogram ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+		constats_wire_encode_histogram( &hist, hist_buffer, sizeof( hist_buffer ), &hist_length );
+}
+
+static void merge_histogram ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < CALLS; ++i )
+		constats_wire_merge_histogram( &decoded, hist_buffer, hist_length );
+}
+
+int main ( void )
+{
+	static const struct { const char* name; void (*fn)( void* ); uint64_t* length; } variants[] =
+	{
+		{ "encode accumulator", encode_accumulator, &acc_length },
+		{ "decode accumulator", decode_accumulator, &acc_length },
+		{ "encode histogram", encode_histogram, &hist_length },
+		{ "merge histogram", merge_histogram, &hist_length },
+	};
+
+	bench_t bench;
+	stats_t stat;
+	unsigned i;
+
+	// Latencies around 50us with a long tail
+	srand( 1 );
+	constats_accumulator_init( &acc );
+	constats_histogram_init( &hist );
+	constats_histogram_init( &decoded );
+
+	for ( i = 0; i < 1000000; ++i )
+	{
+		int64_t value = 50000 + rand() % 10000 + ( rand() % 100 == 0 ? rand() % 10000000 : 0 );
+		constats_accumulator_add( &acc, value );
+		constats_histogram_record( &hist, value );
+	}
+
+	encode_accumulator( NULL );
+	encode_histogram( NULL );
+	printf ( "Encoded sizes          : accumulator %lu bytes, histogram %lu bytes\n", acc_length, hist_length );
+
+	constats_bench_init( &bench, 1000, 0 );
+
+	for ( i = 0; i < sizeof( variants ) / sizeof( variants[0] ); ++i )
+	{
+		constats_bench_run( &bench, variants[i].fn, NULL );
+		constats_bench_calculate_stats( &bench, CONSTATS_BENCH_TIME, &stat );
+
+		double ns = stat.norm_mean / CALLS;
+		printf ( "%-23s: %10.1f ns per call, %8.1f MB/s\n", variants[i].name, ns, *variants[i].length / ns * 1e3 );
+	}
+
+	constats_bench_destroy( &bench );
+	return 0;
+}
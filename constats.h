@@ -27,6 +27,8 @@ int constats_get_and_print_stats ( int64_t* sample_set, uint64_t sample_size );
 
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 typedef struct stats_t
 {
@@ -66,115 +68,266 @@ double constats_get_mean ( int64_t* sample_set, uint64_t sample_size )
 	return sum / (double) sample_size;
 }
 
+// The tolerance sketch is summed in blocks of this many samples, whose
+// float sums are then added up in order. Long sketches keep more of their
+// precision, and blocks summed on different threads give the same result.
+#ifndef CONSTATS_SKETCH_BLOCK
+#define CONSTATS_SKETCH_BLOCK ( 1UL << 12 )
+#endif
+
 /**
- * This function returns a tolerance level, the suggested max deviation
- * from the mean before being classified as an outlier.
+ * This function returns how many samples, from the start, the tolerance
+ * sketch looks at.
  */
 static inline
-int64_t constats_get_tolerance ( int64_t* sample_set, uint64_t sample_size )
+uint64_t constats_sketch_size ( uint64_t sample_size )
+{
+	// For a quick sketch idea of the data, only go through 1/16 of it.
+	return sample_size > 16 ? sample_size >> 4 : sample_size;
+}
+
+/**
+ * This function turns the sketch's sum of absolute deviations into a
+ * tolerance level.
+ */
+static inline
+int64_t constats_sketch_tolerance ( float abdev_sum, uint64_t sketch_size )
+{
+	float sketch_abdev = abdev_sum / (float) sketch_size;
+
+	if ( sketch_abdev > INF / 32 )
+		return INF;
+
+	return 5 * sketch_abdev;
+}
+
+/**
+ * This function returns the float sum of one block of the sketch.
+ */
+static inline
+float constats_sketch_block_sum ( int64_t* sample_set, uint64_t sample_size )
 {
 	register float sum;
-	register float mean;
 	register uint64_t i;
 
-	// For a quick sketch idea of the data, only go through 1/16 of it.
-	if ( sample_size > 16 )
-		sample_size >>= 4;
-
 	for ( sum = 0, i = 0; i < sample_size; ++i )
 	{
 		sum += sample_set[i];
 	}
 
-	mean = sum / (float) sample_size;
+	return sum;
+}
+
+/**
+ * This function returns the float sum of absolute deviations from the
+ * sketch's mean of one block of the sketch.
+ */
+static inline
+float constats_sketch_block_abdev ( int64_t* sample_set, uint64_t sample_size, float mean )
+{
+	register float sum;
+	register uint64_t i;
 
 	for ( sum = 0, i = 0; i < sample_size; ++i )
 	{
 		sum += ABSOLUTE( sample_set[i] - mean );
 	}
 
-	float sketch_abdev = sum / (float) sample_size;
+	return sum;
+}
 
-	if ( sketch_abdev > INF / 32 )
-		return INF;
+/**
+ * This function returns a tolerance level, the suggested max deviation
+ * from the mean before being classified as an outlier.
+ */
+static inline
+int64_t constats_get_tolerance ( int64_t* sample_set, uint64_t sample_size )
+{
+	register float sum;
+	register float mean;
+	register uint64_t i;
 
-	return 5 * sketch_abdev;
+	sample_size = constats_sketch_size( sample_size );
+
+	for ( sum = 0, i = 0; i < sample_size; i += CONSTATS_SKETCH_BLOCK )
+		sum += constats_sketch_block_sum( sample_set + i, sample_size - i < CONSTATS_SKETCH_BLOCK ? sample_size - i : CONSTATS_SKETCH_BLOCK );
+
+	mean = sum / (float) sample_size;
+
+	for ( sum = 0, i = 0; i < sample_size; i += CONSTATS_SKETCH_BLOCK )
+		sum += constats_sketch_block_abdev( sample_set + i, sample_size - i < CONSTATS_SKETCH_BLOCK ? sample_size - i : CONSTATS_SKETCH_BLOCK, mean );
+
+	return constats_sketch_tolerance( sum, sample_size );
 }
 
 /**
- * This function populates the stat data structure with statistics.
+ * The running sums of the deviation and norm passes. Every routine that
+ * fills a stats_t from samples, whatever holds them, feeds each sample
+ * to constats_pass_deviation and then to constats_pass_norm, so they all
+ * do the same arithmetic in the same order.
  */
-int constats_calculate_stats ( int64_t* sample_set, uint64_t sample_size, stats_t* stat )
+typedef struct stats_pass_t
 {
-	// Error Checking
-	if ( stat == NULL || sample_size == 0 )
-		return -1;
+	double mean;			// The mean deviations are taken from
+	double norm_mean;		// The mean without outliers, once the deviation pass is done
+	int64_t upper_thresh;	// Samples above are outliers
+	int64_t lower_thresh;	// Samples below are outliers
 
-	stat->N    = sample_size;
-	stat->mean = constats_get_mean ( sample_set, sample_size );
-	stat->tolerance = constats_get_tolerance ( sample_set, sample_size );
+	double stdev_sum;		// Deviation pass sums
+	double abdev_sum;
+	double norm_sum;
+	int64_t min;
+	int64_t max;
+	int64_t norm_min;
+	int64_t norm_max;
+	uint64_t outliers;
 
-	int64_t upper_thresh = stat->tolerance == INF ? INF : stat->mean + stat->tolerance;
-	int64_t lower_thresh = stat->tolerance == INF ? NINF : stat->mean - stat->tolerance;
-
-	// Temporary Values
-	stat->min = INF;
-	stat->max = NINF;
-	stat->norm_min = INF;
-	stat->norm_max = NINF;
-	stat->outliers = 0;
-
-	register double stdevSum = 0;
-	register double abdevSum = 0;
-	register double normSum = 0;
-	register double normStdevSum = 0;
-	register double normAbdevSum = 0;
-	register uint64_t i;
+	double norm_stdev_sum;	// Norm pass sums
+	double norm_abdev_sum;
 
-	for ( i = 0; i < sample_size; ++i )
-	{
-		double dev = ABSOLUTE( sample_set[i] - stat->mean );
-		abdevSum += dev;
-		stdevSum += dev*dev;
+} stats_pass_t;
 
-		if ( sample_set[i] < stat->min )
-			stat->min = sample_set[i];
+/**
+ * This function starts the passes for the given mean and tolerance.
+ */
+static inline
+void constats_pass_init ( stats_pass_t* pass, double mean, int64_t tolerance )
+{
+	memset( pass, 0, sizeof( stats_pass_t ) );
+
+	pass->mean         = mean;
+	pass->upper_thresh = tolerance == INF ? INF : mean + tolerance;
+	pass->lower_thresh = tolerance == INF ? NINF : mean - tolerance;
+	pass->min          = INF;
+	pass->max          = NINF;
+	pass->norm_min     = INF;
+	pass->norm_max     = NINF;
+}
 
-		if ( sample_set[i] > stat->max )
-			stat->max = sample_set[i];
+/**
+ * This function adds one sample to the deviation pass.
+ */
+static inline
+void constats_pass_deviation ( stats_pass_t* pass, int64_t sample )
+{
+	double dev = ABSOLUTE( sample - pass->mean );
+	pass->abdev_sum += dev;
+	pass->stdev_sum += dev*dev;
 
-		if ( sample_set[i] > upper_thresh || sample_set[i] < lower_thresh )
-		{
-			stat->outliers++;
-		}
-		else
-		{
-			normSum += sample_set[i];
+	if ( sample < pass->min )
+		pass->min = sample;
 
-			if ( sample_set[i] > stat->norm_max )
-				stat->norm_max = sample_set[i];
+	if ( sample > pass->max )
+		pass->max = sample;
 
-			if ( sample_set[i] < stat->norm_min )
-				stat->norm_min = sample_set[i];
-		}
+	if ( sample > pass->upper_thresh || sample < pass->lower_thresh )
+	{
+		pass->outliers++;
 	}
+	else
+	{
+		pass->norm_sum += sample;
 
-	stat->stdev     = sqrt( stdevSum / (double) sample_size );
-	stat->abdev     = abdevSum / (double) sample_size;
-	stat->norm_mean = normSum / (double) ( sample_size - stat->outliers );
+		if ( sample > pass->norm_max )
+			pass->norm_max = sample;
 
-	for ( i = 0; i < sample_size; ++i )
+		if ( sample < pass->norm_min )
+			pass->norm_min = sample;
+	}
+}
+
+/**
+ * This function fills in what the deviation pass over sample_size
+ * samples gives, and readies the norm pass.
+ */
+static inline
+void constats_pass_deviations_done ( stats_pass_t* pass, uint64_t sample_size, stats_t* stat )
+{
+	stat->min       = pass->min;
+	stat->max       = pass->max;
+	stat->norm_min  = pass->norm_min;
+	stat->norm_max  = pass->norm_max;
+	stat->outliers  = pass->outliers;
+	stat->stdev     = sqrt( pass->stdev_sum / (double) sample_size );
+	stat->abdev     = pass->abdev_sum / (double) sample_size;
+	stat->norm_mean = pass->norm_sum / (double) ( sample_size - pass->outliers );
+	pass->norm_mean = stat->norm_mean;
+}
+
+/**
+ * This function adds one sample to the norm pass.
+ */
+static inline
+void constats_pass_norm ( stats_pass_t* pass, int64_t sample )
+{
+	if ( sample <= pass->upper_thresh && sample >= pass->lower_thresh )
 	{
-		if ( sample_set[i] <= upper_thresh && sample_set[i] >= lower_thresh )
-		{
-			double dev = ABSOLUTE( sample_set[i] - stat->norm_mean );
-			normAbdevSum += dev;
-			normStdevSum += dev*dev;
-		}
+		double dev = ABSOLUTE( sample - pass->norm_mean );
+		pass->norm_abdev_sum += dev;
+		pass->norm_stdev_sum += dev*dev;
 	}
+}
+
+/**
+ * This function fills in what the norm pass gives.
+ */
+static inline
+void constats_pass_norm_done ( stats_pass_t* pass, uint64_t sample_size, stats_t* stat )
+{
+	stat->norm_stdev = sqrt( pass->norm_stdev_sum / (double) ( sample_size - pass->outliers ) );
+	stat->norm_abdev = pass->norm_abdev_sum / (double) ( sample_size - pass->outliers );
+}
+
+/**
+ * This function fills in everything that needs the mean and tolerance
+ * already in stat: the deviations, extremes, outliers and norm_mean.
+ * The norm pass picks up from pass.
+ */
+static inline
+void constats_deviation_pass ( int64_t* sample_set, uint64_t sample_size, stats_t* stat, stats_pass_t* pass )
+{
+	register uint64_t i;
+
+	constats_pass_init( pass, stat->mean, stat->tolerance );
+
+	for ( i = 0; i < sample_size; ++i )
+		constats_pass_deviation( pass, sample_set[i] );
+
+	constats_pass_deviations_done( pass, sample_size, stat );
+}
+
+/**
+ * This function fills in the deviations without the outliers, after the
+ * deviation pass.
+ */
+static inline
+void constats_norm_pass ( int64_t* sample_set, uint64_t sample_size, stats_t* stat, stats_pass_t* pass )
+{
+	register uint64_t i;
 
-	stat->norm_stdev = sqrt( normStdevSum / (double) ( sample_size - stat->outliers ) );
-	stat->norm_abdev = normAbdevSum / (double) ( sample_size - stat->outliers );
+	for ( i = 0; i < sample_size; ++i )
+		constats_pass_norm( pass, sample_set[i] );
+
+	constats_pass_norm_done( pass, sample_size, stat );
+}
+
+/**
+ * This function populates the stat data structure with statistics.
+ */
+int constats_calculate_stats ( int64_t* sample_set, uint64_t sample_size, stats_t* stat )
+{
+	stats_pass_t pass;
+
+	// Error Checking
+	if ( stat == NULL || sample_size == 0 )
+		return -1;
+
+	stat->N    = sample_size;
+	stat->mean = constats_get_mean ( sample_set, sample_size );
+	stat->tolerance = constats_get_tolerance ( sample_set, sample_size );
+
+	constats_deviation_pass( sample_set, sample_size, stat, &pass );
+	constats_norm_pass( sample_set, sample_size, stat, &pass );
 
 	return 0;
 }
@@ -216,82 +369,351 @@ uint64_t constats_count_in_range ( int64_t* sample_set, uint64_t sample_size, in
 	return count;
 }
 
+// Formatting flags
+#define CONSTATS_FORMAT_RIGHT 0x1	// Pad on the left instead of the right
+
+// Every two digit number, so digits are produced two at a time
+static const char constats_digit_pairs[201] =
+	"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+	"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+static const uint64_t constats_powers_of_ten[20] =
+{
+	1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+	100000000UL, 1000000000UL, 10000000000UL, 100000000000UL, 1000000000000UL,
+	10000000000000UL, 100000000000000UL, 1000000000000000UL, 10000000000000000UL,
+	100000000000000000UL, 1000000000000000000UL, 10000000000000000000UL
+};
+
 /**
- * This function truncates (or pads) the given int64_t into a string with given width
+ * This function returns the number of decimal digits in value. The bit
+ * length times log10(2) is off by at most one, which one comparison fixes.
  */
 static inline
-int constats_truncate ( int64_t value, char* buf, uint64_t width )
+int constats_count_digits ( uint64_t value )
+{
+	int estimate = ( ( 64 - __builtin_clzll( value | 1 ) ) * 1233 ) >> 12;
+	return estimate + 1 - ( ( value | 1 ) < constats_powers_of_ten[estimate] );
+}
+
+/**
+ * This function writes the digits of value backwards, ending just before end.
+ */
+static inline
+void constats_write_digits ( uint64_t value, char* end )
+{
+	while ( value >= 100 )
+	{
+		const char* pair = constats_digit_pairs + 2 * ( value % 100 );
+		value /= 100;
+
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+
+	if ( value >= 10 )
+	{
+		*--end = constats_digit_pairs[2 * value + 1];
+		*--end = constats_digit_pairs[2 * value];
+	}
+	else
+	{
+		*--end = DTOC(value);
+	}
+}
+
+/**
+ * This function formats value into a field of exactly width characters,
+ * padded with spaces and not null terminated. Values too long for the
+ * field keep their leading digits and get a K, M, G, T, P or E suffix.
+ * It returns -1 if not even that fits.
+ */
+static inline
+int constats_format_field ( int64_t value, char* buf, uint64_t width, int flags )
 {
 	// Error Checking
 	if ( width == 0 )
 		return -1;
 
-	// Negative Symbol
-	if ( value < 0 )
+	int negative = value < 0;
+	uint64_t magnitude = negative ? 0 - (uint64_t) value : (uint64_t) value;
+	uint64_t available = width - negative;
+
+	uint64_t length = constats_count_digits( magnitude );
+	char suffix = 0;
+
+	// Drop digits three at a time, leaving room for the suffix
+	if ( length > available )
+	{
+		uint64_t dropped = ( length - available ) / 3 * 3 + 3;
+
+		if ( dropped >= length )
+			return -1;
+
+		magnitude /= constats_powers_of_ten[dropped];
+		length    -= dropped;
+		suffix     = "KMGTPE"[dropped / 3 - 1];
+	}
+
+	uint64_t used = negative + length + ( suffix != 0 );
+	char* field   = buf;
+
+	if ( flags & CONSTATS_FORMAT_RIGHT )
+	{
+		memset( buf, ' ', width - used );
+		field += width - used;
+	}
+	else
+	{
+		memset( buf + used, ' ', width - used );
+	}
+
+	if ( negative )
+		*field++ = '-';
+
+	constats_write_digits( magnitude, field + length );
+
+	if ( suffix != 0 )
+		field[length] = suffix;
+
+	return 0;
+}
+
+/**
+ * This function truncates (or pads) the given int64_t into a string with given width
+ */
+static inline
+int constats_truncate ( int64_t value, char* buf, uint64_t width )
+{
+	return constats_format_field( value, buf, width, 0 );
+}
+
+/**
+ * This function formats count values into a column, each one a field of
+ * width characters followed by separator. Fields that cannot fit their
+ * value are filled with '#'. It returns the number of bytes written,
+ * always count * ( width + 1 ).
+ */
+static inline
+uint64_t constats_format_column ( const int64_t* values, uint64_t count, char* buf, uint64_t width, char separator, int flags )
+{
+	register uint64_t i;
+	register char* field = buf;
+
+	for ( i = 0; i < count; ++i )
+	{
+		if ( constats_format_field( values[i], field, width, flags ) != 0 )
+			memset( field, '#', width );
+
+		field[width] = separator;
+		field += width + 1;
+	}
+
+	return field - buf;
+}
+
+// Units a value can be scaled into, each step 1000 (1024 for bytes) times the last
+#define CONSTATS_UNIT_NONE  0	// Printed as is
+#define CONSTATS_UNIT_SI    1	// K, M, G, T, P, E
+#define CONSTATS_UNIT_TIME  2	// Nanoseconds up to seconds
+#define CONSTATS_UNIT_BYTES 3	// Bytes up to exabytes
+
+// How constats_print_stats prints its values
+#ifndef CONSTATS_PRINT_UNIT
+#define CONSTATS_PRINT_UNIT CONSTATS_UNIT_NONE
+#endif
+
+#ifndef CONSTATS_PRINT_PRECISION
+#define CONSTATS_PRINT_PRECISION 0
+#endif
+
+// The largest formatted value, including the null terminator
+#define CONSTATS_FORMAT_MAX 40
+
+static const double constats_unit_steps[4] = { 1, 1000, 1000, 1024 };
+
+static const char* const constats_unit_suffixes[4][8] =
+{
+	{ "", NULL },
+	{ "", "K", "M", "G", "T", "P", "E", NULL },
+	{ " ns", " us", " ms", " s", NULL },
+	{ " B", " KB", " MB", " GB", " TB", " PB", " EB", NULL }
+};
+
+/**
+ * This function rounds a non-negative value below 2^64 to precision
+ * decimals (at most 9), splitting it into its integer part and its
+ * fraction times 10^precision. It rounds the exact binary value, ties to
+ * even, as printf does: 0.015 is just below the tie and gives 0.01.
+ */
+static inline
+void constats_round_decimal ( double value, int precision, uint64_t* integer, uint64_t* fraction )
+{
+	if ( precision == 0 )
 	{
-		buf[0] = '-';
-		return constats_truncate ( value <= NINF ? INF : -value, ++buf, --width );
+		*integer  = (uint64_t) rint( value );
+		*fraction = 0;
+		return;
 	}
 
-	uint64_t buf_index   = 0;
-	uint64_t digit_index = 0;
+	double shift = constats_powers_of_ten[precision];
+	*integer = (uint64_t) value;
+
+	// The fraction is exact, and fma gives the exact error of scaling it
+	double part   = value - (double) *integer;
+	double scaled = part * shift;
+	double error  = fma( part, shift, -scaled );
+	double below  = floor( scaled );
+	double half   = ( scaled - below ) - 0.5;
 
-	char digits[21];
-	memset( digits, 0, 21 );
+	*fraction = (uint64_t) below;
 
-	// Turn value into char array
-	while ( value > 0 && digit_index < 20 )
+	// The error is under half an ulp of scaled, so it only decides a tie
+	if ( half > 0 || ( half == 0 && ( error > 0 || ( error == 0 && ( *fraction & 1 ) ) ) ) )
+		( *fraction )++;
+
+	if ( *fraction >= constats_powers_of_ten[precision] )
 	{
-		int64_t digit = value % 10;
-		value = value / 10;
-		digits[digit_index++] = DTOC(digit);
+		( *integer )++;
+		*fraction -= constats_powers_of_ten[precision];
 	}
+}
 
-	// Reverse it into buf
-	while ( width > 0 && digit_index >= 1 )
+/**
+ * This function formats value with precision decimals (at most 9), scaled
+ * to the largest step of unit it reaches, into a null terminated string of
+ * at most CONSTATS_FORMAT_MAX bytes. The digits are those printf's "%.*f"
+ * gives for the scaled value; without a unit they match it exactly. Values
+ * still 2^64 or more after scaling are printed like "%.*e" instead.
+ * It returns the length of the string.
+ */
+static inline
+uint64_t constats_format_double ( double value, char* buf, int precision, int unit )
+{
+	char* end = buf;
+	int level = 0;
+	uint64_t integer, fraction;
+
+	precision = precision < 0 ? 0 : precision > 9 ? 9 : precision;
+
+	if ( value != value )
 	{
-		buf[buf_index++] = digits[--digit_index];
-		--width;
+		strcpy( buf, "nan" );
+		return 3;
 	}
 
-	// Append suffix, if needed
-	if ( digit_index >= 1 )
+	if ( signbit( value ) )
 	{
-		int chars_deleted = 3 - (digit_index % 3);
+		*end++ = '-';
+		value  = -value;
+	}
 
-		buf_index   -= chars_deleted;
-		width       += chars_deleted;
-		digit_index += chars_deleted;
+	if ( isinf( value ) )
+	{
+		strcpy( end, "inf" );
+		return ( end - buf ) + 3;
+	}
 
-		if ( buf_index < 0 )
-			return -1;
+	double step = constats_unit_steps[unit];
 
-		char suffix = ' ';
-
-		if ( digit_index >= 18 )
-			suffix = 'E';
-		else if ( digit_index >= 15 )
-			suffix = 'P';
-		else if ( digit_index >= 12 )
-			suffix = 'T';
-		else if ( digit_index >= 9 )
-			suffix = 'G';
-		else if ( digit_index >= 6 )
-			suffix = 'M';
-		else if ( digit_index >= 3 )
-			suffix = 'K';
-
-		buf[buf_index++] = suffix;
-		width--;
+	while ( value >= step && constats_unit_suffixes[unit][level + 1] != NULL )
+	{
+		value /= step;
+		level++;
 	}
 
-	// Pad with spaces
-	while ( width > 0 )
+	const char* suffix = constats_unit_suffixes[unit][level];
+
+	// Too large for the integer digits, at most 16 bytes before the suffix
+	if ( value >= 18446744073709551616.0 )
 	{
-		buf[buf_index++] = ' ';
-		--width;
+		end += snprintf( end, CONSTATS_FORMAT_MAX - 4, "%.*e", precision, value );
 	}
+	else
+	{
+		constats_round_decimal( value, precision, &integer, &fraction );
+
+		// Rounding up can reach the next step, 999.96 ns is 1.0 us
+		if ( integer >= step && constats_unit_suffixes[unit][level + 1] != NULL )
+		{
+			value /= step;
+			suffix = constats_unit_suffixes[unit][++level];
+			constats_round_decimal( value, precision, &integer, &fraction );
+		}
+
+		uint64_t length = constats_count_digits( integer );
+
+		constats_write_digits( integer, end + length );
+		end += length;
+
+		if ( precision > 0 )
+		{
+			*end++ = '.';
+			memset( end, '0', precision );
+
+			if ( fraction > 0 )
+				constats_write_digits( fraction, end + precision );
+
+			end += precision;
+		}
+	}
+
+	while ( *suffix != '\0' )
+		*end++ = *suffix++;
+
+	*end = '\0';
+	return end - buf;
+}
+
+/**
+ * This function formats a statistic the way constats_print_stats prints it.
+ */
+static inline
+uint64_t constats_format_stat ( double value, char* buf )
+{
+	return constats_format_double( value, buf, CONSTATS_PRINT_PRECISION, CONSTATS_PRINT_UNIT );
+}
+
+/**
+ * This function formats a sample value the way constats_print_stats prints
+ * it. Without a unit it is printed exactly, as a double may not hold it.
+ */
+static inline
+uint64_t constats_format_sample ( int64_t value, char* buf )
+{
+	if ( CONSTATS_PRINT_UNIT != CONSTATS_UNIT_NONE )
+		return constats_format_stat( value, buf );
 
+	uint64_t sign = value < 0;
+	uint64_t magnitude = sign ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+	uint64_t length = sign + constats_count_digits( magnitude );
+
+	buf[0] = '-';
+	constats_write_digits( magnitude, buf + length );
+	buf[length] = '\0';
+	return length;
+}
+
+/**
+ * This function fits a value into a padded field of the given width for
+ * the histogram bars and the summary. Without a unit, values are
+ * truncated to integers with a K, M, G, ... suffix as needed.
+ */
+static inline
+int constats_format_stat_field ( double value, char* buf, uint64_t width )
+{
+	char formatted[CONSTATS_FORMAT_MAX];
+
+	if ( CONSTATS_PRINT_UNIT == CONSTATS_UNIT_NONE )
+		return constats_truncate( value, buf, width );
+
+	uint64_t length = constats_format_stat( value, formatted );
+
+	if ( length > width )
+		return constats_truncate( value, buf, width );
+
+	memcpy( buf, formatted, length );
+	memset( buf + length, ' ', width - length );
 	return 0;
 }
 
@@ -324,8 +746,8 @@ int constats_print_zrange_bar ( int64_t* sample_set, uint64_t sample_size, stats
 	memset( bar + X_count, ' ', 32 - X_count );
 
 	constats_truncate( count, count_str, 12 );
-	constats_truncate( value_below, value_below_str, 13 );
-	constats_truncate( value_above, value_above_str, 13 );
+	constats_format_stat_field( value_below, value_below_str, 13 );
+	constats_format_stat_field( value_above, value_above_str, 13 );
 
 
 	printf ( "%s -> %s : %s : %s\n", value_below_str, value_above_str, bar, count_str );
@@ -359,30 +781,58 @@ int constats_print_zhistogram ( int64_t* sample_set, uint64_t sample_size, stats
 }
 
 /**
- * This function prints statistics of the sample set to stdout.
+ * This function prints the sample size, spread and outlier information
+ * shared by every constats report.
  */
-int constats_print_stats ( int64_t* sample_set, uint64_t sample_size, stats_t* stat )
+static inline
+void constats_print_stats_header ( stats_t* stat )
 {
+	char mean[CONSTATS_FORMAT_MAX];
+	char min[CONSTATS_FORMAT_MAX];
+	char max[CONSTATS_FORMAT_MAX];
+	char stdev[CONSTATS_FORMAT_MAX];
+	char abdev[CONSTATS_FORMAT_MAX];
+
+	constats_format_stat( stat->mean, mean );
+	constats_format_sample( stat->min, min );
+	constats_format_sample( stat->max, max );
+	constats_format_stat( stat->stdev, stdev );
+	constats_format_stat( stat->abdev, abdev );
+
 	printf ( "-------------------------------------------------------------------------------\n" );
 	printf ( "Sample Size            : %lu\n", stat->N );
-	printf ( "Average value          : %.0f\n", stat->mean );
-	printf ( "Minimum value          : %ld\n", stat->min );
-	printf ( "Maximum value          : %ld\n", stat->max );
-	printf ( "Standard Deviation     : %.0f\n", stat->stdev );
-	printf ( "Mean Absolute Deviation: %.0f\n", stat->abdev );
+	printf ( "Average value          : %s\n", mean );
+	printf ( "Minimum value          : %s\n", min );
+	printf ( "Maximum value          : %s\n", max );
+	printf ( "Standard Deviation     : %s\n", stdev );
+	printf ( "Mean Absolute Deviation: %s\n", abdev );
 	printf ( "\n" );
 
 	printf ( "Outlier Count   : %lu\n", stat->outliers );
 	if ( stat->outliers > 0 )
 	{
+		constats_format_stat( stat->norm_mean, mean );
+		constats_format_sample( stat->norm_min, min );
+		constats_format_sample( stat->norm_max, max );
+		constats_format_stat( stat->norm_stdev, stdev );
+		constats_format_stat( stat->norm_abdev, abdev );
+
 		printf ( "Without Outliers:\n");
-		printf ( "\tAverage value          : %.0f\n", stat->norm_mean );
-		printf ( "\tMinimum value          : %ld\n", stat->norm_min );
-		printf ( "\tMaximum value          : %ld\n", stat->norm_max );
-		printf ( "\tStandard Deviation     : %.0f\n", stat->norm_stdev );
-		printf ( "\tMean Absolute Deviation: %.0f\n", stat->norm_abdev );
+		printf ( "\tAverage value          : %s\n", mean );
+		printf ( "\tMinimum value          : %s\n", min );
+		printf ( "\tMaximum value          : %s\n", max );
+		printf ( "\tStandard Deviation     : %s\n", stdev );
+		printf ( "\tMean Absolute Deviation: %s\n", abdev );
 	}
 	printf ( "\n" );
+}
+
+/**
+ * This function prints statistics of the sample set to stdout.
+ */
+int constats_print_stats ( int64_t* sample_set, uint64_t sample_size, stats_t* stat )
+{
+	constats_print_stats_header( stat );
 
 	constats_print_zhistogram( sample_set, sample_size, stat );
 	printf ( "\n" );
@@ -397,9 +847,9 @@ int constats_print_stats ( int64_t* sample_set, uint64_t sample_size, stats_t* s
 	memset( max, 0, 15 );
 	memset( mean, 0, 15 );
 
-	constats_truncate( stat->min, min, 14 );
-	constats_truncate( stat->max, max, 14 );
-	constats_truncate( stat->mean, mean, 14 );
+	constats_format_stat_field( stat->min, min, 14 );
+	constats_format_stat_field( stat->max, max, 14 );
+	constats_format_stat_field( stat->mean, mean, 14 );
 
 	printf ( "min : %s || max : %s || mean : %s\n", min, max, mean );
 
@@ -409,9 +859,9 @@ int constats_print_stats ( int64_t* sample_set, uint64_t sample_size, stats_t* s
 		memset( max, 0, 15 );
 		memset( mean, 0, 15 );
 
-		constats_truncate( stat->norm_min, min, 14 );
-		constats_truncate( stat->norm_max, max, 14 );
-		constats_truncate( stat->norm_mean, mean, 14 );
+		constats_format_stat_field( stat->norm_min, min, 14 );
+		constats_format_stat_field( stat->norm_max, max, 14 );
+		constats_format_stat_field( stat->norm_mean, mean, 14 );
 
 		printf ( "Nmin: %s || Nmax: %s || Nmean: %s\n", min, max, mean );
 	}
@@ -0,0 +1,217 @@
+/**
+ * @File     : constats.hpp
+ * @Author   : Abdullah Younis
+ *
+ * This library is the C++ interface to constats. It needs C++20 and wraps
+ * the C routines, so serial results are the same as theirs bit for bit.
+ * The parallel policies add partial sums in another order and may differ
+ * from the serial result in the last bits, as constats_parallel.h explains.
+ *
+ * constats::calculate_stats takes an optional standard execution policy
+ * first, like the standard algorithms do:
+ *
+ *   seq, unseq        the serial routine. Its loops are simple enough for
+ *                     the compiler to vectorize, so there is no separate
+ *                     SIMD routine for unseq to pick.
+ *   par, par_unseq    constats_calculate_stats_parallel, on the given pool
+ *                     or the process-wide one (constats_pool.h), when the
+ *                     samples are contiguous, and serial otherwise.
+ *
+ * Any range of integers works as well as a span. Contiguous ranges of
+ * int64_t go straight to the C routines. Other forward ranges, such as
+ * transform and filter views, are walked in place with the same passes
+ * and give the same result, without copying the samples out. An input
+ * range can only be read once, so it goes through an accumulator_t and
+ * gets no absolute deviation or outlier information, as documented in
+ * constats_accumulator.h. Its mean and deviation are updated one sample
+ * at a time, so they agree with the passes to rounding, not bit for bit.
+ *
+ * An empty sample set gives a stats_t with N = 0.
+ */
+
+#ifndef CONSTATS_HPP_LIB_LOCK
+#define CONSTATS_HPP_LIB_LOCK
+
+#include <concepts>
+#include <cstdint>
+#include <execution>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// The C headers keep their register hints, which C++17 dropped
+#if defined( __GNUC__ )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wregister"
+#endif
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_parallel.h"
+
+#if defined( __GNUC__ )
+#pragma GCC diagnostic pop
+#endif
+
+namespace constats
+{
+	using ::stats_t;
+	using ::pool_t;
+
+	template <class T>
+	concept execution_policy = std::is_execution_policy_v<std::remove_cvref_t<T>>;
+
+	template <class R>
+	concept sample_range = std::ranges::input_range<R> && std::integral<std::ranges::range_value_t<R>>;
+
+	template <class R>
+	concept contiguous_samples = std::ranges::contiguous_range<R> && std::ranges::sized_range<R>
+	                          && std::is_same_v<std::ranges::range_value_t<R>, int64_t>;
+
+	template <class T>
+	concept parallel_policy = std::is_same_v<std::remove_cvref_t<T>, std::execution::parallel_policy>
+	                       || std::is_same_v<std::remove_cvref_t<T>, std::execution::parallel_unsequenced_policy>;
+
+	/**
+	 * This function calculates the statistics of a sample set serially.
+	 */
+	inline
+	stats_t calculate_stats ( std::span<const int64_t> samples )
+	{
+		stats_t stat = {};
+
+		// The C routines only read the samples
+		if ( !samples.empty() )
+			constats_calculate_stats( const_cast<int64_t*>( samples.data() ), samples.size(), &stat );
+
+		return stat;
+	}
+
+	/**
+	 * This function is constats_calculate_stats over a forward range, which
+	 * it walks once for the mean, over its first sixteenth for the
+	 * tolerance, and twice more with the C routine's pass steps.
+	 */
+	template <std::ranges::forward_range R>
+	stats_t calculate_stats_passes ( R& samples )
+	{
+		stats_t stat = {};
+		stats_pass_t pass;
+		uint64_t size = std::ranges::distance( samples );
+
+		// Error Checking
+		if ( size == 0 )
+			return stat;
+
+		double sum = 0;
+
+		for ( auto&& sample : samples )
+			sum += static_cast<int64_t>( sample );
+
+		stat.N    = size;
+		stat.mean = sum / (double) size;
+
+		// The same float sketch as constats_get_tolerance, block by block
+		uint64_t sketch_size = constats_sketch_size( size );
+		uint64_t count = 0;
+		float sketch_sum = 0;
+		float block_sum = 0;
+		float sketch_mean;
+
+		auto sketch = std::views::take( std::views::all( samples ), sketch_size );
+
+		for ( auto&& sample : sketch )
+		{
+			block_sum += static_cast<int64_t>( sample );
+
+			if ( ++count % CONSTATS_SKETCH_BLOCK == 0 )
+				sketch_sum += std::exchange( block_sum, 0.0f );
+		}
+
+		sketch_sum += block_sum;
+		sketch_mean = sketch_sum / (float) sketch_size;
+
+		for ( count = 0, sketch_sum = 0, block_sum = 0; auto&& sample : sketch )
+		{
+			block_sum += ABSOLUTE( static_cast<int64_t>( sample ) - sketch_mean );
+
+			if ( ++count % CONSTATS_SKETCH_BLOCK == 0 )
+				sketch_sum += std::exchange( block_sum, 0.0f );
+		}
+
+		sketch_sum += block_sum;
+
+		stat.tolerance = constats_sketch_tolerance( sketch_sum, sketch_size );
+
+		constats_pass_init( &pass, stat.mean, stat.tolerance );
+
+		for ( auto&& sample : samples )
+			constats_pass_deviation( &pass, static_cast<int64_t>( sample ) );
+
+		constats_pass_deviations_done( &pass, size, &stat );
+
+		for ( auto&& sample : samples )
+			constats_pass_norm( &pass, static_cast<int64_t>( sample ) );
+
+		constats_pass_norm_done( &pass, size, &stat );
+		return stat;
+	}
+
+	/**
+	 * This function calculates the statistics of any range of integers,
+	 * reading an input range only once.
+	 */
+	template <sample_range R>
+	stats_t calculate_stats ( R&& samples )
+	{
+		if constexpr ( contiguous_samples<R> )
+		{
+			return calculate_stats( std::span<const int64_t>( std::ranges::data( samples ), std::ranges::size( samples ) ) );
+		}
+		else if constexpr ( std::ranges::forward_range<R> )
+		{
+			return calculate_stats_passes( samples );
+		}
+		else
+		{
+			accumulator_t acc;
+			stats_t stat = {};
+
+			constats_accumulator_init( &acc );
+
+			for ( auto&& sample : samples )
+				constats_accumulator_add( &acc, static_cast<int64_t>( sample ) );
+
+			constats_accumulator_calculate_stats( &acc, &stat );
+			return stat;
+		}
+	}
+
+	/**
+	 * This function calculates the statistics of a sample set as the policy
+	 * allows. Parallel policies run on pool, NULL for the process-wide pool,
+	 * when the samples are a contiguous run of int64_t. Any other range is
+	 * read serially.
+	 */
+	template <execution_policy Policy, sample_range R>
+	stats_t calculate_stats ( Policy&&, R&& samples, pool_t* pool = nullptr )
+	{
+		if constexpr ( parallel_policy<Policy> && contiguous_samples<R> )
+		{
+			stats_t stat = {};
+
+			if ( std::ranges::size( samples ) > 0 )
+				constats_calculate_stats_parallel( const_cast<int64_t*>( std::ranges::data( samples ) ), std::ranges::size( samples ), &stat, pool );
+
+			return stat;
+		}
+		else
+		{
+			return calculate_stats( std::forward<R>( samples ) );
+		}
+	}
+}
+
+#endif
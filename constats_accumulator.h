@@ -0,0 +1,153 @@
+/**
+ * @File     : constats_accumulator.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a streaming accumulator, which keeps a running
+ * mean and sum of squared deviations instead of the samples themselves.
+ * Samples are added with Welford's update and accumulators are merged with
+ * Chan's pairwise formula, so the deviation stays accurate far from zero,
+ * where a sum of squares would cancel. Accumulators are cheap to update and
+ * to merge, and produce a stats_t without outlier information: the
+ * absolute deviation is not tracked, no samples are classified as
+ * outliers, and the norm_ fields repeat the plain ones.
+ */
+
+#ifndef CONSTATS_ACCUMULATOR_LIB_LOCK
+#define CONSTATS_ACCUMULATOR_LIB_LOCK
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "constats.h"
+
+typedef struct accumulator_t
+{
+	uint64_t N;			// The number of samples added
+	double mean;		// The mean of the samples
+	double m2;			// The sum of the squared deviations from the mean
+	int64_t min;		// The minimum sample
+	int64_t max;		// The maximum sample
+
+} accumulator_t;
+
+/**
+ * This function empties the accumulator.
+ */
+static inline
+void constats_accumulator_init ( accumulator_t* acc )
+{
+	acc->N      = 0;
+	acc->mean   = 0;
+	acc->m2     = 0;
+	acc->min    = INF;
+	acc->max    = NINF;
+}
+
+/**
+ * This function adds one sample to the accumulator.
+ */
+static inline
+void constats_accumulator_add ( accumulator_t* acc, int64_t sample )
+{
+	double delta = sample - acc->mean;
+
+	acc->N++;
+	acc->mean += delta / (double) acc->N;
+	acc->m2   += delta * ( sample - acc->mean );
+
+	if ( sample < acc->min )
+		acc->min = sample;
+
+	if ( sample > acc->max )
+		acc->max = sample;
+}
+
+/**
+ * This function adds every sample in src to dst.
+ */
+static inline
+void constats_accumulator_merge ( accumulator_t* dst, const accumulator_t* src )
+{
+	// Error Checking
+	if ( src->N == 0 )
+		return;
+
+	uint64_t N   = dst->N + src->N;
+	double delta = src->mean - dst->mean;
+
+	dst->mean += delta * ( (double) src->N / (double) N );
+	dst->m2   += src->m2 + delta * delta * ( (double) dst->N * (double) src->N / (double) N );
+	dst->N     = N;
+
+	if ( src->min < dst->min )
+		dst->min = src->min;
+
+	if ( src->max > dst->max )
+		dst->max = src->max;
+}
+
+/**
+ * This function populates the stat data structure from the accumulator.
+ */
+static inline
+int constats_accumulator_calculate_stats ( const accumulator_t* acc, stats_t* stat )
+{
+	// Error Checking
+	if ( stat == NULL || acc->N == 0 )
+		return -1;
+
+	double variance = acc->m2 / (double) acc->N;
+
+	stat->N         = acc->N;
+	stat->mean      = acc->mean;
+	stat->stdev     = variance > 0 ? sqrt( variance ) : 0;
+	stat->abdev     = 0;
+	stat->min       = acc->min;
+	stat->max       = acc->max;
+
+	stat->tolerance = INF;
+	stat->outliers  = 0;
+
+	stat->norm_mean  = stat->mean;
+	stat->norm_stdev = stat->stdev;
+	stat->norm_abdev = stat->abdev;
+	stat->norm_min   = stat->min;
+	stat->norm_max   = stat->max;
+
+	return 0;
+}
+
+/**
+ * This function prints the accumulator's statistics to stdout.
+ * There are no samples, so unlike constats_print_stats there is no histogram.
+ */
+static inline
+int constats_accumulator_print_stats ( const accumulator_t* acc )
+{
+	char mean[CONSTATS_FORMAT_MAX];
+	char min[CONSTATS_FORMAT_MAX];
+	char max[CONSTATS_FORMAT_MAX];
+	char stdev[CONSTATS_FORMAT_MAX];
+	stats_t stat;
+
+	if ( constats_accumulator_calculate_stats( acc, &stat ) != 0 )
+		return -1;
+
+	constats_format_stat( stat.mean, mean );
+	constats_format_sample( stat.min, min );
+	constats_format_sample( stat.max, max );
+	constats_format_stat( stat.stdev, stdev );
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+	printf ( "Sample Size            : %lu\n", stat.N );
+	printf ( "Average value          : %s\n", mean );
+	printf ( "Minimum value          : %s\n", min );
+	printf ( "Maximum value          : %s\n", max );
+	printf ( "Standard Deviation     : %s\n", stdev );
+	printf ( "-------------------------------------------------------------------------------\n" );
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,411 @@
+/**
+ * @File     : constats_bench.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a benchmark harness. It calls a function a fixed
+ * number of times, recording the nanoseconds each call took and, with
+ * CONSTATS_BENCH_COUNTERS, the hardware counter deltas of each call. Each
+ * metric produces its own stats_t.
+ *
+ * constats_bench_scaling runs the same function on 1 to N threads, all
+ * released together once every one is set up, and reports per-call stats, throughput
+ * and parallel efficiency for each thread count.
+ */
+
+#ifndef CONSTATS_BENCH_LIB_LOCK
+#define CONSTATS_BENCH_LIB_LOCK
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_clock.h"
+#include "constats_perf.h"
+#include "constats_recorder.h"
+
+// Starts a scaling thread, and can be replaced to test failures
+#ifndef CONSTATS_BENCH_THREAD_CREATE
+#define CONSTATS_BENCH_THREAD_CREATE pthread_create
+#endif
+
+// Bench flags
+#define CONSTATS_BENCH_COUNTERS 0x1	// Also sample hardware counters around each call
+
+// Metrics, the counters use their CONSTATS_PERF_ index
+#define CONSTATS_BENCH_TIME CONSTATS_PERF_COUNTERS
+
+typedef struct bench_t
+{
+	uint64_t iterations;							// The number of calls per run
+	int flags;										// The flags the bench was created with
+
+	perf_counters_t perf;							// The counters, if requested
+	recorder_t time;								// The nanoseconds of each call
+	recorder_t counters[CONSTATS_PERF_COUNTERS];	// The counter deltas of each call
+
+} bench_t;
+
+/**
+ * This function prepares a bench that runs iterations calls.
+ */
+static inline
+int constats_bench_init ( bench_t* bench, uint64_t iterations, int flags )
+{
+	int i;
+
+	// Error Checking
+	if ( bench == NULL || iterations == 0 )
+		return -1;
+
+	memset( bench, 0, sizeof( bench_t ) );
+	bench->iterations = iterations;
+	bench->flags      = flags;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+		bench->perf.fd[i] = -1;
+
+	if ( constats_recorder_init( &bench->time, iterations, CONSTATS_RECORDER_PREFAULT ) != 0 )
+		return -1;
+
+	if ( flags & CONSTATS_BENCH_COUNTERS )
+	{
+		constats_perf_open( &bench->perf );
+
+		for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+		{
+			if ( bench->perf.fd[i] == -1 )
+				continue;
+
+			if ( constats_recorder_init( &bench->counters[i], iterations, CONSTATS_RECORDER_PREFAULT ) != 0 )
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * This function releases the bench's recorders and counters.
+ */
+static inline
+int constats_bench_destroy ( bench_t* bench )
+{
+	int i;
+
+	constats_recorder_destroy( &bench->time );
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+		if ( bench->counters[i].samples != NULL )
+			constats_recorder_destroy( &bench->counters[i] );
+
+	constats_perf_close( &bench->perf );
+	return 0;
+}
+
+/**
+ * This function calls fn( arg ) once per iteration, recording every metric.
+ * Samples from an earlier run are discarded.
+ */
+static inline
+int constats_bench_run ( bench_t* bench, void (*fn)( void* ), void* arg )
+{
+	uint64_t before[CONSTATS_PERF_COUNTERS];
+	uint64_t after[CONSTATS_PERF_COUNTERS];
+	double ns_per_tick = constats_clock_ns_per_tick();
+	double overhead_ns = constats_clock_subtracted_ns();
+	int counters = bench->perf.opened > 0;
+	uint64_t n;
+	int i;
+
+	constats_recorder_reset( &bench->time );
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+		if ( bench->counters[i].samples != NULL )
+			constats_recorder_reset( &bench->counters[i] );
+
+	for ( n = 0; n < bench->iterations; ++n )
+	{
+		if ( counters )
+			constats_perf_read( &bench->perf, before );
+
+		uint64_t start = constats_clock_ticks();
+		fn( arg );
+		uint64_t end = constats_clock_ticks();
+
+		constats_recorder_record( &bench->time, constats_clock_elapsed_ns( end - start, ns_per_tick, overhead_ns ) );
+
+		if ( !counters )
+			continue;
+
+		constats_perf_read( &bench->perf, after );
+
+		for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+			if ( bench->counters[i].samples != NULL )
+				constats_recorder_record( &bench->counters[i], (int64_t) ( after[i] - before[i] ) );
+	}
+
+	return 0;
+}
+
+/**
+ * This function populates the stat data structure with one metric of the last run.
+ */
+static inline
+int constats_bench_calculate_stats ( bench_t* bench, int metric, stats_t* stat )
+{
+	// Error Checking
+	if ( bench == NULL || metric < 0 || metric > CONSTATS_BENCH_TIME )
+		return -1;
+
+	recorder_t* recorder = metric == CONSTATS_BENCH_TIME ? &bench->time : &bench->counters[metric];
+
+	if ( recorder->samples == NULL )
+		return -1;
+
+	return constats_calculate_stats ( recorder->samples, recorder->count, stat );
+}
+
+/**
+ * This function prints every metric of the last run.
+ */
+static inline
+int constats_bench_print ( bench_t* bench, const char* name )
+{
+	int i;
+
+	printf ( "Benchmark              : %s\n", name );
+	printf ( "Time (ns)              :\n" );
+	constats_clock_print_resolution_warning( bench->time.samples, bench->time.count, CONSTATS_CLOCK_TICKS );
+	constats_recorder_get_and_print_stats( &bench->time );
+
+	if ( !( bench->flags & CONSTATS_BENCH_COUNTERS ) )
+		return 0;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+		if ( bench->counters[i].samples == NULL )
+		{
+			printf ( "%-23s: unavailable\n", constats_perf_names[i] );
+			continue;
+		}
+
+		printf ( "%-23s:\n", constats_perf_names[i] );
+		constats_recorder_get_and_print_stats( &bench->counters[i] );
+	}
+
+	return 0;
+}
+
+typedef struct scaling_point_t
+{
+	int threads;			// The number of threads running the function
+	stats_t stats;			// The nanoseconds per call, across all threads
+	double seconds;			// The time from the first start to the last finish
+	double throughput;		// The calls completed per second
+	double efficiency;		// The throughput over threads times the 1 thread throughput
+
+} scaling_point_t;
+
+typedef struct scaling_gate_t
+{
+	pthread_mutex_t lock;		// Guards the fields below
+	pthread_cond_t changed;		// Signalled when ready or state changes
+	int ready;					// The workers waiting to start
+	int state;					// 0 to wait, 1 to start, -1 to give up
+
+} scaling_gate_t;
+
+typedef struct scaling_worker_t
+{
+	void (*fn)( void* );		// The function under test
+	void* arg;					// Its argument
+	uint64_t iterations;		// The calls to time
+	scaling_gate_t* gate;		// The gate releasing every worker at once
+	recorder_t recorder;		// The nanoseconds of each call on this thread
+	uint64_t first;				// The tick count when this thread started
+	uint64_t last;				// The tick count when this thread finished
+	int error;					// Whether the recorder could not be allocated
+
+} scaling_worker_t;
+
+/**
+ * This function runs one thread of a scaling sweep. The worker allocates
+ * and prefaults its own recorder, so the pages are local to it, and does
+ * so before the gate opens so allocation and page faults stay out of the
+ * timing.
+ */
+static inline
+void* constats_bench_scaling_worker ( void* data )
+{
+	scaling_worker_t* worker = (scaling_worker_t*) data;
+	scaling_gate_t* gate = worker->gate;
+	double ns_per_tick = constats_clock_ns_per_tick();
+	double overhead_ns = constats_clock_subtracted_ns();
+	uint64_t n;
+
+	worker->error = constats_recorder_init( &worker->recorder, worker->iterations, CONSTATS_RECORDER_PREFAULT ) != 0;
+
+	pthread_mutex_lock( &gate->lock );
+	gate->ready++;
+	pthread_cond_broadcast( &gate->changed );
+
+	while ( gate->state == 0 )
+		pthread_cond_wait( &gate->changed, &gate->lock );
+
+	int state = gate->state;
+	pthread_mutex_unlock( &gate->lock );
+
+	if ( worker->error || state < 0 )
+		return NULL;
+
+	worker->first = constats_clock_ticks();
+
+	for ( n = 0; n < worker->recorder.capacity; ++n )
+	{
+		uint64_t start = constats_clock_ticks();
+		worker->fn( worker->arg );
+		uint64_t end = constats_clock_ticks();
+
+		constats_recorder_record( &worker->recorder, constats_clock_elapsed_ns( end - start, ns_per_tick, overhead_ns ) );
+	}
+
+	worker->last = constats_clock_ticks();
+	return NULL;
+}
+
+/**
+ * This function runs fn( arg ) iterations times on every thread, for
+ * every thread count from 1 to max_threads, filling points[0 .. max_threads-1].
+ * If a thread cannot be started, the threads already started are released
+ * without running and -1 is returned.
+ */
+static inline
+int constats_bench_scaling ( void (*fn)( void* ), void* arg, uint64_t iterations, int max_threads, scaling_point_t* points )
+{
+	// Error Checking
+	if ( fn == NULL || points == NULL || iterations == 0 || max_threads <= 0 )
+		return -1;
+
+	scaling_worker_t* workers = (scaling_worker_t*) calloc( max_threads, sizeof( scaling_worker_t ) );
+	pthread_t* threads        = (pthread_t*) calloc( max_threads, sizeof( pthread_t ) );
+	int64_t* samples          = (int64_t*) malloc( iterations * max_threads * sizeof( int64_t ) );
+	double ns_per_tick        = constats_clock_ns_per_tick();
+	int error_code            = 0;
+	int count;
+	int i;
+
+	if ( workers == NULL || threads == NULL || samples == NULL )
+	{
+		free( workers );
+		free( threads );
+		free( samples );
+		return -1;
+	}
+
+	for ( count = 1; count <= max_threads && error_code == 0; ++count )
+	{
+		scaling_gate_t gate;
+		int started;
+
+		pthread_mutex_init( &gate.lock, NULL );
+		pthread_cond_init( &gate.changed, NULL );
+		gate.ready = 0;
+		gate.state = 0;
+
+		for ( started = 0; started < count; ++started )
+		{
+			workers[started].fn         = fn;
+			workers[started].arg        = arg;
+			workers[started].iterations = iterations;
+			workers[started].gate       = &gate;
+			workers[started].error      = 0;
+
+			if ( CONSTATS_BENCH_THREAD_CREATE( &threads[started], NULL, constats_bench_scaling_worker, &workers[started] ) != 0 )
+			{
+				error_code = -1;
+				break;
+			}
+		}
+
+		// Open the gate once every worker is set up, or give up
+		pthread_mutex_lock( &gate.lock );
+
+		while ( error_code == 0 && gate.ready < started )
+			pthread_cond_wait( &gate.changed, &gate.lock );
+
+		gate.state = error_code == 0 ? 1 : -1;
+		pthread_cond_broadcast( &gate.changed );
+		pthread_mutex_unlock( &gate.lock );
+
+		uint64_t first = UINT64_MAX;
+		uint64_t last  = 0;
+		uint64_t total = 0;
+
+		for ( i = 0; i < started; ++i )
+		{
+			pthread_join( threads[i], NULL );
+
+			if ( workers[i].error )
+			{
+				error_code = -1;
+				continue;
+			}
+
+			if ( workers[i].first < first )
+				first = workers[i].first;
+
+			if ( workers[i].last > last )
+				last = workers[i].last;
+
+			memcpy( samples + total, workers[i].recorder.samples, workers[i].recorder.count * sizeof( int64_t ) );
+			total += workers[i].recorder.count;
+			constats_recorder_destroy( &workers[i].recorder );
+		}
+
+		pthread_cond_destroy( &gate.changed );
+		pthread_mutex_destroy( &gate.lock );
+
+		if ( error_code != 0 )
+			break;
+
+		// A clock too coarse to see the run still counts one tick
+		uint64_t ticks = last > first ? last - first : 1;
+
+		scaling_point_t* point = &points[count - 1];
+		point->threads    = count;
+		point->seconds    = ticks * ns_per_tick / 1e9;
+		point->throughput = total / point->seconds;
+		point->efficiency = point->throughput / ( count * points[0].throughput );
+
+		error_code = constats_calculate_stats ( samples, total, &point->stats );
+	}
+
+	free( workers );
+	free( threads );
+	free( samples );
+	return error_code;
+}
+
+/**
+ * This function prints a scaling sweep as a table, one row per thread count.
+ */
+static inline
+int constats_bench_print_scaling ( scaling_point_t* points, int count )
+{
+	int i;
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+	printf ( "%7s %12s %12s %12s %14s %10s\n", "Threads", "Mean (ns)", "Stdev (ns)", "Max (ns)", "Calls/s", "Efficiency" );
+
+	for ( i = 0; i < count; ++i )
+		printf ( "%7d %12.0f %12.0f %12ld %14.0f %9.1f%%\n", points[i].threads, points[i].stats.mean,
+		         points[i].stats.stdev, points[i].stats.max, points[i].throughput, 100 * points[i].efficiency );
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+	return 0;
+}
+
+#endif
@@ -0,0 +1,507 @@
+/**
+ * @File     : constats_checkpoint.h
+ * @Author   : Abdullah Younis
+ *
+ * This library lets long runs survive a crash or restart without losing
+ * what they have measured. Both halves work on shared file mappings, so
+ * everything written reaches the page cache without a syscall and
+ * survives the process dying; pass CONSTATS_CHECKPOINT_DURABLE to also
+ * msync, which is only needed to survive the machine going down.
+ *
+ * Accumulators and histograms are saved into a checkpoint file: a ring of
+ * slots, each holding one constats_wire.h encoding, a checksum and a
+ * generation. A save always goes to the slot after the newest one, which
+ * is invalidated first and validated last, so the newest complete
+ * checkpoint is never overwritten and a save cut short is simply ignored.
+ * Restoring picks the slot with the highest generation whose checksum
+ * matches.
+ *
+ * Recorders can be backed by a file directly. Samples are written into
+ * the mapping as they are recorded, and constats_checkpoint_recorder_sync
+ * publishes how many of them are valid. Reopening the file resumes after
+ * the last synced sample.
+ *
+ * Both kinds of file start with a header page, sized to this system's
+ * pages. A file is only ever set up when it is new or empty: opening a
+ * file that holds anything else, or a checkpoint or recording from
+ * another version or page size, fails and leaves the file as it was.
+ */
+
+#ifndef CONSTATS_CHECKPOINT_LIB_LOCK
+#define CONSTATS_CHECKPOINT_LIB_LOCK
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_histogram.h"
+#include "constats_recorder.h"
+#include "constats_wire.h"
+
+#define CONSTATS_CHECKPOINT_MAGIC   0x544e504b43434e43UL	// "CNCCKPNT"
+#define CONSTATS_RECORDING_MAGIC    0x44524345524e4e43UL	// "CNNRECRD"
+#define CONSTATS_CHECKPOINT_VERSION 2
+
+// Checkpoint flags
+#define CONSTATS_CHECKPOINT_DURABLE 0x1	// msync every save, so it survives a power loss
+
+#ifndef CONSTATS_CHECKPOINT_SLOTS
+#define CONSTATS_CHECKPOINT_SLOTS 4
+#endif
+
+typedef struct checkpoint_slot_t
+{
+	uint64_t generation;	// The save that filled the slot, 0 while it is being written
+	uint64_t length;		// The number of encoded bytes
+	uint64_t checksum;		// FNV-1a of the encoded bytes
+
+} checkpoint_slot_t;
+
+typedef struct checkpoint_header_t
+{
+	uint64_t magic;			// CONSTATS_CHECKPOINT_MAGIC
+	uint32_t version;		// CONSTATS_CHECKPOINT_VERSION
+	uint32_t slots;			// The number of slots in the ring
+	uint64_t slot_size;		// The size of each slot, including its checkpoint_slot_t
+	uint64_t page_size;		// The size of the header page, which the slots follow
+
+} checkpoint_header_t;
+
+typedef struct checkpoint_t
+{
+	checkpoint_header_t* header;	// The mapped file
+	uint64_t size;					// The size of the mapping
+	uint64_t generation;			// The newest generation in the ring
+	int flags;						// The flags the checkpoint was opened with
+
+} checkpoint_t;
+
+typedef struct recording_header_t
+{
+	uint64_t magic;			// CONSTATS_RECORDING_MAGIC
+	uint32_t version;		// CONSTATS_CHECKPOINT_VERSION
+	uint32_t page_size;		// The size of the header page, which the samples follow
+	uint64_t capacity;		// The number of samples the file can hold
+	uint64_t count;			// The number of valid samples, as of the last sync
+	uint64_t dropped;		// The number of dropped samples, as of the last sync
+
+} recording_header_t;
+
+/**
+ * This function returns the FNV-1a hash of a buffer.
+ */
+static inline
+uint64_t constats_checkpoint_checksum ( const uint8_t* buffer, uint64_t size )
+{
+	register uint64_t hash = 0xcbf29ce484222325UL;
+	register uint64_t i;
+
+	for ( i = 0; i < size; ++i )
+		hash = ( hash ^ buffer[i] ) * 0x100000001b3UL;
+
+	return hash;
+}
+
+/**
+ * This function reads the first size bytes of the file at path into
+ * header. It returns 1 if it did, 0 if the file is missing, empty, or
+ * starts with a zeroed header left by a set up that never finished, and
+ * -1 if it is shorter than that or cannot be read.
+ */
+static inline
+int constats_checkpoint_peek ( const char* path, void* header, uint64_t size )
+{
+	struct stat st;
+	int found = -1;
+
+	int fd = open( path, O_RDONLY );
+
+	if ( fd < 0 )
+		return errno == ENOENT ? 0 : -1;
+
+	if ( fstat( fd, &st ) == 0 )
+	{
+		if ( st.st_size == 0 )
+			found = 0;
+		else if ( (uint64_t) st.st_size >= size && pread( fd, header, size, 0 ) == (ssize_t) size )
+			found = 1;
+	}
+
+	close( fd );
+
+	if ( found == 1 )
+	{
+		const uint8_t* bytes = (const uint8_t*) header;
+		uint64_t i;
+
+		for ( i = 0; i < size && bytes[i] == 0; ++i );
+
+		if ( i == size )
+			found = 0;
+	}
+
+	return found;
+}
+
+/**
+ * This function maps a file of the given size, creating or growing it as
+ * needed. It returns MAP_FAILED on failure.
+ */
+static inline
+void* constats_checkpoint_map ( const char* path, uint64_t size, int populate )
+{
+	struct stat st;
+
+	int fd = open( path, O_CREAT | O_RDWR, 0644 );
+
+	if ( fd < 0 )
+		return MAP_FAILED;
+
+	if ( fstat( fd, &st ) != 0 || ( (uint64_t) st.st_size < size && ftruncate( fd, size ) != 0 ) )
+	{
+		close( fd );
+		return MAP_FAILED;
+	}
+
+#ifdef MAP_POPULATE
+	populate = populate ? MAP_POPULATE : 0;
+#else
+	populate = 0;
+#endif
+
+	void* mapping = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | populate, fd, 0 );
+	close( fd );
+	return mapping;
+}
+
+/**
+ * This function returns a slot of the ring.
+ */
+static inline
+checkpoint_slot_t* constats_checkpoint_slot ( checkpoint_t* cp, uint64_t index )
+{
+	return (checkpoint_slot_t*) ( (uint8_t*) cp->header + cp->header->page_size + index * cp->header->slot_size );
+}
+
+/**
+ * This function opens the checkpoint file at path, creating it if it does
+ * not exist. Each slot holds up to capacity encoded bytes; use
+ * CONSTATS_WIRE_HISTOGRAM_MAX to be sure any histogram fits. An existing
+ * checkpoint keeps its own geometry, and its newest checkpoint can be
+ * restored. Any other non-empty file is refused.
+ */
+static inline
+int constats_checkpoint_open ( checkpoint_t* cp, const char* path, uint64_t capacity, int flags )
+{
+	uint64_t i;
+
+	// Error Checking
+	if ( cp == NULL || path == NULL || capacity == 0 )
+		return -1;
+
+	memset( cp, 0, sizeof( checkpoint_t ) );
+
+	checkpoint_header_t existing;
+	uint64_t page      = constats_recorder_page_size();
+	uint64_t slot_size = ( sizeof( checkpoint_slot_t ) + capacity + 7 ) & ~7UL;
+	uint64_t size      = page + CONSTATS_CHECKPOINT_SLOTS * slot_size;
+	int found          = constats_checkpoint_peek( path, &existing, sizeof( existing ) );
+
+	if ( found < 0 )
+		return -1;
+
+	// Reuse the geometry the file was created with, and touch nothing else
+	if ( found )
+	{
+		if ( existing.magic != CONSTATS_CHECKPOINT_MAGIC || existing.version != CONSTATS_CHECKPOINT_VERSION
+		  || existing.page_size != page || existing.slots == 0 || existing.slot_size <= sizeof( checkpoint_slot_t ) )
+			return -1;
+
+		size = page + existing.slots * existing.slot_size;
+	}
+
+	void* mapping = constats_checkpoint_map( path, size, 0 );
+
+	if ( mapping == MAP_FAILED )
+		return -1;
+
+	cp->header = (checkpoint_header_t*) mapping;
+	cp->size   = size;
+	cp->flags  = flags;
+
+	if ( !found )
+	{
+		memset( cp->header, 0, size );
+		cp->header->version   = CONSTATS_CHECKPOINT_VERSION;
+		cp->header->slots     = CONSTATS_CHECKPOINT_SLOTS;
+		cp->header->slot_size = slot_size;
+		cp->header->page_size = page;
+		cp->header->magic     = CONSTATS_CHECKPOINT_MAGIC;
+
+		if ( flags & CONSTATS_CHECKPOINT_DURABLE )
+			msync( cp->header, size, MS_SYNC );
+	}
+
+	for ( i = 0; i < cp->header->slots; ++i )
+	{
+		uint64_t generation = constats_checkpoint_slot( cp, i )->generation;
+
+		if ( generation > cp->generation )
+			cp->generation = generation;
+	}
+
+	return 0;
+}
+
+/**
+ * This function unmaps the checkpoint file.
+ */
+static inline
+int constats_checkpoint_close ( checkpoint_t* cp )
+{
+	// Error Checking
+	if ( cp == NULL || cp->header == NULL )
+		return -1;
+
+	munmap( cp->header, cp->size );
+	cp->header = NULL;
+	return 0;
+}
+
+/**
+ * This function returns the slot the next save goes to, already
+ * invalidated, and the number of bytes it can hold.
+ */
+static inline
+checkpoint_slot_t* constats_checkpoint_begin ( checkpoint_t* cp, uint64_t* capacity )
+{
+	checkpoint_slot_t* slot = constats_checkpoint_slot( cp, ( cp->generation + 1 ) % cp->header->slots );
+
+	__atomic_store_n( &slot->generation, 0, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	*capacity = cp->header->slot_size - sizeof( checkpoint_slot_t );
+	return slot;
+}
+
+/**
+ * This function validates a slot filled with length encoded bytes.
+ */
+static inline
+int constats_checkpoint_commit ( checkpoint_t* cp, checkpoint_slot_t* slot, uint64_t length )
+{
+	slot->length   = length;
+	slot->checksum = constats_checkpoint_checksum( (uint8_t*) ( slot + 1 ), length );
+
+	__atomic_store_n( &slot->generation, cp->generation + 1, __ATOMIC_RELEASE );
+	cp->generation++;
+
+	if ( cp->flags & CONSTATS_CHECKPOINT_DURABLE )
+		return msync( cp->header, cp->size, MS_SYNC );
+
+	return 0;
+}
+
+/**
+ * This function finds the newest complete checkpoint. It returns NULL if
+ * there is none.
+ */
+static inline
+checkpoint_slot_t* constats_checkpoint_newest ( checkpoint_t* cp )
+{
+	checkpoint_slot_t* newest = NULL;
+	uint64_t capacity = cp->header->slot_size - sizeof( checkpoint_slot_t );
+	uint64_t i;
+
+	for ( i = 0; i < cp->header->slots; ++i )
+	{
+		checkpoint_slot_t* slot = constats_checkpoint_slot( cp, i );
+
+		if ( slot->generation == 0 || slot->length > capacity
+		  || ( newest != NULL && slot->generation <= newest->generation ) )
+			continue;
+
+		if ( slot->checksum == constats_checkpoint_checksum( (uint8_t*) ( slot + 1 ), slot->length ) )
+			newest = slot;
+	}
+
+	return newest;
+}
+
+/**
+ * This function saves an accumulator.
+ */
+static inline
+int constats_checkpoint_save_accumulator ( checkpoint_t* cp, const accumulator_t* acc )
+{
+	uint64_t capacity;
+	uint64_t length;
+
+	checkpoint_slot_t* slot = constats_checkpoint_begin( cp, &capacity );
+
+	if ( constats_wire_encode_accumulator( acc, (uint8_t*) ( slot + 1 ), capacity, &length ) != 0 )
+		return -1;
+
+	return constats_checkpoint_commit( cp, slot, length );
+}
+
+/**
+ * This function saves a histogram.
+ */
+static inline
+int constats_checkpoint_save_histogram ( checkpoint_t* cp, const histogram_t* hist )
+{
+	uint64_t capacity;
+	uint64_t length;
+
+	checkpoint_slot_t* slot = constats_checkpoint_begin( cp, &capacity );
+
+	if ( constats_wire_encode_histogram( hist, (uint8_t*) ( slot + 1 ), capacity, &length ) != 0 )
+		return -1;
+
+	return constats_checkpoint_commit( cp, slot, length );
+}
+
+/**
+ * This function replaces acc with the newest saved accumulator. It
+ * returns -1, leaving acc untouched, if there is none.
+ */
+static inline
+int constats_checkpoint_restore_accumulator ( checkpoint_t* cp, accumulator_t* acc )
+{
+	checkpoint_slot_t* slot = constats_checkpoint_newest( cp );
+	accumulator_t restored;
+
+	if ( slot == NULL || constats_wire_decode_accumulator( &restored, (uint8_t*) ( slot + 1 ), slot->length ) != 0 )
+		return -1;
+
+	*acc = restored;
+	return 0;
+}
+
+/**
+ * This function replaces hist with the newest saved histogram. It
+ * returns -1, leaving hist untouched, if there is none.
+ */
+static inline
+int constats_checkpoint_restore_histogram ( checkpoint_t* cp, histogram_t* hist )
+{
+	checkpoint_slot_t* slot = constats_checkpoint_newest( cp );
+
+	if ( slot == NULL || constats_wire_kind( (uint8_t*) ( slot + 1 ), slot->length ) != CONSTATS_WIRE_HISTOGRAM )
+		return -1;
+
+	return constats_wire_decode_histogram( hist, (uint8_t*) ( slot + 1 ), slot->length );
+}
+
+/**
+ * This function returns the header of a file backed recorder.
+ */
+static inline
+recording_header_t* constats_checkpoint_recording ( recorder_t* recorder )
+{
+	return (recording_header_t*) ( (char*) recorder->samples - constats_recorder_page_size() );
+}
+
+/**
+ * This function initializes a recorder backed by the file at path,
+ * resuming after the last synced sample if the file already holds a
+ * recording. A recording of another capacity, or any other non-empty
+ * file, is refused. CONSTATS_RECORDER_PREFAULT and
+ * CONSTATS_RECORDER_LOCK are honored; huge pages are not available for
+ * file mappings. Release the recorder with constats_checkpoint_recorder_close.
+ */
+static inline
+int constats_checkpoint_recorder_open ( recorder_t* recorder, const char* path, uint64_t capacity, int flags )
+{
+	// Error Checking
+	if ( recorder == NULL || path == NULL || capacity == 0 )
+		return -1;
+
+	memset( recorder, 0, sizeof( recorder_t ) );
+
+	recording_header_t existing;
+	uint64_t start = constats_recorder_ns();
+	uint64_t page  = constats_recorder_page_size();
+	uint64_t size  = page + capacity * sizeof( int64_t );
+	int found      = constats_checkpoint_peek( path, &existing, sizeof( existing ) );
+
+	size = ( size + page - 1 ) & ~( page - 1 );
+
+	if ( found < 0 || ( found && ( existing.magic != CONSTATS_RECORDING_MAGIC || existing.version != CONSTATS_CHECKPOINT_VERSION
+	                            || existing.page_size != page || existing.capacity != capacity || existing.count > capacity ) ) )
+		return -1;
+
+	// Prefault by populating, touching the pages would clobber resumed samples
+	void* mapping = constats_checkpoint_map( path, size, flags & CONSTATS_RECORDER_PREFAULT );
+
+	if ( mapping == MAP_FAILED )
+		return -1;
+
+	recording_header_t* header = (recording_header_t*) mapping;
+
+	if ( !found )
+	{
+		memset( header, 0, sizeof( recording_header_t ) );
+		header->version   = CONSTATS_CHECKPOINT_VERSION;
+		header->page_size = page;
+		header->capacity  = capacity;
+		header->magic     = CONSTATS_RECORDING_MAGIC;
+	}
+
+	recorder->samples     = (int64_t*) ( (char*) mapping + page );
+	recorder->capacity    = capacity;
+	recorder->count       = header->count;
+	recorder->published   = header->count;
+	recorder->dropped     = header->dropped;
+	recorder->flags       = flags & ~CONSTATS_RECORDER_HUGEPAGES;
+	recorder->backing     = CONSTATS_BACKING_FILE;
+	recorder->mapped_size = size;
+
+	if ( flags & CONSTATS_RECORDER_LOCK )
+		recorder->locked = mlock( recorder->samples, capacity * sizeof( int64_t ) ) == 0;
+
+	recorder->setup_ns = constats_recorder_ns() - start;
+	return 0;
+}
+
+/**
+ * This function publishes every sample recorded so far, so a reopened
+ * recording resumes after them. It is two stores unless the durable flag
+ * is given, cheap enough to call every few thousand samples.
+ */
+static inline
+int constats_checkpoint_recorder_sync ( recorder_t* recorder, int flags )
+{
+	recording_header_t* header = constats_checkpoint_recording( recorder );
+
+	__atomic_store_n( &header->dropped, recorder->dropped, __ATOMIC_RELAXED );
+	__atomic_store_n( &header->count, constats_recorder_size( recorder ), __ATOMIC_RELEASE );
+
+	if ( flags & CONSTATS_CHECKPOINT_DURABLE )
+		return msync( header, recorder->mapped_size, MS_SYNC );
+
+	return 0;
+}
+
+/**
+ * This function syncs a file backed recorder and releases it.
+ */
+static inline
+int constats_checkpoint_recorder_close ( recorder_t* recorder, int flags )
+{
+	// Error Checking
+	if ( recorder == NULL || recorder->backing != CONSTATS_BACKING_FILE )
+		return -1;
+
+	constats_checkpoint_recorder_sync( recorder, flags );
+	return constats_recorder_destroy( recorder );
+}
+
+#endif
@@ -0,0 +1,373 @@
+/**
+ * @File     : constats_clock.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a cheap timestamp counter for timing short code
+ * regions, and the conversion from its ticks to nanoseconds.
+ *
+ * It also calibrates every supported clock source, measuring what one
+ * read costs and the smallest step the clock can report. The calibration
+ * runs once, on first use, or at startup when CONSTATS_CALIBRATE_AT_STARTUP
+ * is defined. With CONSTATS_SUBTRACT_OVERHEAD defined, scopes and benches
+ * subtract the cost of the clock reads from every sample they record, and
+ * the calibration always runs at startup, so its tens of milliseconds are
+ * not spent on the first thread to time something.
+ */
+
+#ifndef CONSTATS_CLOCK_LIB_LOCK
+#define CONSTATS_CLOCK_LIB_LOCK
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Clock sources
+#define CONSTATS_CLOCK_TICKS            0	// constats_clock_ticks
+#define CONSTATS_CLOCK_MONOTONIC        1	// CLOCK_MONOTONIC
+#define CONSTATS_CLOCK_MONOTONIC_RAW    2	// CLOCK_MONOTONIC_RAW
+#define CONSTATS_CLOCK_MONOTONIC_COARSE 3	// CLOCK_MONOTONIC_COARSE
+#define CONSTATS_CLOCK_SOURCES          4
+
+#ifndef CONSTATS_CALIBRATION_PAIRS
+#define CONSTATS_CALIBRATION_PAIRS 1001
+#endif
+
+#ifndef CONSTATS_CALIBRATION_STEPS
+#define CONSTATS_CALIBRATION_STEPS 8
+#endif
+
+#if defined(CONSTATS_SUBTRACT_OVERHEAD) && !defined(CONSTATS_CALIBRATE_AT_STARTUP)
+#define CONSTATS_CALIBRATE_AT_STARTUP
+#endif
+
+// Samples under this many resolution steps are flagged as unreliable
+#ifndef CONSTATS_RESOLUTION_FACTOR
+#define CONSTATS_RESOLUTION_FACTOR 10
+#endif
+
+typedef struct clock_calibration_t
+{
+	const char* name;		// The name of the clock source
+	int available;			// Whether the clock could be read
+	double overhead_ns;		// The median cost of one read
+	double resolution_ns;	// The smallest nonzero step observed
+
+} clock_calibration_t;
+
+/**
+ * This function returns the current value of the cheapest available
+ * monotonic counter: the TSC on x86, the virtual counter on aarch64 and
+ * CLOCK_MONOTONIC in nanoseconds everywhere else.
+ */
+static inline
+uint64_t constats_clock_ticks ( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ volatile ( "mrs %0, cntvct_el0" : "=r" (ticks) );
+	return ticks;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+/**
+ * This function returns CLOCK_MONOTONIC in nanoseconds.
+ */
+static inline
+uint64_t constats_clock_ns ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * This function measures how many nanoseconds one tick lasts by timing
+ * the counter against CLOCK_MONOTONIC for about 10 milliseconds.
+ */
+static inline
+double constats_clock_measure_ns_per_tick ( void )
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+	uint64_t ns_start    = constats_clock_ns();
+	uint64_t ticks_start = constats_clock_ticks();
+	uint64_t ns_end;
+
+	do
+	{
+		ns_end = constats_clock_ns();
+	} while ( ns_end - ns_start < 10000000 );
+
+	uint64_t ticks_end = constats_clock_ticks();
+
+	return (double) ( ns_end - ns_start ) / (double) ( ticks_end - ticks_start );
+#else
+	return 1.0;
+#endif
+}
+
+// The nanoseconds per tick, measured once per process by constats_clock_ns_per_tick
+double constats_clock_tick_ns = 0;
+pthread_once_t constats_clock_tick_once = PTHREAD_ONCE_INIT;
+
+static inline
+void constats_clock_measure_tick_ns ( void )
+{
+	constats_clock_tick_ns = constats_clock_measure_ns_per_tick();
+}
+
+/**
+ * This function returns the nanoseconds per tick. The first call measures
+ * it, and callers racing it wait rather than measure again.
+ */
+static inline
+double constats_clock_ns_per_tick ( void )
+{
+	pthread_once( &constats_clock_tick_once, constats_clock_measure_tick_ns );
+	return constats_clock_tick_ns;
+}
+
+/**
+ * This function reads a clock source in its own units, ticks for
+ * CONSTATS_CLOCK_TICKS and nanoseconds otherwise. It returns 0 if the
+ * source cannot be read.
+ */
+static inline
+uint64_t constats_clock_read ( int source )
+{
+	struct timespec ts;
+	clockid_t id;
+
+	switch ( source )
+	{
+		case CONSTATS_CLOCK_TICKS:
+			return constats_clock_ticks();
+
+		case CONSTATS_CLOCK_MONOTONIC:
+			id = CLOCK_MONOTONIC;
+			break;
+
+#ifdef CLOCK_MONOTONIC_RAW
+		case CONSTATS_CLOCK_MONOTONIC_RAW:
+			id = CLOCK_MONOTONIC_RAW;
+			break;
+#endif
+
+#ifdef CLOCK_MONOTONIC_COARSE
+		case CONSTATS_CLOCK_MONOTONIC_COARSE:
+			id = CLOCK_MONOTONIC_COARSE;
+			break;
+#endif
+
+		default:
+			return 0;
+	}
+
+	if ( clock_gettime( id, &ts ) != 0 )
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+}
+
+static inline
+int constats_clock_compare ( const void* a, const void* b )
+{
+	uint64_t x = *(const uint64_t*) a;
+	uint64_t y = *(const uint64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * This function measures the read cost and resolution of one clock source.
+ * The cost is the median of back-to-back reads, the resolution is the
+ * smallest step seen while spinning until the clock changes.
+ */
+static inline
+int constats_clock_calibrate ( int source, clock_calibration_t* cal )
+{
+	static const char* names[CONSTATS_CLOCK_SOURCES] =
+		{ "ticks", "CLOCK_MONOTONIC", "CLOCK_MONOTONIC_RAW", "CLOCK_MONOTONIC_COARSE" };
+
+	uint64_t deltas[CONSTATS_CALIBRATION_PAIRS];
+	uint64_t step = 0;
+	int i;
+
+	// Error Checking
+	if ( cal == NULL || source < 0 || source >= CONSTATS_CLOCK_SOURCES )
+		return -1;
+
+	cal->name          = names[source];
+	cal->available     = constats_clock_read( source ) != 0;
+	cal->overhead_ns   = 0;
+	cal->resolution_ns = 0;
+
+	if ( !cal->available )
+		return -1;
+
+	double scale = source == CONSTATS_CLOCK_TICKS ? constats_clock_ns_per_tick() : 1.0;
+
+	for ( i = 0; i < CONSTATS_CALIBRATION_PAIRS; ++i )
+	{
+		uint64_t start = constats_clock_read( source );
+		deltas[i] = constats_clock_read( source ) - start;
+	}
+
+	qsort( deltas, CONSTATS_CALIBRATION_PAIRS, sizeof( uint64_t ), constats_clock_compare );
+	cal->overhead_ns = deltas[CONSTATS_CALIBRATION_PAIRS / 2] * scale;
+
+	for ( i = 0; i < CONSTATS_CALIBRATION_STEPS; ++i )
+	{
+		uint64_t start = constats_clock_read( source );
+		uint64_t now;
+
+		while ( ( now = constats_clock_read( source ) ) == start );
+
+		if ( step == 0 || now - start < step )
+			step = now - start;
+	}
+
+	cal->resolution_ns = step * scale;
+	return 0;
+}
+
+// The calibration of every clock source, filled in once by constats_clock_calibration
+clock_calibration_t constats_clock_calibrations[CONSTATS_CLOCK_SOURCES];
+pthread_once_t constats_clock_calibrated = PTHREAD_ONCE_INIT;
+
+static inline
+void constats_clock_calibrate_all ( void )
+{
+	int i;
+
+	for ( i = 0; i < CONSTATS_CLOCK_SOURCES; ++i )
+		constats_clock_calibrate( i, &constats_clock_calibrations[i] );
+}
+
+/**
+ * This function returns the calibration of a clock source. The first call
+ * calibrates every source, and callers racing it wait rather than read a
+ * calibration in progress.
+ */
+static inline
+clock_calibration_t* constats_clock_calibration ( int source )
+{
+	pthread_once( &constats_clock_calibrated, constats_clock_calibrate_all );
+	return &constats_clock_calibrations[source];
+}
+
+#ifdef CONSTATS_CALIBRATE_AT_STARTUP
+static __attribute__((constructor))
+void constats_clock_calibrate_at_startup ( void )
+{
+	constats_clock_calibration( CONSTATS_CLOCK_TICKS );
+}
+#endif
+
+/**
+ * This function returns the nanoseconds timed regions should have
+ * subtracted: the cost of a tick read when CONSTATS_SUBTRACT_OVERHEAD is
+ * defined, 0 otherwise.
+ */
+static inline
+double constats_clock_subtracted_ns ( void )
+{
+#ifdef CONSTATS_SUBTRACT_OVERHEAD
+	return constats_clock_calibration( CONSTATS_CLOCK_TICKS )->overhead_ns;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * This function converts a tick interval to nanoseconds, less the given
+ * overhead, without going below 0.
+ */
+static inline
+int64_t constats_clock_elapsed_ns ( uint64_t ticks, double ns_per_tick, double overhead_ns )
+{
+	double ns = ticks * ns_per_tick - overhead_ns;
+	return ns > 0 ? (int64_t) ns : 0;
+}
+
+/**
+ * This function subtracts overhead_ns from every sample, without going below 0.
+ */
+static inline
+void constats_clock_subtract_overhead ( int64_t* sample_set, uint64_t sample_size, int64_t overhead_ns )
+{
+	register uint64_t i;
+
+	for ( i = 0; i < sample_size; ++i )
+		sample_set[i] = sample_set[i] > overhead_ns ? sample_set[i] - overhead_ns : 0;
+}
+
+/**
+ * This function counts the samples within CONSTATS_RESOLUTION_FACTOR
+ * resolution steps of the clock source, which are too short to trust.
+ */
+static inline
+uint64_t constats_clock_count_near_resolution ( int64_t* sample_set, uint64_t sample_size, int source )
+{
+	double limit = CONSTATS_RESOLUTION_FACTOR * constats_clock_calibration( source )->resolution_ns;
+	register uint64_t count;
+	register uint64_t i;
+
+	for ( count = 0, i = 0; i < sample_size; ++i )
+		if ( sample_set[i] < limit )
+			++count;
+
+	return count;
+}
+
+/**
+ * This function prints a warning if samples are near the clock's resolution.
+ */
+static inline
+int constats_clock_print_resolution_warning ( int64_t* sample_set, uint64_t sample_size, int source )
+{
+	uint64_t count = constats_clock_count_near_resolution( sample_set, sample_size, source );
+
+	if ( count > 0 )
+		printf ( "Near Resolution        : %lu samples under %d x %.0f ns resolution\n", count,
+		         CONSTATS_RESOLUTION_FACTOR, constats_clock_calibration( source )->resolution_ns );
+
+	return 0;
+}
+
+/**
+ * This function prints the calibration of every clock source.
+ */
+static inline
+int constats_clock_print_calibration ( void )
+{
+	int i;
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+	printf ( "%-24s %14s %16s\n", "Clock Source", "Overhead (ns)", "Resolution (ns)" );
+
+	for ( i = 0; i < CONSTATS_CLOCK_SOURCES; ++i )
+	{
+		clock_calibration_t* cal = constats_clock_calibration( i );
+
+		if ( !cal->available )
+			printf ( "%-24s %14s %16s\n", cal->name, "unavailable", "unavailable" );
+		else
+			printf ( "%-24s %14.1f %16.1f\n", cal->name, cal->overhead_ns, cal->resolution_ns );
+	}
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+	return 0;
+}
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * @File     : constats_daemon.c
+ * @Author   : Abdullah Younis
+ *
+ * This daemon aggregates samples from many local processes. Each client
+ * connection gets a thread that reads messages and pushes them onto the
+ * lock-free ingest queue. A single aggregator thread drains the queue in
+ * batches and merges every batch into one histogram, so ingest never
+ * waits on a lock and the histogram never needs one. See constats_daemon.h
+ * for the protocol and the client calls.
+ *
+ * Only a client running as the daemon's user, or as root, may shut it
+ * down, and raw histograms are checked before they are merged.
+ *
+ * Build : cc -O2 -pthread -o constats_daemon constats_daemon.c -lm
+ * Usage : constats_daemon <socket path>
+ */
+
+// For struct ucred
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "constats_daemon.h"
+
+static ingest_queue_t queue;
+static sem_t pending;
+static histogram_t aggregate;
+static const char* socket_path;
+
+/**
+ * This function merges one message into the aggregate.
+ */
+static void merge ( ingest_node_t* node )
+{
+	uint64_t i;
+
+	switch ( node->type )
+	{
+		case CONSTATS_MSG_SAMPLES:
+		{
+			int64_t* samples = (int64_t*) node->payload;
+
+			for ( i = 0; i < node->length / sizeof( int64_t ); ++i )
+				constats_histogram_record( &aggregate, samples[i] );
+
+			break;
+		}
+
+		case CONSTATS_MSG_HISTOGRAM:
+			constats_histogram_merge( &aggregate, (histogram_t*) node->payload );
+			break;
+
+		case CONSTATS_MSG_ENCODED:
+			// A malformed encoding is dropped without touching the aggregate
+			constats_wire_merge_histogram( &aggregate, (const uint8_t*) node->payload, node->length );
+			break;
+
+		case CONSTATS_MSG_QUERY:
+		{
+			stats_t* stat = (stats_t*) node->payload;
+
+			if ( constats_histogram_calculate_stats( &aggregate, stat ) != 0 )
+				memset( stat, 0, sizeof( stats_t ) );
+
+			memcpy( stat + 1, &aggregate, sizeof( histogram_t ) );
+			sem_post( node->done );
+
+			// The connection thread owns query nodes
+			return;
+		}
+
+		case CONSTATS_MSG_SHUTDOWN:
+			printf ( "Aggregate              : %s\n", socket_path );
+
+			if ( constats_histogram_print_stats( &aggregate ) != 0 )
+				printf ( "Sample Size            : 0\n" );
+
+			fflush( stdout );
+			unlink( socket_path );
+			exit( 0 );
+	}
+
+	free( node->payload );
+	free( node );
+}
+
+/**
+ * This function is the aggregator thread. Every wakeup drains the whole
+ * queue, so a burst of batches costs one wakeup.
+ */
+static void* aggregate_loop ( void* unused )
+{
+	ingest_node_t* node;
+	(void) unused;
+
+	for ( ;; )
+	{
+		while ( sem_wait( &pending ) != 0 );
+
+		while ( ( node = constats_ingest_pop( &queue ) ) != NULL )
+			merge( node );
+	}
+
+	return NULL;
+}
+
+/**
+ * This function pushes a node and wakes the aggregator.
+ */
+static void submit ( ingest_node_t* node )
+{
+	constats_ingest_push( &queue, node );
+	sem_post( &pending );
+}
+
+/**
+ * This function returns whether the peer of a connection may shut the
+ * daemon down, which takes the daemon's own user or root.
+ */
+static int may_shut_down ( int fd )
+{
+	struct ucred peer;
+	socklen_t size = sizeof( peer );
+
+	if ( getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &peer, &size ) != 0 || size != sizeof( peer ) )
+		return 0;
+
+	return peer.uid == 0 || peer.uid == getuid();
+}
+
+/**
+ * This function is a connection thread. It reads messages until the
+ * client hangs up or sends something invalid, answering queries once the
+ * aggregator has seen every earlier message.
+ */
+static void* connection_loop ( void* data )
+{
+	int fd = (int) (intptr_t) data;
+	daemon_msg_t msg;
+
+	while ( constats_read_full( fd, &msg, sizeof( msg ) ) == 0 )
+	{
+		// Only the daemon sends CONSTATS_MSG_STATS, and a query or shutdown
+		// carrying a payload would leave it unread in the stream
+		if ( msg.length > CONSTATS_MSG_MAX
+		  || ( msg.type != CONSTATS_MSG_SAMPLES && msg.type != CONSTATS_MSG_HISTOGRAM && msg.type != CONSTATS_MSG_QUERY
+		    && msg.type != CONSTATS_MSG_SHUTDOWN && msg.type != CONSTATS_MSG_ENCODED )
+		  || ( msg.type == CONSTATS_MSG_SAMPLES && msg.length % sizeof( int64_t ) != 0 )
+		  || ( msg.type == CONSTATS_MSG_HISTOGRAM && msg.length != sizeof( histogram_t ) )
+		  || ( msg.type == CONSTATS_MSG_QUERY && msg.length != 0 )
+		  || ( msg.type == CONSTATS_MSG_SHUTDOWN && ( msg.length != 0 || !may_shut_down( fd ) ) ) )
+			break;
+
+		ingest_node_t* node = (ingest_node_t*) calloc( 1, sizeof( ingest_node_t ) );
+
+		if ( node == NULL )
+			break;
+
+		node->type   = msg.type;
+		node->length = msg.length;
+
+		if ( msg.type == CONSTATS_MSG_QUERY )
+		{
+			sem_t done;
+			sem_init( &done, 0, 0 );
+
+			node->length  = sizeof( stats_t ) + sizeof( histogram_t );
+			node->payload = (char*) malloc( node->length );
+			node->done    = &done;
+
+			if ( node->payload == NULL )
+			{
+				free( node );
+				break;
+			}
+
+			submit( node );
+			while ( sem_wait( &done ) != 0 );
+			sem_destroy( &done );
+
+			int error_code = constats_daemon_send( fd, CONSTATS_MSG_STATS, node->payload, node->length );
+
+			free( node->payload );
+			free( node );
+
+			if ( error_code != 0 )
+				break;
+
+			continue;
+		}
+
+		if ( msg.length > 0 )
+		{
+			node->payload = (char*) malloc( msg.length );
+
+			if ( node->payload == NULL || constats_read_full( fd, node->payload, msg.length ) != 0
+			  || ( msg.type == CONSTATS_MSG_HISTOGRAM && constats_histogram_validate( (histogram_t*) node->payload ) != 0 ) )
+			{
+				free( node->payload );
+				free( node );
+				break;
+			}
+		}
+
+		submit( node );
+	}
+
+	close( fd );
+	return NULL;
+}
+
+int main ( int argc, char** argv )
+{
+	struct sockaddr_un addr;
+	pthread_t thread;
+
+	if ( argc < 2 || strlen( argv[1] ) >= sizeof( addr.sun_path ) )
+	{
+		fprintf ( stderr, "Usage: %s <socket path>\n", argv[0] );
+		return 1;
+	}
+
+	// A client that hangs up before its answer is written must not stop the daemon
+	signal( SIGPIPE, SIG_IGN );
+
+	socket_path = argv[1];
+	constats_ingest_init( &queue );
+	constats_histogram_init( &aggregate );
+	sem_init( &pending, 0, 0 );
+
+	int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, socket_path );
+	unlink( socket_path );
+
+	if ( listener < 0 || bind( listener, (struct sockaddr*) &addr, sizeof( addr ) ) != 0 || listen( listener, 64 ) != 0 )
+	{
+		perror( socket_path );
+		return 1;
+	}
+
+	if ( pthread_create( &thread, NULL, aggregate_loop, NULL ) != 0 )
+	{
+		fprintf ( stderr, "%s: cannot start the aggregator\n", argv[0] );
+		unlink( socket_path );
+		return 1;
+	}
+
+	for ( ;; )
+	{
+		int fd = accept( listener, NULL, NULL );
+
+		if ( fd < 0 )
+			continue;
+
+		if ( pthread_create( &thread, NULL, connection_loop, (void*) (intptr_t) fd ) != 0 )
+		{
+			close( fd );
+			continue;
+		}
+
+		pthread_detach( thread );
+	}
+
+	return 0;
+}
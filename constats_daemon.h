@@ -0,0 +1,318 @@
+/**
+ * @File     : constats_daemon.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains the protocol, the client calls and the ingest
+ * queue of the constats aggregation daemon (constats_daemon.c). Several
+ * processes on one host send it batches of samples, or partial aggregates
+ * they built themselves, over a Unix domain socket. The daemon merges
+ * everything into one histogram and answers queries with its stats_t.
+ *
+ * Every message is a daemon_msg_t header followed by length bytes:
+ *   CONSTATS_MSG_SAMPLES   : an array of int64_t samples
+ *   CONSTATS_MSG_HISTOGRAM : a histogram_t
+ *   CONSTATS_MSG_ENCODED   : a histogram in the constats_wire.h encoding
+ *   CONSTATS_MSG_QUERY     : empty, answered with CONSTATS_MSG_STATS
+ *   CONSTATS_MSG_STATS     : a stats_t, followed by the histogram_t it came from
+ *   CONSTATS_MSG_SHUTDOWN  : empty, the daemon prints the aggregate and exits
+ *
+ * A histogram_t that is inconsistent (see constats_histogram_validate), a
+ * malformed message, or a SHUTDOWN from a user other than the daemon's or
+ * root closes the connection without touching the aggregate.
+ *
+ * Messages on one connection are merged in order, so a query sees every
+ * batch sent before it on the same connection.
+ */
+
+#ifndef CONSTATS_DAEMON_LIB_LOCK
+#define CONSTATS_DAEMON_LIB_LOCK
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "constats.h"
+#include "constats_histogram.h"
+#include "constats_wire.h"
+
+// Message types
+#define CONSTATS_MSG_SAMPLES   1
+#define CONSTATS_MSG_HISTOGRAM 2
+#define CONSTATS_MSG_QUERY     3
+#define CONSTATS_MSG_STATS     4
+#define CONSTATS_MSG_SHUTDOWN  5
+#define CONSTATS_MSG_ENCODED   6
+
+// The largest payload the daemon accepts
+#ifndef CONSTATS_MSG_MAX
+#define CONSTATS_MSG_MAX ( 64UL << 20 )
+#endif
+
+typedef struct daemon_msg_t
+{
+	uint32_t type;		// The message type
+	uint32_t reserved;	// Always 0
+	uint64_t length;	// The number of payload bytes that follow
+
+} daemon_msg_t;
+
+/**
+ * This function writes the whole buffer, retrying short writes.
+ */
+static inline
+int constats_write_full ( int fd, const void* buffer, uint64_t size )
+{
+	const char* bytes = (const char*) buffer;
+
+	while ( size > 0 )
+	{
+		ssize_t written = write( fd, bytes, size );
+
+		if ( written < 0 && errno == EINTR )
+			continue;
+
+		if ( written <= 0 )
+			return -1;
+
+		bytes += written;
+		size  -= written;
+	}
+
+	return 0;
+}
+
+/**
+ * This function fills the whole buffer, retrying short reads.
+ */
+static inline
+int constats_read_full ( int fd, void* buffer, uint64_t size )
+{
+	char* bytes = (char*) buffer;
+
+	while ( size > 0 )
+	{
+		ssize_t got = read( fd, bytes, size );
+
+		if ( got < 0 && errno == EINTR )
+			continue;
+
+		if ( got <= 0 )
+			return -1;
+
+		bytes += got;
+		size  -= got;
+	}
+
+	return 0;
+}
+
+/**
+ * This function sends one message.
+ */
+static inline
+int constats_daemon_send ( int fd, uint32_t type, const void* payload, uint64_t length )
+{
+	daemon_msg_t msg;
+	msg.type     = type;
+	msg.reserved = 0;
+	msg.length   = length;
+
+	if ( constats_write_full( fd, &msg, sizeof( msg ) ) != 0 )
+		return -1;
+
+	return length == 0 ? 0 : constats_write_full( fd, payload, length );
+}
+
+/**
+ * This function connects to the daemon listening on path. It returns the
+ * socket, or -1.
+ */
+static inline
+int constats_daemon_connect ( const char* path )
+{
+	struct sockaddr_un addr;
+
+	// Error Checking
+	if ( path == NULL || strlen( path ) >= sizeof( addr.sun_path ) )
+		return -1;
+
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+	if ( fd < 0 )
+		return -1;
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+
+	if ( connect( fd, (struct sockaddr*) &addr, sizeof( addr ) ) != 0 )
+	{
+		close( fd );
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * This function sends a batch of samples.
+ */
+static inline
+int constats_daemon_send_samples ( int fd, const int64_t* sample_set, uint64_t sample_size )
+{
+	return constats_daemon_send( fd, CONSTATS_MSG_SAMPLES, sample_set, sample_size * sizeof( int64_t ) );
+}
+
+/**
+ * This function sends a partial aggregate.
+ */
+static inline
+int constats_daemon_send_histogram ( int fd, const histogram_t* hist )
+{
+	return constats_daemon_send( fd, CONSTATS_MSG_HISTOGRAM, hist, sizeof( histogram_t ) );
+}
+
+/**
+ * This function sends a partial aggregate in the compact wire encoding,
+ * which is usually far smaller than the histogram_t itself.
+ */
+static inline
+int constats_daemon_send_encoded ( int fd, const histogram_t* hist )
+{
+	uint64_t length;
+	uint8_t* buffer = (uint8_t*) malloc( CONSTATS_WIRE_HISTOGRAM_MAX );
+
+	if ( buffer == NULL )
+		return -1;
+
+	int error_code = constats_wire_encode_histogram( hist, buffer, CONSTATS_WIRE_HISTOGRAM_MAX, &length );
+
+	if ( error_code == 0 )
+		error_code = constats_daemon_send( fd, CONSTATS_MSG_ENCODED, buffer, length );
+
+	free( buffer );
+	return error_code;
+}
+
+/**
+ * This function asks for the aggregate statistics. hist may be NULL if
+ * only the stats_t is wanted.
+ */
+static inline
+int constats_daemon_query ( int fd, stats_t* stat, histogram_t* hist )
+{
+	daemon_msg_t msg;
+	histogram_t* reply = hist;
+
+	if ( constats_daemon_send( fd, CONSTATS_MSG_QUERY, NULL, 0 ) != 0 )
+		return -1;
+
+	if ( constats_read_full( fd, &msg, sizeof( msg ) ) != 0 || msg.type != CONSTATS_MSG_STATS
+	  || msg.length != sizeof( stats_t ) + sizeof( histogram_t ) )
+		return -1;
+
+	if ( reply == NULL && ( reply = (histogram_t*) malloc( sizeof( histogram_t ) ) ) == NULL )
+		return -1;
+
+	int error_code = constats_read_full( fd, stat, sizeof( stats_t ) ) != 0
+	              || constats_read_full( fd, reply, sizeof( histogram_t ) ) != 0 ? -1 : 0;
+
+	if ( hist == NULL )
+		free( reply );
+
+	// An empty aggregate has no statistics
+	return error_code != 0 || stat->N == 0 ? -1 : 0;
+}
+
+/**
+ * The ingest queue: an intrusive multi-producer, single-consumer queue.
+ * Producers link a node in with one atomic exchange and never wait; the
+ * consumer may briefly see the queue as empty while a push is in flight.
+ */
+typedef struct ingest_node_t
+{
+	struct ingest_node_t* next;		// The node pushed after this one
+	uint32_t type;					// The message type
+	uint64_t length;				// The payload size
+	char* payload;					// The payload, owned by the node
+	sem_t* done;					// Posted once a query's payload holds the answer
+
+} ingest_node_t;
+
+typedef struct ingest_queue_t
+{
+	ingest_node_t* head;			// The most recently pushed node
+	ingest_node_t* tail;			// The next node to pop, consumer only
+	ingest_node_t stub;				// The placeholder that keeps the list non-empty
+
+} ingest_queue_t;
+
+/**
+ * This function prepares an empty queue.
+ */
+static inline
+void constats_ingest_init ( ingest_queue_t* queue )
+{
+	memset( queue, 0, sizeof( ingest_queue_t ) );
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+}
+
+/**
+ * This function pushes a node. It is safe to call from any thread.
+ */
+static inline
+void constats_ingest_push ( ingest_queue_t* queue, ingest_node_t* node )
+{
+	__atomic_store_n( &node->next, NULL, __ATOMIC_RELAXED );
+	ingest_node_t* prev = __atomic_exchange_n( &queue->head, node, __ATOMIC_ACQ_REL );
+	__atomic_store_n( &prev->next, node, __ATOMIC_RELEASE );
+}
+
+/**
+ * This function pops the oldest node, or returns NULL. Only one thread may pop.
+ */
+static inline
+ingest_node_t* constats_ingest_pop ( ingest_queue_t* queue )
+{
+	ingest_node_t* tail = queue->tail;
+	ingest_node_t* next = __atomic_load_n( &tail->next, __ATOMIC_ACQUIRE );
+
+	if ( tail == &queue->stub )
+	{
+		if ( next == NULL )
+			return NULL;
+
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n( &next->next, __ATOMIC_ACQUIRE );
+	}
+
+	if ( next != NULL )
+	{
+		queue->tail = next;
+		return tail;
+	}
+
+	// tail is the last node unless a push is still linking in
+	if ( tail != __atomic_load_n( &queue->head, __ATOMIC_ACQUIRE ) )
+		return NULL;
+
+	constats_ingest_push( queue, &queue->stub );
+	next = __atomic_load_n( &tail->next, __ATOMIC_ACQUIRE );
+
+	if ( next != NULL )
+	{
+		queue->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+#endif
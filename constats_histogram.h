@@ -0,0 +1,429 @@
+/**
+ * @File     : constats_histogram.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a log-linear histogram in the style of HDR
+ * histograms. Every power of two is split into 2^CONSTATS_HISTOGRAM_SUB_BITS
+ * linear buckets, so a value is kept to within 1 part in 2^SUB_BITS no
+ * matter its magnitude, in a fixed amount of memory. Values below 0 are
+ * recorded as 0.
+ *
+ * The exact count, min and max, and a running mean and sum of squared
+ * deviations (Welford's method, merged with Chan's formula) are tracked
+ * alongside the buckets, so the mean and standard deviation do not depend
+ * on the bucket width and stay accurate far from zero. Percentiles, the
+ * absolute deviation and the outlier split come from the buckets.
+ *
+ * constats_histogram_record_corrected corrects for coordinated omission.
+ * When a load generator meant to issue a request every expected_interval
+ * and a request took value, the requests that should have been issued
+ * during the stall are missing from the data. The function records the
+ * latencies those requests would have seen, value - interval,
+ * value - 2 * interval and so on down to interval, as ordinary values
+ * that count toward N, the moments and the percentiles alike. They are
+ * added a bucket at a time, so a long stall costs no more than a short one.
+ */
+
+#ifndef CONSTATS_HISTOGRAM_LIB_LOCK
+#define CONSTATS_HISTOGRAM_LIB_LOCK
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "constats.h"
+
+#ifndef CONSTATS_HISTOGRAM_SUB_BITS
+#define CONSTATS_HISTOGRAM_SUB_BITS 6
+#endif
+
+#define CONSTATS_HISTOGRAM_SUB_BUCKETS ( 1 << CONSTATS_HISTOGRAM_SUB_BITS )
+#define CONSTATS_HISTOGRAM_BUCKETS     ( ( 64 - CONSTATS_HISTOGRAM_SUB_BITS ) * CONSTATS_HISTOGRAM_SUB_BUCKETS )
+
+typedef struct histogram_t
+{
+	uint64_t N;			// The number of values recorded
+	double mean;		// The mean of the values
+	double m2;			// The sum of the squared deviations from the mean
+	int64_t min;		// The minimum value
+	int64_t max;		// The maximum value
+
+	uint64_t counts[CONSTATS_HISTOGRAM_BUCKETS];	// The number of values in each bucket
+
+} histogram_t;
+
+/**
+ * This function empties the histogram.
+ */
+static inline
+void constats_histogram_init ( histogram_t* hist )
+{
+	memset( hist, 0, sizeof( histogram_t ) );
+	hist->min = INF;
+	hist->max = NINF;
+}
+
+/**
+ * This function returns the bucket holding a non-negative value.
+ */
+static inline
+uint64_t constats_histogram_index ( int64_t value )
+{
+	if ( value < 2 * CONSTATS_HISTOGRAM_SUB_BUCKETS )
+		return value;
+
+	int exponent = 63 - __builtin_clzll( value ) - CONSTATS_HISTOGRAM_SUB_BITS;
+	return (uint64_t) exponent * CONSTATS_HISTOGRAM_SUB_BUCKETS + ( value >> exponent );
+}
+
+/**
+ * This function returns the smallest value that falls in the given bucket.
+ */
+static inline
+int64_t constats_histogram_lowest ( uint64_t index )
+{
+	if ( index < 2 * CONSTATS_HISTOGRAM_SUB_BUCKETS )
+		return index;
+
+	int exponent = index / CONSTATS_HISTOGRAM_SUB_BUCKETS - 1;
+	return (int64_t) ( index - exponent * CONSTATS_HISTOGRAM_SUB_BUCKETS ) << exponent;
+}
+
+/**
+ * This function returns the largest value that falls in the given bucket.
+ */
+static inline
+int64_t constats_histogram_highest ( uint64_t index )
+{
+	if ( index + 1 >= CONSTATS_HISTOGRAM_BUCKETS )
+		return INF;
+
+	return constats_histogram_lowest( index + 1 ) - 1;
+}
+
+/**
+ * This function returns the value a bucket stands for: the midpoint of the
+ * part of the bucket between the histogram's min and max.
+ */
+static inline
+double constats_histogram_midpoint ( const histogram_t* hist, uint64_t index )
+{
+	int64_t low  = constats_histogram_lowest( index );
+	int64_t high = constats_histogram_highest( index );
+
+	low  = low > hist->min ? low : hist->min;
+	high = high < hist->max ? high : hist->max;
+
+	return ( (double) low + (double) high ) / 2;
+}
+
+/**
+ * This function records count copies of a value.
+ */
+static inline
+void constats_histogram_record_n ( histogram_t* hist, int64_t value, uint64_t count )
+{
+	if ( value < 0 )
+		value = 0;
+
+	// Error Checking
+	if ( count == 0 )
+		return;
+
+	double delta = value - hist->mean;
+
+	hist->counts[constats_histogram_index( value )] += count;
+	hist->N    += count;
+	hist->mean += delta * ( (double) count / (double) hist->N );
+	hist->m2   += delta * ( value - hist->mean ) * count;
+
+	if ( value < hist->min )
+		hist->min = value;
+
+	if ( value > hist->max )
+		hist->max = value;
+}
+
+/**
+ * This function records one value.
+ */
+static inline
+void constats_histogram_record ( histogram_t* hist, int64_t value )
+{
+	constats_histogram_record_n( hist, value, 1 );
+}
+
+/**
+ * This function adds the count, moments and range of N other values to
+ * dst, leaving the buckets alone.
+ */
+static inline
+void constats_histogram_merge_moments ( histogram_t* dst, uint64_t N, double mean, double m2, int64_t min, int64_t max )
+{
+	// Error Checking
+	if ( N == 0 )
+		return;
+
+	uint64_t total = dst->N + N;
+	double delta   = mean - dst->mean;
+
+	dst->mean += delta * ( (double) N / (double) total );
+	dst->m2   += m2 + delta * delta * ( (double) dst->N * (double) N / (double) total );
+	dst->N     = total;
+
+	if ( min < dst->min )
+		dst->min = min;
+
+	if ( max > dst->max )
+		dst->max = max;
+}
+
+/**
+ * This function records a latency measured by an open-loop load generator
+ * that meant to issue a request every expected_interval, back-filling the
+ * latencies of the requests a stall kept it from issuing. The back-filled
+ * values in one bucket are an arithmetic run, whose count, mean and m2
+ * are known in closed form, so each bucket is filled in one step.
+ */
+static inline
+void constats_histogram_record_corrected ( histogram_t* hist, int64_t value, int64_t expected_interval )
+{
+	constats_histogram_record( hist, value );
+
+	if ( expected_interval <= 0 || value <= expected_interval )
+		return;
+
+	double step = (double) expected_interval;
+	int64_t missing;
+
+	for ( missing = value - expected_interval; missing >= expected_interval; )
+	{
+		uint64_t index = constats_histogram_index( missing );
+		int64_t floor  = constats_histogram_lowest( index );
+
+		if ( floor < expected_interval )
+			floor = expected_interval;
+
+		uint64_t count = (uint64_t) ( ( missing - floor ) / expected_interval ) + 1;
+		int64_t last   = missing - (int64_t) ( count - 1 ) * expected_interval;
+		double run     = (double) count;
+
+		hist->counts[index] += count;
+		constats_histogram_merge_moments( hist, count, ( (double) missing + (double) last ) / 2,
+		                                  step * step * run * ( run * run - 1 ) / 12, last, missing );
+
+		missing = last - expected_interval;
+	}
+}
+
+/**
+ * This function adds every value in src to dst.
+ */
+static inline
+void constats_histogram_merge ( histogram_t* dst, const histogram_t* src )
+{
+	register uint64_t i;
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+		dst->counts[i] += src->counts[i];
+
+	constats_histogram_merge_moments( dst, src->N, src->mean, src->m2, src->min, src->max );
+}
+
+/**
+ * This function checks that a histogram from elsewhere, such as another
+ * process, is consistent before it is merged: the buckets add up to N,
+ * min and max fall in the first and last non-empty buckets, and the
+ * moments are finite. It returns 0 if so and -1 otherwise.
+ */
+static inline
+int constats_histogram_validate ( const histogram_t* hist )
+{
+	register uint64_t i;
+	uint64_t total = 0;
+	uint64_t first = CONSTATS_HISTOGRAM_BUCKETS;
+	uint64_t last  = 0;
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+	{
+		if ( hist->counts[i] == 0 )
+			continue;
+
+		// Error Checking
+		if ( hist->counts[i] > UINT64_MAX - total )
+			return -1;
+
+		total += hist->counts[i];
+		last   = i;
+
+		if ( first == CONSTATS_HISTOGRAM_BUCKETS )
+			first = i;
+	}
+
+	if ( total != hist->N || !isfinite( hist->mean ) || !isfinite( hist->m2 ) || hist->m2 < 0 )
+		return -1;
+
+	if ( hist->N == 0 )
+		return 0;
+
+	if ( hist->min < 0 || hist->min > hist->max
+	  || constats_histogram_index( hist->min ) != first || constats_histogram_index( hist->max ) != last )
+		return -1;
+
+	return 0;
+}
+
+/**
+ * This function returns the value below which the given percentage of
+ * recorded values fall, to within the bucket width.
+ */
+static inline
+int64_t constats_histogram_percentile ( const histogram_t* hist, double percentile )
+{
+	register uint64_t i;
+	register uint64_t seen;
+
+	if ( hist->N == 0 )
+		return 0;
+
+	uint64_t rank = (uint64_t) ceil( percentile / 100 * hist->N );
+
+	if ( rank == 0 )
+		rank = 1;
+
+	for ( seen = 0, i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+	{
+		seen += hist->counts[i];
+
+		if ( seen >= rank )
+		{
+			int64_t value = constats_histogram_highest( i );
+			return value < hist->max ? value : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+/**
+ * This function populates the stat data structure from the histogram.
+ * The outlier rule matches constats_calculate_stats, applied to buckets.
+ */
+static inline
+int constats_histogram_calculate_stats ( const histogram_t* hist, stats_t* stat )
+{
+	register uint64_t i;
+
+	// Error Checking
+	if ( stat == NULL || hist->N == 0 )
+		return -1;
+
+	double mean     = hist->mean;
+	double variance = hist->m2 / (double) hist->N;
+
+	stat->N     = hist->N;
+	stat->mean  = mean;
+	stat->stdev = variance > 0 ? sqrt( variance ) : 0;
+	stat->min   = hist->min;
+	stat->max   = hist->max;
+
+	double abdevSum = 0;
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+		if ( hist->counts[i] > 0 )
+			abdevSum += hist->counts[i] * ABSOLUTE( constats_histogram_midpoint( hist, i ) - mean );
+
+	stat->abdev     = abdevSum / (double) hist->N;
+	stat->tolerance = stat->abdev > INF / 32 ? INF : (int64_t) ( 5 * stat->abdev );
+
+	double upper_thresh = stat->tolerance == INF ? INF : mean + stat->tolerance;
+	double lower_thresh = stat->tolerance == INF ? NINF : mean - stat->tolerance;
+
+	uint64_t normN      = 0;
+	double normSum      = 0;
+
+	stat->outliers = 0;
+	stat->norm_min = INF;
+	stat->norm_max = NINF;
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+	{
+		if ( hist->counts[i] == 0 )
+			continue;
+
+		double mid = constats_histogram_midpoint( hist, i );
+
+		if ( mid > upper_thresh || mid < lower_thresh )
+		{
+			stat->outliers += hist->counts[i];
+			continue;
+		}
+
+		normN   += hist->counts[i];
+		normSum += mid * hist->counts[i];
+
+		int64_t low  = constats_histogram_lowest( i ) > hist->min ? constats_histogram_lowest( i ) : hist->min;
+		int64_t high = constats_histogram_highest( i ) < hist->max ? constats_histogram_highest( i ) : hist->max;
+
+		if ( low < stat->norm_min )
+			stat->norm_min = low;
+
+		if ( high > stat->norm_max )
+			stat->norm_max = high;
+	}
+
+	stat->norm_mean = normN ? normSum / normN : mean;
+
+	// Deviations are taken from the norm mean in a second pass, like constats_calculate_stats
+	double normAbdevSum = 0;
+	double normStdevSum = 0;
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+	{
+		double mid = constats_histogram_midpoint( hist, i );
+
+		if ( hist->counts[i] > 0 && mid <= upper_thresh && mid >= lower_thresh )
+		{
+			double dev = ABSOLUTE( mid - stat->norm_mean );
+			normAbdevSum += hist->counts[i] * dev;
+			normStdevSum += hist->counts[i] * dev * dev;
+		}
+	}
+
+	stat->norm_abdev = normN ? normAbdevSum / normN : stat->abdev;
+	stat->norm_stdev = normN ? sqrt( normStdevSum / normN ) : stat->stdev;
+
+	return 0;
+}
+
+/**
+ * This function prints the histogram's statistics and percentiles to stdout.
+ */
+static inline
+int constats_histogram_print_stats ( const histogram_t* hist )
+{
+	static const double percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+	char value[CONSTATS_FORMAT_MAX];
+	stats_t stat;
+	unsigned i;
+
+	if ( constats_histogram_calculate_stats( hist, &stat ) != 0 )
+		return -1;
+
+	constats_print_stats_header( &stat );
+
+	for ( i = 0; i < sizeof( percentiles ) / sizeof( percentiles[0] ); ++i )
+	{
+		constats_format_sample( constats_histogram_percentile( hist, percentiles[i] ), value );
+		printf ( "p%-6g : %s\n", percentiles[i], value );
+	}
+
+	constats_format_sample( stat.max, value );
+	printf ( "p100    : %s\n", value );
+	printf ( "-------------------------------------------------------------------------------\n" );
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,379 @@
+/**
+ * @File     : constats_lazy.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a lazy stats_t. A lazy_stats_t is bound to a
+ * sample set and computes a statistic the first time it is asked for,
+ * along with whatever it depends on, and keeps it for later calls. A
+ * caller that only needs the minimum and maximum pays for one pass, and
+ * one that only needs the mean pays for one pass, instead of the three
+ * passes and tolerance sketch of constats_calculate_stats.
+ *
+ * The statistics come from four computations:
+ *
+ *   the mean pass        mean, and min and max if asked for together
+ *   the tolerance sketch tolerance, over the first sixteenth of the samples
+ *   the deviation pass   stdev, abdev, min, max, outliers, norm_mean,
+ *                        norm_min and norm_max, given the mean and tolerance
+ *   the norm pass        norm_stdev and norm_abdev, given norm_mean
+ *
+ * Pass every field needed to constats_lazy_request at once so each
+ * computation runs at most once for all of them. The deviation and norm
+ * passes are the ones constats_calculate_stats runs, so each field matches
+ * it bit for bit. The samples must not change while the lazy_stats_t is
+ * in use.
+ *
+ * The accessors store one statistic through their second argument and,
+ * like constats_lazy_request, return -1 for a NULL or unbound lazy_stats_t.
+ */
+
+#ifndef CONSTATS_LAZY_LIB_LOCK
+#define CONSTATS_LAZY_LIB_LOCK
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constats.h"
+
+// Fields of stats_t
+#define CONSTATS_FIELD_MEAN       0x001
+#define CONSTATS_FIELD_STDEV      0x002
+#define CONSTATS_FIELD_ABDEV      0x004
+#define CONSTATS_FIELD_MIN        0x008
+#define CONSTATS_FIELD_MAX        0x010
+#define CONSTATS_FIELD_TOLERANCE  0x020
+#define CONSTATS_FIELD_OUTLIERS   0x040
+#define CONSTATS_FIELD_NORM_MEAN  0x080
+#define CONSTATS_FIELD_NORM_STDEV 0x100
+#define CONSTATS_FIELD_NORM_ABDEV 0x200
+#define CONSTATS_FIELD_NORM_MIN   0x400
+#define CONSTATS_FIELD_NORM_MAX   0x800
+#define CONSTATS_FIELD_ALL        0xfff
+
+// The fields each computation produces
+#define CONSTATS_LAZY_EXTREMES   ( CONSTATS_FIELD_MIN | CONSTATS_FIELD_MAX )
+#define CONSTATS_LAZY_DEVIATIONS ( CONSTATS_FIELD_STDEV | CONSTATS_FIELD_ABDEV | CONSTATS_LAZY_EXTREMES | CONSTATS_FIELD_OUTLIERS | \
+                                   CONSTATS_FIELD_NORM_MEAN | CONSTATS_FIELD_NORM_MIN | CONSTATS_FIELD_NORM_MAX )
+#define CONSTATS_LAZY_NORM       ( CONSTATS_FIELD_NORM_STDEV | CONSTATS_FIELD_NORM_ABDEV )
+
+typedef struct lazy_stats_t
+{
+	int64_t* sample_set;	// The samples the statistics are of
+	uint64_t ready;			// The fields computed so far
+	stats_t stat;			// The fields computed so far, N always
+	stats_pass_t pass;		// The deviation pass, kept for the norm pass
+
+} lazy_stats_t;
+
+/**
+ * This function binds a lazy_stats_t to a sample set without reading it.
+ */
+static inline
+int constats_lazy_init ( lazy_stats_t* lazy, int64_t* sample_set, uint64_t sample_size )
+{
+	// Error Checking
+	if ( lazy == NULL || sample_set == NULL || sample_size == 0 )
+		return -1;
+
+	memset( lazy, 0, sizeof( lazy_stats_t ) );
+	lazy->sample_set = sample_set;
+	lazy->stat.N     = sample_size;
+
+	return 0;
+}
+
+/**
+ * This function computes the mean, and the extremes with it if asked.
+ */
+static inline
+void constats_lazy_mean_pass ( lazy_stats_t* lazy, int extremes )
+{
+	int64_t* sample_set = lazy->sample_set;
+	register uint64_t sample_size = lazy->stat.N;
+	register double sum = 0;
+	register uint64_t i;
+
+	// Fused with the extremes, summed in the same order as constats_get_mean
+	if ( extremes )
+	{
+		register int64_t min = INF;
+		register int64_t max = NINF;
+
+		for ( i = 0; i < sample_size; ++i )
+		{
+			sum += sample_set[i];
+
+			if ( sample_set[i] < min )
+				min = sample_set[i];
+
+			if ( sample_set[i] > max )
+				max = sample_set[i];
+		}
+
+		lazy->stat.min  = min;
+		lazy->stat.max  = max;
+		lazy->stat.mean = sum / (double) sample_size;
+		lazy->ready    |= CONSTATS_LAZY_EXTREMES;
+	}
+	else
+	{
+		lazy->stat.mean = constats_get_mean( sample_set, sample_size );
+	}
+
+	lazy->ready |= CONSTATS_FIELD_MEAN;
+}
+
+/**
+ * This function computes the extremes alone.
+ */
+static inline
+void constats_lazy_extremes_pass ( lazy_stats_t* lazy )
+{
+	int64_t* sample_set = lazy->sample_set;
+	register uint64_t sample_size = lazy->stat.N;
+	register int64_t min = INF;
+	register int64_t max = NINF;
+	register uint64_t i;
+
+	for ( i = 0; i < sample_size; ++i )
+	{
+		if ( sample_set[i] < min )
+			min = sample_set[i];
+
+		if ( sample_set[i] > max )
+			max = sample_set[i];
+	}
+
+	lazy->stat.min = min;
+	lazy->stat.max = max;
+	lazy->ready   |= CONSTATS_LAZY_EXTREMES;
+}
+
+/**
+ * This function computes the requested fields that are not ready yet,
+ * running each computation they need at most once.
+ */
+static inline
+int constats_lazy_request ( lazy_stats_t* lazy, uint64_t fields )
+{
+	// Error Checking
+	if ( lazy == NULL || lazy->sample_set == NULL || lazy->stat.N == 0 )
+		return -1;
+
+	uint64_t need = fields & CONSTATS_FIELD_ALL & ~lazy->ready;
+
+	if ( need == 0 )
+		return 0;
+
+	// Work back from the last computation to what it depends on
+	int norm       = ( need & CONSTATS_LAZY_NORM ) != 0;
+	int deviations = norm ? !( lazy->ready & CONSTATS_FIELD_NORM_MEAN ) : ( need & CONSTATS_LAZY_DEVIATIONS & ~CONSTATS_LAZY_EXTREMES ) != 0;
+	int tolerance  = deviations || ( need & CONSTATS_FIELD_TOLERANCE );
+	int mean       = deviations || ( need & CONSTATS_FIELD_MEAN );
+	int extremes   = !deviations && ( need & CONSTATS_LAZY_EXTREMES );
+
+	if ( mean && !( lazy->ready & CONSTATS_FIELD_MEAN ) )
+	{
+		constats_lazy_mean_pass( lazy, extremes );
+		extremes = 0;
+	}
+
+	if ( extremes )
+		constats_lazy_extremes_pass( lazy );
+
+	if ( tolerance && !( lazy->ready & CONSTATS_FIELD_TOLERANCE ) )
+	{
+		lazy->stat.tolerance = constats_get_tolerance( lazy->sample_set, lazy->stat.N );
+		lazy->ready |= CONSTATS_FIELD_TOLERANCE;
+	}
+
+	if ( deviations )
+	{
+		constats_deviation_pass( lazy->sample_set, lazy->stat.N, &lazy->stat, &lazy->pass );
+		lazy->ready |= CONSTATS_LAZY_DEVIATIONS;
+	}
+
+	if ( norm )
+	{
+		constats_norm_pass( lazy->sample_set, lazy->stat.N, &lazy->stat, &lazy->pass );
+		lazy->ready |= CONSTATS_LAZY_NORM;
+	}
+
+	return 0;
+}
+
+/**
+ * This function returns the statistics with at least the requested
+ * fields filled in, or NULL on error.
+ */
+static inline
+const stats_t* constats_lazy_get ( lazy_stats_t* lazy, uint64_t fields )
+{
+	if ( constats_lazy_request( lazy, fields ) != 0 )
+		return NULL;
+
+	return &lazy->stat;
+}
+
+/**
+ * These functions store one statistic each in value, computing it on
+ * first use. They return -1 on error and leave value untouched.
+ */
+static inline
+int constats_lazy_mean ( lazy_stats_t* lazy, double* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_MEAN );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->mean;
+	return 0;
+}
+
+static inline
+int constats_lazy_stdev ( lazy_stats_t* lazy, double* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_STDEV );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->stdev;
+	return 0;
+}
+
+static inline
+int constats_lazy_abdev ( lazy_stats_t* lazy, double* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_ABDEV );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->abdev;
+	return 0;
+}
+
+static inline
+int constats_lazy_min ( lazy_stats_t* lazy, int64_t* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_MIN );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->min;
+	return 0;
+}
+
+static inline
+int constats_lazy_max ( lazy_stats_t* lazy, int64_t* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_MAX );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->max;
+	return 0;
+}
+
+static inline
+int constats_lazy_tolerance ( lazy_stats_t* lazy, int64_t* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_TOLERANCE );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->tolerance;
+	return 0;
+}
+
+static inline
+int constats_lazy_outliers ( lazy_stats_t* lazy, uint64_t* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_OUTLIERS );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->outliers;
+	return 0;
+}
+
+static inline
+int constats_lazy_norm_mean ( lazy_stats_t* lazy, double* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_NORM_MEAN );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->norm_mean;
+	return 0;
+}
+
+static inline
+int constats_lazy_norm_stdev ( lazy_stats_t* lazy, double* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_NORM_STDEV );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->norm_stdev;
+	return 0;
+}
+
+static inline
+int constats_lazy_norm_abdev ( lazy_stats_t* lazy, double* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_NORM_ABDEV );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->norm_abdev;
+	return 0;
+}
+
+static inline
+int constats_lazy_norm_min ( lazy_stats_t* lazy, int64_t* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_NORM_MIN );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->norm_min;
+	return 0;
+}
+
+static inline
+int constats_lazy_norm_max ( lazy_stats_t* lazy, int64_t* value )
+{
+	const stats_t* stat = constats_lazy_get( lazy, CONSTATS_FIELD_NORM_MAX );
+
+	// Error Checking
+	if ( stat == NULL || value == NULL )
+		return -1;
+
+	*value = stat->norm_max;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * @File     : constats_parallel.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains parallel versions of the constats kernels, run
+ * on a constats_pool.h pool. Work smaller than CONSTATS_PARALLEL_THRESHOLD
+ * samples is done serially, since waking the workers would cost more
+ * than it saves.
+ *
+ * The batch and group-by routines compute one stats_t per segment. Every
+ * segment is cut into chunks of CONSTATS_PARALLEL_GRAIN samples and the
+ * chunks of all segments are scheduled together, so one huge segment
+ * is spread over every thread instead of holding up the batch while
+ * the small ones finish.
+ *
+ * Every pass feeds each chunk through the serial routine's per-sample
+ * steps, keeps one partial result per chunk and combines them in chunk
+ * order, so results do not depend on scheduling. Sums are added
+ * in a different order than the serial routine adds them, so the
+ * floating point fields may differ from it in the last few bits. The
+ * tolerance sketch is split into the same CONSTATS_SKETCH_BLOCK blocks
+ * the serial routine sums, so the tolerance, and with it the outliers,
+ * match it exactly.
+ */
+
+#ifndef CONSTATS_PARALLEL_LIB_LOCK
+#define CONSTATS_PARALLEL_LIB_LOCK
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_pool.h"
+
+#ifndef CONSTATS_PARALLEL_THRESHOLD
+#define CONSTATS_PARALLEL_THRESHOLD ( 1UL << 18 )
+#endif
+
+// The number of samples per chunk
+#ifndef CONSTATS_PARALLEL_GRAIN
+#define CONSTATS_PARALLEL_GRAIN ( 1UL << 15 )
+#endif
+
+typedef struct stats_chunk_t
+{
+	uint64_t segment;		// The segment the chunk belongs to
+	uint64_t begin;			// The first sample of the chunk
+	uint64_t end;			// One past the last sample of the chunk
+
+	double sum;				// Pass 1: the sum of the samples
+	stats_pass_t pass;		// Passes 2 and 3: the chunk's share of the serial passes
+
+} stats_chunk_t;
+
+typedef struct stats_sketch_t
+{
+	uint64_t segment;		// The segment the block belongs to
+	uint64_t begin;			// The first sample of the block
+	uint64_t end;			// One past the last sample of the block
+
+	float mean;				// The mean of the segment's whole sketch
+	float sum;				// The block's sum, then its sum of absolute deviations
+
+} stats_sketch_t;
+
+typedef struct stats_job_t
+{
+	int64_t* sample_set;		// The samples
+	const uint64_t* offsets;	// Where each segment starts
+	stats_chunk_t* chunks;		// The chunks of every segment, in order
+	stats_sketch_t* sketches;	// The sketch blocks of every segment, in order
+	stats_t* stats;				// One per segment
+
+} stats_job_t;
+
+static inline
+void constats_parallel_sum ( void* arg, uint64_t begin, uint64_t end, uint64_t unused )
+{
+	stats_job_t* job = (stats_job_t*) arg;
+	register uint64_t c;
+	(void) unused;
+
+	for ( c = begin; c < end; ++c )
+	{
+		stats_chunk_t* chunk = &job->chunks[c];
+		register double sum = 0;
+		register uint64_t i;
+
+		for ( i = chunk->begin; i < chunk->end; ++i )
+			sum += job->sample_set[i];
+
+		chunk->sum = sum;
+	}
+}
+
+static inline
+void constats_parallel_sketch_sum ( void* arg, uint64_t begin, uint64_t end, uint64_t unused )
+{
+	stats_job_t* job = (stats_job_t*) arg;
+	register uint64_t b;
+	(void) unused;
+
+	for ( b = begin; b < end; ++b )
+	{
+		stats_sketch_t* block = &job->sketches[b];
+		block->sum = constats_sketch_block_sum( job->sample_set + block->begin, block->end - block->begin );
+	}
+}
+
+static inline
+void constats_parallel_sketch_abdev ( void* arg, uint64_t begin, uint64_t end, uint64_t unused )
+{
+	stats_job_t* job = (stats_job_t*) arg;
+	register uint64_t b;
+	(void) unused;
+
+	for ( b = begin; b < end; ++b )
+	{
+		stats_sketch_t* block = &job->sketches[b];
+		block->sum = constats_sketch_block_abdev( job->sample_set + block->begin, block->end - block->begin, block->mean );
+	}
+}
+
+static inline
+void constats_parallel_deviations ( void* arg, uint64_t begin, uint64_t end, uint64_t unused )
+{
+	stats_job_t* job = (stats_job_t*) arg;
+	int64_t* sample_set = job->sample_set;
+	register uint64_t c;
+	(void) unused;
+
+	for ( c = begin; c < end; ++c )
+	{
+		stats_chunk_t* chunk = &job->chunks[c];
+		stats_t* stat = &job->stats[chunk->segment];
+		register uint64_t i;
+
+		constats_pass_init( &chunk->pass, stat->mean, stat->tolerance );
+
+		for ( i = chunk->begin; i < chunk->end; ++i )
+			constats_pass_deviation( &chunk->pass, sample_set[i] );
+	}
+}
+
+static inline
+void constats_parallel_norm_deviations ( void* arg, uint64_t begin, uint64_t end, uint64_t unused )
+{
+	stats_job_t* job = (stats_job_t*) arg;
+	int64_t* sample_set = job->sample_set;
+	register uint64_t c;
+	(void) unused;
+
+	for ( c = begin; c < end; ++c )
+	{
+		stats_chunk_t* chunk = &job->chunks[c];
+		register uint64_t i;
+
+		chunk->pass.norm_mean = job->stats[chunk->segment].norm_mean;
+
+		for ( i = chunk->begin; i < chunk->end; ++i )
+			constats_pass_norm( &chunk->pass, sample_set[i] );
+	}
+}
+
+/**
+ * This function adds up each segment's sketch blocks in block order, as
+ * constats_get_tolerance does. After the block sums it hands every block
+ * its segment's sketch mean, after the absolute deviations it sets each
+ * segment's tolerance.
+ */
+static inline
+void constats_parallel_sketch_combine ( stats_job_t* job, uint64_t blocks, int deviations )
+{
+	uint64_t b, next;
+
+	for ( b = 0; b < blocks; b = next )
+	{
+		uint64_t segment     = job->sketches[b].segment;
+		uint64_t sketch_size = constats_sketch_size( job->offsets[segment + 1] - job->offsets[segment] );
+		float sum = 0;
+
+		for ( next = b; next < blocks && job->sketches[next].segment == segment; ++next )
+			sum += job->sketches[next].sum;
+
+		if ( deviations )
+		{
+			job->stats[segment].tolerance = constats_sketch_tolerance( sum, sketch_size );
+			continue;
+		}
+
+		for ( ; b < next; ++b )
+			job->sketches[b].mean = sum / (float) sketch_size;
+	}
+}
+
+/**
+ * This function calculates the statistics of every segment of a sample
+ * set, spread over a pool (NULL for the process-wide pool). Segment s is
+ * sample_set[offsets[s]] up to sample_set[offsets[s + 1]], so offsets
+ * holds segments + 1 entries. Empty segments get a zeroed stats_t.
+ */
+static inline
+int constats_calculate_stats_batch ( int64_t* sample_set, const uint64_t* offsets, uint64_t segments, stats_t* stats, pool_t* pool )
+{
+	stats_job_t job;
+	uint64_t count  = 0;
+	uint64_t blocks = 0;
+	uint64_t s, c, b;
+
+	// Error Checking
+	if ( offsets == NULL || stats == NULL )
+		return -1;
+
+	for ( s = 0; s < segments; ++s )
+	{
+		if ( offsets[s + 1] < offsets[s] )
+			return -1;
+
+		count  += ( offsets[s + 1] - offsets[s] + CONSTATS_PARALLEL_GRAIN - 1 ) / CONSTATS_PARALLEL_GRAIN;
+		blocks += ( constats_sketch_size( offsets[s + 1] - offsets[s] ) + CONSTATS_SKETCH_BLOCK - 1 ) / CONSTATS_SKETCH_BLOCK;
+		memset( &stats[s], 0, sizeof( stats_t ) );
+	}
+
+	job.chunks   = NULL;
+	job.sketches = NULL;
+
+	if ( offsets[segments] - offsets[0] >= CONSTATS_PARALLEL_THRESHOLD && constats_pool_threads( pool ) > 1 )
+	{
+		job.chunks   = (stats_chunk_t*) malloc( count * sizeof( stats_chunk_t ) );
+		job.sketches = (stats_sketch_t*) malloc( blocks * sizeof( stats_sketch_t ) );
+	}
+
+	// Too small to share, or no memory to share it with
+	if ( job.chunks == NULL || job.sketches == NULL )
+	{
+		free( job.chunks );
+		free( job.sketches );
+
+		for ( s = 0; s < segments; ++s )
+			if ( offsets[s + 1] > offsets[s] )
+				constats_calculate_stats( sample_set + offsets[s], offsets[s + 1] - offsets[s], &stats[s] );
+
+		return 0;
+	}
+
+	job.sample_set = sample_set;
+	job.offsets    = offsets;
+	job.stats      = stats;
+
+	for ( c = 0, b = 0, s = 0; s < segments; ++s )
+	{
+		uint64_t sketch_end = offsets[s] + constats_sketch_size( offsets[s + 1] - offsets[s] );
+		uint64_t begin;
+
+		for ( begin = offsets[s]; begin < offsets[s + 1]; begin += CONSTATS_PARALLEL_GRAIN, ++c )
+		{
+			job.chunks[c].segment = s;
+			job.chunks[c].begin   = begin;
+			job.chunks[c].end     = begin + CONSTATS_PARALLEL_GRAIN < offsets[s + 1] ? begin + CONSTATS_PARALLEL_GRAIN : offsets[s + 1];
+		}
+
+		for ( begin = offsets[s]; begin < sketch_end; begin += CONSTATS_SKETCH_BLOCK, ++b )
+		{
+			job.sketches[b].segment = s;
+			job.sketches[b].begin   = begin;
+			job.sketches[b].end     = begin + CONSTATS_SKETCH_BLOCK < sketch_end ? begin + CONSTATS_SKETCH_BLOCK : sketch_end;
+		}
+	}
+
+	// Pass 1: the means, and the tolerances from the sketch blocks
+	constats_pool_for( pool, count, 1, constats_parallel_sum, &job );
+	constats_pool_for( pool, blocks, 1, constats_parallel_sketch_sum, &job );
+	constats_parallel_sketch_combine( &job, blocks, 0 );
+	constats_pool_for( pool, blocks, 1, constats_parallel_sketch_abdev, &job );
+	constats_parallel_sketch_combine( &job, blocks, 1 );
+
+	for ( c = 0; c < count; ++c )
+		stats[job.chunks[c].segment].mean += job.chunks[c].sum;
+
+	for ( s = 0; s < segments; ++s )
+	{
+		stats[s].N        = offsets[s + 1] - offsets[s];
+		stats[s].mean     = stats[s].N > 0 ? stats[s].mean / (double) stats[s].N : 0;
+		stats[s].min      = INF;
+		stats[s].max      = NINF;
+		stats[s].norm_min = INF;
+		stats[s].norm_max = NINF;
+	}
+
+	// Pass 2: deviations, extremes and outliers
+	constats_pool_for( pool, count, 1, constats_parallel_deviations, &job );
+
+	// Each sum collects in its field until the segment is complete
+	for ( c = 0; c < count; ++c )
+	{
+		stats_pass_t* pass = &job.chunks[c].pass;
+		stats_t* stat = &stats[job.chunks[c].segment];
+
+		stat->stdev     += pass->stdev_sum;
+		stat->abdev     += pass->abdev_sum;
+		stat->norm_mean += pass->norm_sum;
+		stat->outliers  += pass->outliers;
+
+		if ( pass->min < stat->min )
+			stat->min = pass->min;
+
+		if ( pass->max > stat->max )
+			stat->max = pass->max;
+
+		if ( pass->norm_min < stat->norm_min )
+			stat->norm_min = pass->norm_min;
+
+		if ( pass->norm_max > stat->norm_max )
+			stat->norm_max = pass->norm_max;
+	}
+
+	for ( s = 0; s < segments; ++s )
+	{
+		if ( stats[s].N == 0 )
+		{
+			memset( &stats[s], 0, sizeof( stats_t ) );
+			continue;
+		}
+
+		stats[s].stdev     = sqrt( stats[s].stdev / (double) stats[s].N );
+		stats[s].abdev     = stats[s].abdev / (double) stats[s].N;
+		stats[s].norm_mean = stats[s].norm_mean / (double) ( stats[s].N - stats[s].outliers );
+	}
+
+	// Pass 3: deviations without the outliers
+	constats_pool_for( pool, count, 1, constats_parallel_norm_deviations, &job );
+
+	for ( c = 0; c < count; ++c )
+	{
+		stats[job.chunks[c].segment].norm_stdev += job.chunks[c].pass.norm_stdev_sum;
+		stats[job.chunks[c].segment].norm_abdev += job.chunks[c].pass.norm_abdev_sum;
+	}
+
+	for ( s = 0; s < segments; ++s )
+	{
+		if ( stats[s].N == 0 )
+			continue;
+
+		stats[s].norm_stdev = sqrt( stats[s].norm_stdev / (double) ( stats[s].N - stats[s].outliers ) );
+		stats[s].norm_abdev = stats[s].norm_abdev / (double) ( stats[s].N - stats[s].outliers );
+	}
+
+	free( job.chunks );
+	free( job.sketches );
+	return 0;
+}
+
+/**
+ * This function is constats_calculate_stats spread over a pool (NULL for
+ * the process-wide pool).
+ */
+static inline
+int constats_calculate_stats_parallel ( int64_t* sample_set, uint64_t sample_size, stats_t* stat, pool_t* pool )
+{
+	uint64_t offsets[2] = { 0, sample_size };
+
+	// Error Checking
+	if ( stat == NULL || sample_size == 0 )
+		return -1;
+
+	return constats_calculate_stats_batch( sample_set, offsets, 1, stat, pool );
+}
+
+/**
+ * This function calculates the statistics of every group of a sample set,
+ * where sample i belongs to group groups[i], below group_count. Samples
+ * keep their order within a group, so every group's stats_t is the one
+ * constats_calculate_stats gives for its samples alone.
+ */
+static inline
+int constats_calculate_stats_grouped ( int64_t* sample_set, const uint32_t* groups, uint64_t sample_size,
+                                       uint64_t group_count, stats_t* stats, pool_t* pool )
+{
+	uint64_t i;
+
+	// Error Checking
+	if ( sample_set == NULL || groups == NULL || stats == NULL || group_count == 0 )
+		return -1;
+
+	uint64_t* offsets = (uint64_t*) calloc( group_count + 1, sizeof( uint64_t ) );
+	uint64_t* next    = (uint64_t*) malloc( group_count * sizeof( uint64_t ) );
+	int64_t* sorted   = (int64_t*) malloc( ( sample_size > 0 ? sample_size : 1 ) * sizeof( int64_t ) );
+	int error_code    = -1;
+
+	// Counting sort by group, which keeps the order within each group
+	for ( i = 0; offsets != NULL && i < sample_size && groups[i] < group_count; ++i )
+		offsets[groups[i] + 1]++;
+
+	if ( offsets != NULL && next != NULL && sorted != NULL && i == sample_size )
+	{
+		for ( i = 0; i < group_count; ++i )
+		{
+			offsets[i + 1] += offsets[i];
+			next[i] = offsets[i];
+		}
+
+		for ( i = 0; i < sample_size; ++i )
+			sorted[next[groups[i]]++] = sample_set[i];
+
+		error_code = constats_calculate_stats_batch( sorted, offsets, group_count, stats, pool );
+	}
+
+	free( offsets );
+	free( next );
+	free( sorted );
+	return error_code;
+}
+
+#endif
@@ -0,0 +1,458 @@
+/**
+ * @File     : constats_perf.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains hardware performance counter sampling through
+ * perf_event_open. It counts cycles, instructions, cache misses and branch
+ * misses for the calling thread, in user space only. When the kernel lets
+ * user space read the counters directly the values come from rdpmc,
+ * otherwise one read(2) fetches the whole group.
+ *
+ * Counters that cannot be opened (no PMU in a VM, perf_event_paranoid,
+ * seccomp, or a non Linux system) are left out. Everything keeps working
+ * with whichever counters are left, even none.
+ *
+ * CONSTATS_SCOPE_COUNTERS( "name" ) behaves like CONSTATS_SCOPE and also
+ * records how much each counter moved, and constats_perf_print_all prints
+ * one stats_t per counter for every such site. These sites are kept apart
+ * from the plain scope sites, so constats_scope_print_all leaves them out.
+ * A thread's counters are closed when it exits.
+ */
+
+#ifndef CONSTATS_PERF_LIB_LOCK
+#define CONSTATS_PERF_LIB_LOCK
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "constats.h"
+#include "constats_clock.h"
+#include "constats_recorder.h"
+#include "constats_scope.h"
+
+// Counters
+#define CONSTATS_PERF_CYCLES        0
+#define CONSTATS_PERF_INSTRUCTIONS  1
+#define CONSTATS_PERF_CACHE_MISSES  2
+#define CONSTATS_PERF_BRANCH_MISSES 3
+#define CONSTATS_PERF_COUNTERS      4
+
+typedef struct perf_counters_t
+{
+	int fd[CONSTATS_PERF_COUNTERS];		// The counter file descriptors, -1 if unavailable
+	void* page[CONSTATS_PERF_COUNTERS];	// The mmap'd control pages used by rdpmc
+	int slot[CONSTATS_PERF_COUNTERS];	// The position of each counter in a group read
+	int leader;							// The counter leading the group, -1 if none
+	int opened;							// The number of counters opened
+
+} perf_counters_t;
+
+static const char* constats_perf_names[CONSTATS_PERF_COUNTERS] =
+	{ "Cycles", "Instructions", "Cache Misses", "Branch Misses" };
+
+/**
+ * This function opens every counter it can for the calling thread. It
+ * returns the number of counters opened, which may be 0.
+ */
+static inline
+int constats_perf_open ( perf_counters_t* perf )
+{
+	int i;
+
+	memset( perf, 0, sizeof( perf_counters_t ) );
+	perf->leader = -1;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+		perf->fd[i]   = -1;
+		perf->page[i] = NULL;
+		perf->slot[i] = -1;
+	}
+
+#ifdef __linux__
+	static const uint64_t configs[CONSTATS_PERF_COUNTERS] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+		struct perf_event_attr attr;
+		memset( &attr, 0, sizeof( attr ) );
+
+		attr.size           = sizeof( attr );
+		attr.type           = PERF_TYPE_HARDWARE;
+		attr.config         = configs[i];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		attr.read_format    = PERF_FORMAT_GROUP;
+
+		int group = perf->leader == -1 ? -1 : perf->fd[perf->leader];
+		int fd    = (int) syscall( SYS_perf_event_open, &attr, 0, -1, group, 0 );
+
+		if ( fd < 0 )
+			continue;
+
+		if ( perf->leader == -1 )
+			perf->leader = i;
+
+		perf->fd[i]   = fd;
+		perf->slot[i] = perf->opened++;
+
+		// The control page is only needed for rdpmc, so failing to map it is fine
+		void* page = mmap( NULL, sysconf( _SC_PAGESIZE ), PROT_READ, MAP_SHARED, fd, 0 );
+		perf->page[i] = page == MAP_FAILED ? NULL : page;
+	}
+#endif
+
+	return perf->opened;
+}
+
+/**
+ * This function closes every counter.
+ */
+static inline
+void constats_perf_close ( perf_counters_t* perf )
+{
+	int i;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+#ifdef __linux__
+		if ( perf->page[i] != NULL )
+			munmap( perf->page[i], sysconf( _SC_PAGESIZE ) );
+#endif
+
+		if ( perf->fd[i] != -1 )
+			close( perf->fd[i] );
+
+		perf->fd[i]   = -1;
+		perf->page[i] = NULL;
+	}
+
+	perf->leader = -1;
+	perf->opened = 0;
+}
+
+/**
+ * This function reads one counter with rdpmc. It returns -1 if the kernel
+ * does not allow it or the counter is not currently on the PMU.
+ */
+static inline
+int constats_perf_rdpmc ( perf_counters_t* perf, int counter, uint64_t* value )
+{
+#if defined(__linux__) && ( defined(__x86_64__) || defined(__i386__) )
+	volatile struct perf_event_mmap_page* pc = (volatile struct perf_event_mmap_page*) perf->page[counter];
+	uint32_t seq;
+	uint32_t index;
+	int64_t count;
+
+	if ( pc == NULL || !pc->cap_user_rdpmc )
+		return -1;
+
+	do
+	{
+		seq = pc->lock;
+		__asm__ volatile ( "" ::: "memory" );
+
+		index = pc->index;
+		count = pc->offset;
+
+		if ( index == 0 )
+			return -1;
+
+		uint32_t width = pc->pmc_width;
+		int64_t pmc    = (int64_t) __rdpmc( index - 1 );
+
+		// Sign extend the raw counter to 64 bits
+		pmc <<= 64 - width;
+		pmc >>= 64 - width;
+		count += pmc;
+
+		__asm__ volatile ( "" ::: "memory" );
+	} while ( pc->lock != seq );
+
+	*value = (uint64_t) count;
+	return 0;
+#else
+	(void) perf;
+	(void) counter;
+	(void) value;
+	return -1;
+#endif
+}
+
+/**
+ * This function reads every open counter into values, indexed by counter.
+ * Unavailable counters read as 0.
+ */
+static inline
+int constats_perf_read ( perf_counters_t* perf, uint64_t* values )
+{
+	int i;
+	int fallback = 0;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+		values[i] = 0;
+
+		if ( perf->fd[i] != -1 && constats_perf_rdpmc( perf, i, &values[i] ) != 0 )
+			fallback = 1;
+	}
+
+	if ( !fallback || perf->leader == -1 )
+		return 0;
+
+	uint64_t group[1 + CONSTATS_PERF_COUNTERS];
+
+	if ( read( perf->fd[perf->leader], group, sizeof( group ) ) < (ssize_t) sizeof( uint64_t ) )
+		return -1;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+		if ( perf->slot[i] != -1 && (uint64_t) perf->slot[i] < group[0] )
+			values[i] = group[1 + perf->slot[i]];
+
+	return 0;
+}
+
+// The calling thread's counters, closed when it exits
+__thread perf_counters_t constats_perf_thread;
+__thread int constats_perf_thread_opened = 0;
+pthread_key_t constats_perf_key;
+pthread_once_t constats_perf_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * This function closes a thread's counters as it exits.
+ */
+static inline
+void constats_perf_thread_close ( void* arg )
+{
+	constats_perf_close( (perf_counters_t*) arg );
+	constats_perf_thread_opened = 0;
+}
+
+static inline
+void constats_perf_key_create ( void )
+{
+	pthread_key_create( &constats_perf_key, constats_perf_thread_close );
+}
+
+/**
+ * This function returns the calling thread's counters, opening them on first use.
+ */
+static inline
+perf_counters_t* constats_perf_self ( void )
+{
+	if ( CONSTATS_UNLIKELY( !constats_perf_thread_opened ) )
+	{
+		pthread_once( &constats_perf_key_once, constats_perf_key_create );
+		constats_perf_open( &constats_perf_thread );
+		pthread_setspecific( constats_perf_key, &constats_perf_thread );
+		constats_perf_thread_opened = 1;
+	}
+
+	return &constats_perf_thread;
+}
+
+typedef struct perf_site_t
+{
+	scope_site_t scope;								// The timing half of the site
+	int state;										// The registration state of the counters
+	recorder_t counters[CONSTATS_PERF_COUNTERS];	// The counter deltas recorded at this site
+
+	struct perf_site_t* next;						// The next registered site
+
+} perf_site_t;
+
+typedef struct perf_scope_t
+{
+	perf_site_t* site;								// The site being measured
+	uint64_t start;									// The tick count when the scope was entered
+	uint64_t values[CONSTATS_PERF_COUNTERS];		// The counters when the scope was entered
+
+} perf_scope_t;
+
+// The list of registered counter sites, newest first
+perf_site_t* constats_perf_sites = NULL;
+
+#ifdef CONSTATS_DISABLE
+
+#define CONSTATS_SCOPE_COUNTERS(name)
+
+#else
+
+/**
+ * Times the rest of the enclosing block and counts the hardware events in it.
+ */
+#define CONSTATS_SCOPE_COUNTERS(name)                                                     \
+	static perf_site_t CONSTATS_CONCAT(constats_perf_site_, __LINE__) =                   \
+		{ .scope = CONSTATS_SITE_INITIALIZER( name, CONSTATS_SAMPLING_NONE, 1 ) };         \
+	perf_scope_t CONSTATS_CONCAT(constats_perf_scope_, __LINE__)                          \
+		__attribute__((cleanup(constats_perf_scope_exit))) =                             \
+		constats_perf_scope_enter( &CONSTATS_CONCAT(constats_perf_site_, __LINE__) )
+
+#endif
+
+/**
+ * This function registers a counter site, allocating a recorder for each
+ * counter and one for the timing half, which is not a registered scope site.
+ */
+static __attribute__((noinline))
+void constats_perf_register ( perf_site_t* site )
+{
+	int expected = CONSTATS_SITE_UNREGISTERED;
+	int i;
+
+	if ( !__atomic_compare_exchange_n( &site->state, &expected, CONSTATS_SITE_REGISTERING,
+	                                   0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+	{
+		while ( expected == CONSTATS_SITE_REGISTERING )
+		{
+			sched_yield();
+			expected = __atomic_load_n( &site->state, __ATOMIC_ACQUIRE );
+		}
+
+		return;
+	}
+
+	if ( constats_scope_site_init( &site->scope ) != 0 )
+	{
+		__atomic_store_n( &site->state, CONSTATS_SITE_FAILED, __ATOMIC_RELEASE );
+		return;
+	}
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+		if ( constats_recorder_init( &site->counters[i], CONSTATS_SITE_CAPACITY, CONSTATS_SITE_FLAGS ) != 0 )
+		{
+			while ( i-- > 0 )
+				constats_recorder_destroy( &site->counters[i] );
+
+			constats_recorder_destroy( &site->scope.recorder );
+			__atomic_store_n( &site->state, CONSTATS_SITE_FAILED, __ATOMIC_RELEASE );
+			return;
+		}
+	}
+
+	// Only this thread got past the exchange, so the timing half needs no registration
+	__atomic_store_n( &site->scope.state, CONSTATS_SITE_READY, __ATOMIC_RELEASE );
+
+	site->next = __atomic_load_n( &constats_perf_sites, __ATOMIC_RELAXED );
+
+	while ( !__atomic_compare_exchange_n( &constats_perf_sites, &site->next, site,
+	                                      1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+
+	__atomic_store_n( &site->state, CONSTATS_SITE_READY, __ATOMIC_RELEASE );
+}
+
+/**
+ * This function starts measuring a counter scope, registering its site
+ * first if needed.
+ */
+static inline
+perf_scope_t constats_perf_scope_enter ( perf_site_t* site )
+{
+	if ( CONSTATS_UNLIKELY( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY ) )
+		constats_perf_register( site );
+
+	perf_scope_t scope;
+	scope.site = site;
+	constats_perf_read( constats_perf_self(), scope.values );
+	scope.start = constats_clock_ticks();
+	return scope;
+}
+
+/**
+ * This function stops measuring a counter scope and records the elapsed
+ * nanoseconds and the change in every available counter.
+ */
+static inline
+void constats_perf_scope_exit ( perf_scope_t* scope )
+{
+	uint64_t end = constats_clock_ticks();
+	uint64_t values[CONSTATS_PERF_COUNTERS];
+	perf_counters_t* perf = constats_perf_self();
+	register perf_site_t* site = scope->site;
+	int i;
+
+	constats_perf_read( perf, values );
+
+	if ( CONSTATS_UNLIKELY( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY ) )
+		return;
+
+	constats_recorder_record_shared( &site->scope.recorder,
+	                                 constats_clock_elapsed_ns( end - scope->start, site->scope.ns_per_tick, site->scope.overhead_ns ) );
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+		if ( perf->fd[i] != -1 )
+			constats_recorder_record_shared( &site->counters[i], (int64_t) ( values[i] - scope->values[i] ) );
+}
+
+/**
+ * This function populates the stat data structure with one counter's
+ * statistics at a site. It fails if the counter was never available.
+ */
+static inline
+int constats_perf_calculate_stats ( perf_site_t* site, int counter, stats_t* stat )
+{
+	// Error Checking
+	if ( site == NULL || counter < 0 || counter >= CONSTATS_PERF_COUNTERS
+	  || __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY )
+		return -1;
+
+	return constats_calculate_stats ( site->counters[counter].samples, constats_recorder_size( &site->counters[counter] ), stat );
+}
+
+/**
+ * This function prints time and counter statistics of one counter site.
+ */
+static inline
+int constats_perf_print ( perf_site_t* site )
+{
+	int i;
+
+	if ( constats_scope_print( &site->scope ) != 0 )
+		return -1;
+
+	for ( i = 0; i < CONSTATS_PERF_COUNTERS; ++i )
+	{
+		if ( constats_recorder_size( &site->counters[i] ) == 0 )
+		{
+			printf ( "%-23s: unavailable\n", constats_perf_names[i] );
+			continue;
+		}
+
+		printf ( "%-23s:\n", constats_perf_names[i] );
+		constats_recorder_get_and_print_stats( &site->counters[i] );
+	}
+
+	return 0;
+}
+
+/**
+ * This function prints time and counter statistics of every counter site.
+ */
+static inline
+int constats_perf_print_all ( void )
+{
+	perf_site_t* site = __atomic_load_n( &constats_perf_sites, __ATOMIC_ACQUIRE );
+
+	for ( ; site != NULL; site = site->next )
+		constats_perf_print( site );
+
+	return 0;
+}
+
+#endif
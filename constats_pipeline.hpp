@@ -0,0 +1,204 @@
+/**
+ * @File     : constats_pipeline.hpp
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a C++20 coroutine stage for streaming pipelines.
+ * constats::stats_stage awaits batches of samples from an async generator,
+ * adds them to an accumulator_t as they arrive and yields a cumulative
+ * stats_t snapshot every period samples, and once more for whatever is
+ * left when the source ends.
+ *
+ * constats::async_generator is the generator type on both sides. It is a
+ * coroutine that may co_await anything the event loop provides, such as a
+ * socket read, and co_yields values to a consumer that co_awaits next().
+ * Control passes between the two by symmetric transfer, so a stage only
+ * ever suspends where its source does and never blocks the thread that
+ * runs the loop. A pipeline chains stages by passing one generator into
+ * the next:
+ *
+ *   auto stats = constats::stats_stage( filter( parse( read( socket ) ) ), 100000 );
+ *
+ *   while ( const stats_t* snapshot = co_await stats.next() )
+ *       publish( *snapshot );
+ *
+ * Snapshots come from the accumulator, so as documented in
+ * constats_accumulator.h they hold no absolute deviation or outlier
+ * information. Its mean and deviation are kept with Welford's method, so
+ * they stay accurate for samples far from zero.
+ */
+
+#ifndef CONSTATS_PIPELINE_HPP_LIB_LOCK
+#define CONSTATS_PIPELINE_HPP_LIB_LOCK
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <utility>
+
+#include "constats.hpp"
+
+namespace constats
+{
+	template <class T>
+	class async_generator
+	{
+	public:
+
+		struct promise_type
+		{
+			T* value = nullptr;							// The value last yielded, NULL once done
+			std::coroutine_handle<> consumer;			// The coroutine waiting in next()
+			std::exception_ptr error;					// Thrown out of next() once done
+
+			// Hands control back to the consumer
+			struct transfer
+			{
+				bool await_ready ( ) noexcept { return false; }
+				void await_resume ( ) noexcept { }
+
+				std::coroutine_handle<> await_suspend ( std::coroutine_handle<promise_type> self ) noexcept
+				{
+					return self.promise().consumer;
+				}
+			};
+
+			async_generator get_return_object ( )
+			{
+				return async_generator( std::coroutine_handle<promise_type>::from_promise( *this ) );
+			}
+
+			std::suspend_always initial_suspend ( ) noexcept { return {}; }
+			transfer final_suspend ( ) noexcept { return {}; }
+
+			// The value outlives the suspension, as it is part of the co_yield expression
+			transfer yield_value ( T& value ) noexcept
+			{
+				this->value = std::addressof( value );
+				return {};
+			}
+
+			transfer yield_value ( T&& value ) noexcept
+			{
+				this->value = std::addressof( value );
+				return {};
+			}
+
+			void return_void ( ) noexcept
+			{
+				value = nullptr;
+			}
+
+			void unhandled_exception ( ) noexcept
+			{
+				value = nullptr;
+				error = std::current_exception();
+			}
+		};
+
+		// Resumes the generator until it yields or finishes
+		struct next_awaiter
+		{
+			std::coroutine_handle<promise_type> generator;
+
+			bool await_ready ( ) noexcept
+			{
+				return !generator || generator.done();
+			}
+
+			std::coroutine_handle<> await_suspend ( std::coroutine_handle<> consumer ) noexcept
+			{
+				generator.promise().consumer = consumer;
+				return generator;
+			}
+
+			T* await_resume ( )
+			{
+				if ( !generator || generator.done() )
+				{
+					if ( generator && generator.promise().error )
+						std::rethrow_exception( std::exchange( generator.promise().error, nullptr ) );
+
+					return nullptr;
+				}
+
+				return generator.promise().value;
+			}
+		};
+
+		async_generator ( async_generator&& other ) noexcept
+			: handle( std::exchange( other.handle, nullptr ) ) { }
+
+		async_generator& operator= ( async_generator&& other ) noexcept
+		{
+			if ( this != &other )
+			{
+				if ( handle )
+					handle.destroy();
+
+				handle = std::exchange( other.handle, nullptr );
+			}
+
+			return *this;
+		}
+
+		~async_generator ( )
+		{
+			if ( handle )
+				handle.destroy();
+		}
+
+		/**
+		 * This function returns an awaitable for the next value, which gives
+		 * a pointer to it, valid until next() is awaited again, or NULL once
+		 * the generator is done.
+		 */
+		next_awaiter next ( )
+		{
+			return next_awaiter{ handle };
+		}
+
+	private:
+
+		explicit async_generator ( std::coroutine_handle<promise_type> handle )
+			: handle( handle ) { }
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	/**
+	 * This function is a pipeline stage that accumulates batches of samples
+	 * and yields a cumulative snapshot every period samples.
+	 */
+	template <sample_range Batch>
+	async_generator<stats_t> stats_stage ( async_generator<Batch> batches, uint64_t period )
+	{
+		accumulator_t acc;
+		uint64_t reported = 0;
+
+		constats_accumulator_init( &acc );
+
+		while ( Batch* batch = co_await batches.next() )
+		{
+			for ( auto&& sample : *batch )
+				constats_accumulator_add( &acc, static_cast<int64_t>( sample ) );
+
+			if ( acc.N - reported >= period )
+			{
+				stats_t stat = {};
+				reported = acc.N;
+				constats_accumulator_calculate_stats( &acc, &stat );
+				co_yield stat;
+			}
+		}
+
+		if ( acc.N > reported )
+		{
+			stats_t stat = {};
+			constats_accumulator_calculate_stats( &acc, &stat );
+			co_yield stat;
+		}
+	}
+}
+
+#endif
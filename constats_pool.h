@@ -0,0 +1,556 @@
+/**
+ * @File     : constats_pool.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains the worker pool that every parallel constats
+ * routine runs on. Workers are started once and then sleep between
+ * jobs, so a parallel call costs a wakeup instead of a thread creation.
+ * Pass a pool_t of your own to any parallel routine, or NULL for the
+ * process-wide pool, which is created on first use with one worker per
+ * online CPU besides the caller (CONSTATS_POOL_THREADS overrides that).
+ *
+ * A job splits [0, count) into chunks of grain items, and each thread
+ * (the caller included) is handed an equal, contiguous share of them
+ * as one task on its own Chase-Lev deque. A thread takes a task from the
+ * bottom of its deque, pushes back the upper half until one chunk is
+ * left, and runs it. A thread whose deque is empty steals from the top
+ * of another's, which holds the largest untouched halves. Threads mostly
+ * touch only their own deque and their own region of memory, and a
+ * thread stuck on expensive chunks gives the rest of its share away.
+ * A thread that finds nothing to steal for a while sleeps until a task
+ * is pushed or the job's last chunk is done, instead of spinning while
+ * one thread finishes a long chunk.
+ * A pool runs one job at a time; a parallel call made from inside a job,
+ * on a worker or on the thread that submitted it, runs serially there.
+ */
+
+#ifndef CONSTATS_POOL_LIB_LOCK
+#define CONSTATS_POOL_LIB_LOCK
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constats.h"
+
+// The capacity of a deque, a power of two. Halving a share never
+// leaves more than 33 tasks queued on one deque.
+#ifndef CONSTATS_DEQUE_SIZE
+#define CONSTATS_DEQUE_SIZE 128
+#endif
+
+// Returned by deque operations that found nothing to take
+#define CONSTATS_DEQUE_EMPTY UINT64_MAX
+
+typedef void (*pool_fn_t)( void* arg, uint64_t begin, uint64_t end, uint64_t chunk );
+
+/**
+ * A Chase-Lev work-stealing deque of tasks, each a range of chunks packed
+ * as begin << 32 | end. The owner pushes and takes at the bottom; any
+ * thread may steal from the top.
+ */
+typedef struct pool_deque_t
+{
+	int64_t top;							// The next task to steal
+	char pad[56];							// Keeps thieves off the owner's line
+	int64_t bottom;							// One past the last task pushed
+	uint64_t tasks[CONSTATS_DEQUE_SIZE];	// The ring of tasks
+
+} pool_deque_t;
+
+typedef struct pool_job_t
+{
+	pool_fn_t fn;				// Called once per chunk
+	void* arg;					// Passed to fn
+	uint64_t count;				// The number of items
+	uint64_t grain;				// The number of items per chunk
+	uint64_t chunks;			// The number of chunks
+	uint64_t remaining;			// The number of chunks not yet run
+	uint64_t threads;			// The number of threads sharing the chunks
+
+} pool_job_t;
+
+typedef struct pool_t
+{
+	pthread_t* threads;			// The workers
+	uint64_t size;				// The number of workers, not counting the caller
+	pool_deque_t* deques;		// One per thread, the caller's first
+
+	pthread_mutex_t lock;		// Guards everything below
+	pthread_cond_t wake;		// Signaled when a job is posted or the pool shuts down
+	pthread_cond_t idle;		// Signaled when the last worker leaves a job
+	uint64_t generation;		// Bumped for every job
+	uint64_t active;			// The number of workers yet to finish the current job
+	pool_job_t* job;			// The current job
+	int shutdown;				// Set when the workers should exit
+
+	pthread_cond_t steal;		// Signaled when tasks are pushed or a job's last chunk is done
+	uint64_t sleepers;			// The number of threads waiting on steal
+	uint64_t signals;			// Bumped for every signal on steal
+
+	pthread_mutex_t submit;		// Lets one job run at a time
+
+} pool_t;
+
+pool_t* constats_pool_global = NULL;
+pthread_once_t constats_pool_global_once = PTHREAD_ONCE_INIT;
+
+// The deque index of this thread, 0 off the pool, so nested parallel calls run serially
+__thread uint64_t constats_pool_worker = 0;
+
+// Set while the caller of a job works on it, which makes its nested calls serial too
+__thread int constats_pool_in_job = 0;
+
+/**
+ * This function pushes a task onto the bottom of the deque. Only the
+ * owner may push. It returns -1 if the deque is full.
+ */
+static inline
+int constats_deque_push ( pool_deque_t* deque, uint64_t task )
+{
+	int64_t bottom = __atomic_load_n( &deque->bottom, __ATOMIC_RELAXED );
+	int64_t top    = __atomic_load_n( &deque->top, __ATOMIC_ACQUIRE );
+
+	if ( bottom - top >= CONSTATS_DEQUE_SIZE )
+		return -1;
+
+	__atomic_store_n( &deque->tasks[bottom & ( CONSTATS_DEQUE_SIZE - 1 )], task, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	__atomic_store_n( &deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+	return 0;
+}
+
+/**
+ * This function takes the newest task from the bottom of the deque. Only
+ * the owner may take.
+ */
+static inline
+uint64_t constats_deque_take ( pool_deque_t* deque )
+{
+	int64_t bottom = __atomic_load_n( &deque->bottom, __ATOMIC_RELAXED ) - 1;
+	__atomic_store_n( &deque->bottom, bottom, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	int64_t top = __atomic_load_n( &deque->top, __ATOMIC_RELAXED );
+
+	if ( top > bottom )
+	{
+		__atomic_store_n( &deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+		return CONSTATS_DEQUE_EMPTY;
+	}
+
+	uint64_t task = __atomic_load_n( &deque->tasks[bottom & ( CONSTATS_DEQUE_SIZE - 1 )], __ATOMIC_RELAXED );
+
+	// The last task may be raced for by a thief
+	if ( top == bottom )
+	{
+		if ( !__atomic_compare_exchange_n( &deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+			task = CONSTATS_DEQUE_EMPTY;
+
+		__atomic_store_n( &deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+	}
+
+	return task;
+}
+
+/**
+ * This function steals the oldest task from the top of the deque. It may
+ * fail spuriously when racing another thief or the owner.
+ */
+static inline
+uint64_t constats_deque_steal ( pool_deque_t* deque )
+{
+	int64_t top = __atomic_load_n( &deque->top, __ATOMIC_ACQUIRE );
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	int64_t bottom = __atomic_load_n( &deque->bottom, __ATOMIC_ACQUIRE );
+
+	if ( top >= bottom )
+		return CONSTATS_DEQUE_EMPTY;
+
+	uint64_t task = __atomic_load_n( &deque->tasks[top & ( CONSTATS_DEQUE_SIZE - 1 )], __ATOMIC_RELAXED );
+
+	if ( !__atomic_compare_exchange_n( &deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+		return CONSTATS_DEQUE_EMPTY;
+
+	return task;
+}
+
+/**
+ * This function wakes the threads sleeping in constats_pool_sleep, if
+ * any. Call it after pushing tasks or finishing the last chunk.
+ */
+static inline
+void constats_pool_notify ( pool_t* pool )
+{
+	// Pairs with the sleeper's increment, so one of the two sees the other
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+	if ( __atomic_load_n( &pool->sleepers, __ATOMIC_RELAXED ) == 0 )
+		return;
+
+	pthread_mutex_lock( &pool->lock );
+	pool->signals++;
+	pthread_cond_broadcast( &pool->steal );
+	pthread_mutex_unlock( &pool->lock );
+}
+
+/**
+ * This function sleeps until constats_pool_notify is called, unless a
+ * deque already holds a task or the job is done.
+ */
+static inline
+void constats_pool_sleep ( pool_t* pool, pool_job_t* job )
+{
+	uint64_t i;
+
+	pthread_mutex_lock( &pool->lock );
+
+	uint64_t signals = pool->signals;
+	__atomic_fetch_add( &pool->sleepers, 1, __ATOMIC_SEQ_CST );
+
+	// Look only after registering, so anything pushed after the look wakes us
+	int empty = __atomic_load_n( &job->remaining, __ATOMIC_SEQ_CST ) > 0;
+
+	for ( i = 0; empty && i < job->threads; ++i )
+		empty = __atomic_load_n( &pool->deques[i].top, __ATOMIC_SEQ_CST )
+		     >= __atomic_load_n( &pool->deques[i].bottom, __ATOMIC_SEQ_CST );
+
+	while ( empty && pool->signals == signals )
+		pthread_cond_wait( &pool->steal, &pool->lock );
+
+	__atomic_fetch_sub( &pool->sleepers, 1, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &pool->lock );
+}
+
+/**
+ * This function runs chunks from its own deque, then steals, until every
+ * chunk of the job has run.
+ */
+static inline
+void constats_pool_work ( pool_t* pool, pool_job_t* job, uint64_t self )
+{
+	pool_deque_t* deque = &pool->deques[self];
+	uint64_t seed = self * 0x9e3779b97f4a7c15UL + 1;
+	uint64_t failures = 0;
+
+	while ( __atomic_load_n( &job->remaining, __ATOMIC_ACQUIRE ) > 0 )
+	{
+		uint64_t task = constats_deque_take( deque );
+
+		if ( task == CONSTATS_DEQUE_EMPTY )
+		{
+			// Pick a random victim other than ourselves
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+
+			uint64_t victim = seed % ( job->threads - 1 );
+			task = constats_deque_steal( &pool->deques[victim >= self ? victim + 1 : victim] );
+
+			if ( task == CONSTATS_DEQUE_EMPTY )
+			{
+				if ( ++failures % job->threads == 0 )
+					sched_yield();
+
+				// Every deque came up empty a few times over
+				if ( failures >= 4 * job->threads )
+				{
+					constats_pool_sleep( pool, job );
+					failures = 0;
+				}
+
+				continue;
+			}
+		}
+
+		failures = 0;
+
+		uint64_t begin = task >> 32;
+		uint64_t end   = task & 0xffffffffUL;
+		uint64_t taken = end;
+
+		// Leave the upper halves where thieves can find them
+		while ( end - begin > 1 && constats_deque_push( deque, ( begin + end ) / 2 << 32 | end ) == 0 )
+			end = ( begin + end ) / 2;
+
+		if ( end != taken )
+			constats_pool_notify( pool );
+
+		uint64_t chunk;
+
+		for ( chunk = begin; chunk < end; ++chunk )
+		{
+			uint64_t from = chunk * job->grain;
+			uint64_t to   = from + job->grain < job->count ? from + job->grain : job->count;
+
+			job->fn( job->arg, from, to, chunk );
+		}
+
+		if ( __atomic_sub_fetch( &job->remaining, end - begin, __ATOMIC_RELEASE ) == 0 )
+			constats_pool_notify( pool );
+	}
+}
+
+typedef struct pool_worker_t
+{
+	pool_t* pool;				// The pool the worker belongs to
+	uint64_t index;				// The worker's deque
+
+} pool_worker_t;
+
+/**
+ * This function is a worker thread.
+ */
+static inline
+void* constats_pool_loop ( void* data )
+{
+	pool_worker_t* worker = (pool_worker_t*) data;
+	pool_t* pool = worker->pool;
+
+	constats_pool_worker = worker->index;
+	free( worker );
+
+	// Jobs may be posted before the worker gets here, so count from the
+	// generation the pool was created with rather than the current one
+	uint64_t seen = 0;
+
+	pthread_mutex_lock( &pool->lock );
+
+	for ( ;; )
+	{
+		while ( pool->generation == seen && !pool->shutdown )
+			pthread_cond_wait( &pool->wake, &pool->lock );
+
+		if ( pool->shutdown )
+			break;
+
+		seen = pool->generation;
+		pool_job_t* job = pool->job;
+		pthread_mutex_unlock( &pool->lock );
+
+		constats_pool_work( pool, job, constats_pool_worker );
+
+		pthread_mutex_lock( &pool->lock );
+
+		if ( --pool->active == 0 )
+			pthread_cond_signal( &pool->idle );
+	}
+
+	pthread_mutex_unlock( &pool->lock );
+	return NULL;
+}
+
+/**
+ * This function starts a pool with the given number of workers. The
+ * caller also works on every job, so 0 workers is a valid, serial pool.
+ */
+static inline
+int constats_pool_create ( pool_t* pool, uint64_t size )
+{
+	uint64_t i;
+
+	// Error Checking
+	if ( pool == NULL )
+		return -1;
+
+	memset( pool, 0, sizeof( pool_t ) );
+	pthread_mutex_init( &pool->lock, NULL );
+	pthread_mutex_init( &pool->submit, NULL );
+	pthread_cond_init( &pool->wake, NULL );
+	pthread_cond_init( &pool->idle, NULL );
+	pthread_cond_init( &pool->steal, NULL );
+
+	if ( size == 0 )
+		return 0;
+
+	pool->threads = (pthread_t*) calloc( size, sizeof( pthread_t ) );
+	pool->deques  = (pool_deque_t*) calloc( size + 1, sizeof( pool_deque_t ) );
+
+	if ( pool->threads == NULL || pool->deques == NULL )
+	{
+		free( pool->threads );
+		free( pool->deques );
+		return -1;
+	}
+
+	// Keep whatever workers could be started
+	for ( i = 0; i < size; ++i )
+	{
+		pool_worker_t* worker = (pool_worker_t*) malloc( sizeof( pool_worker_t ) );
+
+		if ( worker == NULL )
+			break;
+
+		worker->pool  = pool;
+		worker->index = i + 1;
+
+		if ( pthread_create( &pool->threads[i], NULL, constats_pool_loop, worker ) != 0 )
+		{
+			free( worker );
+			break;
+		}
+
+		pool->size++;
+	}
+
+	return 0;
+}
+
+/**
+ * This function stops the workers and releases the pool.
+ */
+static inline
+int constats_pool_destroy ( pool_t* pool )
+{
+	uint64_t i;
+
+	// Error Checking
+	if ( pool == NULL )
+		return -1;
+
+	pthread_mutex_lock( &pool->lock );
+	pool->shutdown = 1;
+	pthread_cond_broadcast( &pool->wake );
+	pthread_mutex_unlock( &pool->lock );
+
+	for ( i = 0; i < pool->size; ++i )
+		pthread_join( pool->threads[i], NULL );
+
+	free( pool->threads );
+	free( pool->deques );
+
+	pthread_mutex_destroy( &pool->lock );
+	pthread_mutex_destroy( &pool->submit );
+	pthread_cond_destroy( &pool->wake );
+	pthread_cond_destroy( &pool->idle );
+	pthread_cond_destroy( &pool->steal );
+
+	memset( pool, 0, sizeof( pool_t ) );
+	return 0;
+}
+
+static inline
+void constats_pool_global_create ( void )
+{
+	static pool_t pool;
+
+#ifdef CONSTATS_POOL_THREADS
+	long size = CONSTATS_POOL_THREADS;
+#else
+	long size = sysconf( _SC_NPROCESSORS_ONLN ) - 1;
+#endif
+
+	if ( constats_pool_create( &pool, size > 0 ? size : 0 ) == 0 )
+		constats_pool_global = &pool;
+}
+
+/**
+ * This function returns the process-wide pool, starting it on first use.
+ * It returns NULL if the pool could not be created.
+ */
+static inline
+pool_t* constats_pool_default ( void )
+{
+	pthread_once( &constats_pool_global_once, constats_pool_global_create );
+	return constats_pool_global;
+}
+
+/**
+ * This function returns the number of threads a job on the pool runs on,
+ * the caller included.
+ */
+static inline
+uint64_t constats_pool_threads ( pool_t* pool )
+{
+	if ( pool == NULL )
+		pool = constats_pool_default();
+
+	return pool == NULL || constats_pool_worker || constats_pool_in_job ? 1 : pool->size + 1;
+}
+
+/**
+ * This function calls fn on every chunk of grain items in [0, count),
+ * spread over the pool (NULL for the process-wide pool), and returns once
+ * every chunk is done. Chunks are numbered from 0, so results can be
+ * combined in a fixed order however the chunks were scheduled.
+ */
+static inline
+int constats_pool_for ( pool_t* pool, uint64_t count, uint64_t grain, pool_fn_t fn, void* arg )
+{
+	pool_job_t job;
+	uint64_t i;
+
+	// Error Checking
+	if ( fn == NULL || grain == 0 )
+		return -1;
+
+	if ( pool == NULL )
+		pool = constats_pool_default();
+
+	job.fn        = fn;
+	job.arg       = arg;
+	job.count     = count;
+	job.grain     = grain;
+	job.chunks    = ( count + grain - 1 ) / grain;
+	job.remaining = job.chunks;
+
+	// Nothing to share, or already inside a job
+	if ( pool == NULL || pool->size == 0 || job.chunks < 2 || constats_pool_worker || constats_pool_in_job )
+	{
+		uint64_t chunk;
+
+		for ( chunk = 0; chunk < job.chunks; ++chunk )
+			fn( arg, chunk * grain, chunk + 1 < job.chunks ? ( chunk + 1 ) * grain : count, chunk );
+
+		return 0;
+	}
+
+	// Tasks pack chunk indices into 32 bits
+	if ( job.chunks > 0xffffffffUL )
+		return -1;
+
+	pthread_mutex_lock( &pool->submit );
+	pthread_mutex_lock( &pool->lock );
+
+	job.threads  = pool->size + 1;
+	pool->job    = &job;
+
+	// Every thread starts with an equal share, as one task. The workers
+	// are idle, so their deques can be filled from here, and a worker that
+	// is slow to wake up has its share stolen instead of waited for.
+	for ( i = 0; i < job.threads; ++i )
+	{
+		uint64_t first = job.chunks * i / job.threads;
+		uint64_t last  = job.chunks * ( i + 1 ) / job.threads;
+
+		if ( first < last )
+			constats_deque_push( &pool->deques[i], first << 32 | last );
+	}
+
+	pool->active = pool->size;
+	pool->generation++;
+
+	pthread_cond_broadcast( &pool->wake );
+	pthread_mutex_unlock( &pool->lock );
+
+	// The caller holds submit until the job is done, so it must not submit again
+	constats_pool_in_job = 1;
+	constats_pool_work( pool, &job, 0 );
+	constats_pool_in_job = 0;
+
+	// job lives on this stack, so wait until no worker can touch it
+	pthread_mutex_lock( &pool->lock );
+
+	while ( pool->active > 0 )
+		pthread_cond_wait( &pool->idle, &pool->lock );
+
+	pool->job = NULL;
+	pthread_mutex_unlock( &pool->lock );
+	pthread_mutex_unlock( &pool->submit );
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,379 @@
+/**
+ * @File     : constats_recorder.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a sample recorder: a preallocated buffer that
+ * samples are recorded into and later handed to constats for analysis.
+ *
+ * Once a recorder is initialized, constats_recorder_record performs no
+ * syscalls, allocations or locks. Each recorder has a single writer, and
+ * samples that do not fit are counted as dropped instead of growing the
+ * buffer. Initialize with CONSTATS_RECORDER_REALTIME so the buffer is
+ * prefaulted and locked and the first write to a page does not fault.
+ *
+ * constats_recorder_record_shared lets many threads record into one
+ * recorder. A writer claims a slot, fills it, and then counts it as
+ * published with a release increment. constats_recorder_size only reports
+ * samples once every claimed slot has been published, so a reader never
+ * sees a slot that is still being written.
+ *
+ * CONSTATS_RECORD and CONSTATS_RECORD_SHARED compile to nothing, arguments
+ * included, when CONSTATS_DISABLE is defined.
+ */
+
+#ifndef CONSTATS_RECORDER_LIB_LOCK
+#define CONSTATS_RECORDER_LIB_LOCK
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "constats.h"
+
+// Recorder flags
+#define CONSTATS_RECORDER_HUGEPAGES 0x1	// Try to back the buffer with huge pages
+#define CONSTATS_RECORDER_PREFAULT  0x2	// Fault every page in during init
+#define CONSTATS_RECORDER_LOCK      0x4	// mlock the buffer so it is never paged out
+#define CONSTATS_RECORDER_REALTIME  ( CONSTATS_RECORDER_PREFAULT | CONSTATS_RECORDER_LOCK )
+
+// Buffer backings, from least to most preferred
+#define CONSTATS_BACKING_MALLOC  0	// Plain malloc
+#define CONSTATS_BACKING_MMAP    1	// Anonymous mapping with normal pages
+#define CONSTATS_BACKING_THP     2	// Anonymous mapping with a transparent huge page hint
+#define CONSTATS_BACKING_HUGETLB 3	// Anonymous mapping from the hugetlb pool
+#define CONSTATS_BACKING_FILE    4	// Shared file mapping, see constats_checkpoint.h
+
+#define CONSTATS_LIKELY(x)   __builtin_expect( !!(x), 1 )
+#define CONSTATS_UNLIKELY(x) __builtin_expect( !!(x), 0 )
+
+#ifndef CONSTATS_HUGEPAGE_SIZE
+#define CONSTATS_HUGEPAGE_SIZE (2UL << 20)
+#endif
+
+typedef struct recorder_t
+{
+	int64_t* samples;		// The sample buffer
+	uint64_t capacity;		// The number of samples the buffer can hold
+	uint64_t count;			// The number of samples recorded so far
+	uint64_t published;		// The number of those samples fully written
+	uint64_t dropped;		// The number of samples that did not fit
+
+	int flags;				// The flags the recorder was created with
+	int backing;			// How the buffer was allocated
+	uint64_t mapped_size;	// The number of bytes mapped, 0 if malloc'd
+	int locked;				// Whether the buffer was successfully mlock'd
+	uint64_t setup_ns;		// Time spent allocating and prefaulting the buffer
+
+} recorder_t;
+
+/**
+ * This function returns the size of a page on this system.
+ */
+static inline
+uint64_t constats_recorder_page_size ( void )
+{
+	long size = sysconf( _SC_PAGESIZE );
+	return size > 0 ? (uint64_t) size : 4096;
+}
+
+/**
+ * This function returns a monotonic timestamp in nanoseconds.
+ */
+static inline
+uint64_t constats_recorder_ns ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * This function writes to one byte in every page of the buffer so the
+ * page faults are taken now instead of on the recording path.
+ */
+static inline
+void constats_recorder_touch ( void* buffer, uint64_t size )
+{
+	register volatile char* bytes = (volatile char*) buffer;
+	register uint64_t page = constats_recorder_page_size();
+	register uint64_t i;
+
+	for ( i = 0; i < size; i += page )
+		bytes[i] = 0;
+}
+
+/**
+ * This function tries to map the buffer, preferring hugetlb pages, then
+ * transparent huge pages. It returns MAP_FAILED if neither is possible.
+ */
+static inline
+void* constats_recorder_map_huge ( uint64_t size, int flags, int* backing )
+{
+	void* buffer = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	int populate = 0;
+
+#ifdef MAP_POPULATE
+	if ( flags & CONSTATS_RECORDER_PREFAULT )
+		populate = MAP_POPULATE;
+#endif
+
+	buffer = mmap( NULL, size, PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0 );
+
+	if ( buffer != MAP_FAILED )
+	{
+		*backing = CONSTATS_BACKING_HUGETLB;
+		return buffer;
+	}
+#endif
+
+	// No reserved huge pages, fall back to a hinted normal mapping.
+	// The hint has to be given before the pages are faulted in.
+	buffer = mmap( NULL, size, PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+	if ( buffer == MAP_FAILED )
+		return MAP_FAILED;
+
+	*backing = CONSTATS_BACKING_MMAP;
+
+#ifdef MADV_HUGEPAGE
+	if ( madvise( buffer, size, MADV_HUGEPAGE ) == 0 )
+		*backing = CONSTATS_BACKING_THP;
+#endif
+
+	if ( flags & CONSTATS_RECORDER_PREFAULT )
+		constats_recorder_touch( buffer, size );
+
+	return buffer;
+}
+
+/**
+ * This function allocates a recorder able to hold capacity samples.
+ */
+static inline
+int constats_recorder_init ( recorder_t* recorder, uint64_t capacity, int flags )
+{
+	// Error Checking
+	if ( recorder == NULL || capacity == 0 )
+		return -1;
+
+	memset( recorder, 0, sizeof( recorder_t ) );
+
+	uint64_t start = constats_recorder_ns();
+	uint64_t size  = capacity * sizeof( int64_t );
+	void* buffer   = MAP_FAILED;
+
+	if ( flags & CONSTATS_RECORDER_HUGEPAGES )
+	{
+		size   = ( size + CONSTATS_HUGEPAGE_SIZE - 1 ) & ~( CONSTATS_HUGEPAGE_SIZE - 1 );
+		buffer = constats_recorder_map_huge( size, flags, &recorder->backing );
+	}
+	else if ( flags & CONSTATS_RECORDER_PREFAULT )
+	{
+		uint64_t page = constats_recorder_page_size();
+
+		size   = ( size + page - 1 ) & ~( page - 1 );
+		buffer = mmap( NULL, size, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+		if ( buffer != MAP_FAILED )
+		{
+			recorder->backing = CONSTATS_BACKING_MMAP;
+			constats_recorder_touch( buffer, size );
+		}
+	}
+
+	if ( buffer != MAP_FAILED )
+	{
+		recorder->mapped_size = size;
+	}
+	else
+	{
+		// Last resort, a plain heap buffer
+		buffer = malloc( capacity * sizeof( int64_t ) );
+
+		if ( buffer == NULL )
+			return -1;
+
+		recorder->backing = CONSTATS_BACKING_MALLOC;
+
+		if ( flags & CONSTATS_RECORDER_PREFAULT )
+			constats_recorder_touch( buffer, capacity * sizeof( int64_t ) );
+	}
+
+	if ( flags & CONSTATS_RECORDER_LOCK )
+		recorder->locked = mlock( buffer, capacity * sizeof( int64_t ) ) == 0;
+
+	recorder->samples  = (int64_t*) buffer;
+	recorder->capacity = capacity;
+	recorder->flags    = flags;
+	recorder->setup_ns = constats_recorder_ns() - start;
+
+	return 0;
+}
+
+/**
+ * This function releases the recorder's buffer.
+ */
+static inline
+int constats_recorder_destroy ( recorder_t* recorder )
+{
+	// Error Checking
+	if ( recorder == NULL || recorder->samples == NULL )
+		return -1;
+
+	if ( recorder->locked )
+		munlock( recorder->samples, recorder->capacity * sizeof( int64_t ) );
+
+	if ( recorder->backing == CONSTATS_BACKING_MALLOC )
+		free( recorder->samples );
+	else if ( recorder->backing == CONSTATS_BACKING_FILE )
+		munmap( (char*) recorder->samples - constats_recorder_page_size(), recorder->mapped_size );
+	else
+		munmap( recorder->samples, recorder->mapped_size );
+
+	memset( recorder, 0, sizeof( recorder_t ) );
+	return 0;
+}
+
+/**
+ * This function records one sample. If the buffer is full the sample is
+ * counted as dropped and -1 is returned. It never syscalls, allocates or locks.
+ */
+static inline
+int constats_recorder_record ( recorder_t* recorder, int64_t sample )
+{
+	register uint64_t count = recorder->count;
+
+	if ( CONSTATS_UNLIKELY( count >= recorder->capacity ) )
+	{
+		recorder->dropped++;
+		return -1;
+	}
+
+	recorder->samples[count] = sample;
+	__atomic_store_n( &recorder->count, count + 1, __ATOMIC_RELAXED );
+	__atomic_store_n( &recorder->published, count + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+/**
+ * This function records one sample from any thread. Writers claim slots
+ * with an atomic increment and publish them with another, so it is lock
+ * free, but slower than constats_recorder_record when threads contend for
+ * the recorder.
+ */
+static inline
+int constats_recorder_record_shared ( recorder_t* recorder, int64_t sample )
+{
+	register uint64_t slot = __atomic_fetch_add( &recorder->count, 1, __ATOMIC_RELAXED );
+
+	if ( CONSTATS_UNLIKELY( slot >= recorder->capacity ) )
+	{
+		__atomic_fetch_add( &recorder->dropped, 1, __ATOMIC_RELAXED );
+		return -1;
+	}
+
+	recorder->samples[slot] = sample;
+	__atomic_fetch_add( &recorder->published, 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+#ifdef CONSTATS_DISABLE
+#define CONSTATS_RECORD(recorder, sample)        ((void) 0)
+#define CONSTATS_RECORD_SHARED(recorder, sample) ((void) 0)
+#else
+#define CONSTATS_RECORD(recorder, sample)        ((void) constats_recorder_record( (recorder), (sample) ))
+#define CONSTATS_RECORD_SHARED(recorder, sample) ((void) constats_recorder_record_shared( (recorder), (sample) ))
+#endif
+
+/**
+ * This function stores the number of samples held by the recorder in size
+ * if every slot claimed so far has been written, and returns -1 if a
+ * writer is still filling one. It never waits, so it is safe in a signal
+ * handler. Shared recording lets count run past capacity, so it is
+ * clamped here.
+ */
+static inline
+int constats_recorder_try_size ( recorder_t* recorder, uint64_t* size )
+{
+	// Every published slot was claimed first, so published <= count, and
+	// they are equal only when no claimed slot is still being written
+	uint64_t published = __atomic_load_n( &recorder->published, __ATOMIC_ACQUIRE );
+	uint64_t count     = __atomic_load_n( &recorder->count, __ATOMIC_ACQUIRE );
+
+	*size = count < recorder->capacity ? count : recorder->capacity;
+	return published == *size ? 0 : -1;
+}
+
+/**
+ * This function returns the number of samples held by the recorder,
+ * waiting for writers that are still filling their slots.
+ */
+static inline
+uint64_t constats_recorder_size ( recorder_t* recorder )
+{
+	uint64_t size;
+
+	while ( constats_recorder_try_size( recorder, &size ) != 0 )
+		sched_yield();
+
+	return size;
+}
+
+/**
+ * This function discards all recorded samples, keeping the buffer.
+ */
+static inline
+void constats_recorder_reset ( recorder_t* recorder )
+{
+	recorder->count     = 0;
+	recorder->published = 0;
+	recorder->dropped   = 0;
+}
+
+/**
+ * This function prints how the recorder's buffer was set up and what it cost.
+ */
+static inline
+int constats_recorder_print_report ( recorder_t* recorder )
+{
+	static const char* backings[] = { "malloc", "mmap", "mmap + THP hint", "hugetlb", "file" };
+
+	printf ( "Recorder Capacity      : %lu samples\n", recorder->capacity );
+	printf ( "Recorder Backing       : %s\n", backings[recorder->backing] );
+	printf ( "Recorder Mapped Bytes  : %lu\n", recorder->mapped_size );
+	printf ( "Recorder Prefaulted    : %s\n", recorder->flags & CONSTATS_RECORDER_PREFAULT ? "yes" : "no" );
+	printf ( "Recorder Locked        : %s\n", recorder->locked ? "yes" : "no" );
+	printf ( "Recorder Setup Time    : %lu ns\n", recorder->setup_ns );
+
+	if ( ( recorder->flags & CONSTATS_RECORDER_HUGEPAGES ) && recorder->backing != CONSTATS_BACKING_HUGETLB )
+		printf ( "Recorder Warning       : hugetlb pages unavailable, fell back to %s\n", backings[recorder->backing] );
+
+	if ( ( recorder->flags & CONSTATS_RECORDER_LOCK ) && !recorder->locked )
+		printf ( "Recorder Warning       : mlock failed, buffer may be paged out\n" );
+
+	return 0;
+}
+
+/**
+ * This function calculates and prints statistics of the recorded samples.
+ */
+static inline
+int constats_recorder_get_and_print_stats ( recorder_t* recorder )
+{
+	if ( recorder->dropped > 0 )
+		printf ( "Dropped Samples        : %lu\n", recorder->dropped );
+
+	return constats_get_and_print_stats ( recorder->samples, constats_recorder_size( recorder ) );
+}
+
+#endif
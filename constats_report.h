@@ -0,0 +1,354 @@
+/**
+ * @File     : constats_report.h
+ * @Author   : Abdullah Younis
+ *
+ * This library moves report computation and printing off the calling
+ * thread. The caller's data is snapshotted (a copy of the samples, or of
+ * the histogram or accumulator) and queued for a background reporter
+ * thread, and the caller gets a report_t handle back at once. The handle
+ * can be polled, waited on for the stats_t, or detached.
+ *
+ * A single reporter thread, started on first use, handles the queue in
+ * order, so reports printed from many threads never interleave. Copying
+ * samples costs a memcpy on the calling thread; pass CONSTATS_REPORT_NOCOPY
+ * to skip it when the samples are left alone until the report is done.
+ */
+
+#ifndef CONSTATS_REPORT_LIB_LOCK
+#define CONSTATS_REPORT_LIB_LOCK
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_histogram.h"
+
+// Report flags
+#define CONSTATS_REPORT_PRINT  0x1	// Print the report as well as computing it
+#define CONSTATS_REPORT_NOCOPY 0x2	// Read the caller's samples in place
+
+// Report kinds
+#define CONSTATS_REPORT_SAMPLES     1
+#define CONSTATS_REPORT_HISTOGRAM   2
+#define CONSTATS_REPORT_ACCUMULATOR 3
+
+// Report states
+#define CONSTATS_REPORT_PENDING  0
+#define CONSTATS_REPORT_DONE     1
+#define CONSTATS_REPORT_DETACHED 2
+
+typedef struct report_t
+{
+	int kind;					// What was snapshotted
+	int flags;					// The flags the report was requested with
+	int state;					// Pending, done, or detached by its owner
+
+	int64_t* samples;			// The samples, copied unless CONSTATS_REPORT_NOCOPY
+	uint64_t size;				// The number of samples
+	histogram_t* hist;			// The copied histogram
+	accumulator_t acc;			// The copied accumulator
+
+	stats_t stat;				// The result
+	int error_code;				// The result of calculating the stats
+
+	sem_t done;					// Posted once the report is done
+	struct report_t* next;		// The report queued after this one
+
+} report_t;
+
+typedef struct report_queue_t
+{
+	pthread_once_t once;		// Starts the reporter thread
+	pthread_mutex_t lock;		// Guards the queue
+	pthread_cond_t ready;		// Signaled when a report is queued
+	report_t* head;				// The next report to handle
+	report_t* tail;				// The last report queued
+	int started;				// Whether the reporter thread is running
+
+} report_queue_t;
+
+report_queue_t constats_report_queue = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+/**
+ * This function releases a report.
+ */
+static inline
+void constats_report_free ( report_t* report )
+{
+	if ( !( report->flags & CONSTATS_REPORT_NOCOPY ) )
+		free( report->samples );
+
+	free( report->hist );
+	sem_destroy( &report->done );
+	free( report );
+}
+
+/**
+ * This function computes, and if asked prints, one report.
+ */
+static inline
+void constats_report_run ( report_t* report )
+{
+	if ( report->kind == CONSTATS_REPORT_SAMPLES )
+	{
+		report->error_code = constats_calculate_stats( report->samples, report->size, &report->stat );
+
+		if ( report->error_code == 0 && ( report->flags & CONSTATS_REPORT_PRINT ) )
+			constats_print_stats( report->samples, report->size, &report->stat );
+	}
+	else if ( report->kind == CONSTATS_REPORT_HISTOGRAM )
+	{
+		report->error_code = constats_histogram_calculate_stats( report->hist, &report->stat );
+
+		if ( report->error_code == 0 && ( report->flags & CONSTATS_REPORT_PRINT ) )
+			constats_histogram_print_stats( report->hist );
+	}
+	else
+	{
+		report->error_code = constats_accumulator_calculate_stats( &report->acc, &report->stat );
+
+		if ( report->error_code == 0 && ( report->flags & CONSTATS_REPORT_PRINT ) )
+			constats_accumulator_print_stats( &report->acc );
+	}
+
+	if ( report->flags & CONSTATS_REPORT_PRINT )
+		fflush( stdout );
+}
+
+/**
+ * This function is the reporter thread.
+ */
+static inline
+void* constats_report_loop ( void* unused )
+{
+	report_queue_t* queue = &constats_report_queue;
+	(void) unused;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &queue->lock );
+
+		while ( queue->head == NULL )
+			pthread_cond_wait( &queue->ready, &queue->lock );
+
+		report_t* report = queue->head;
+		queue->head = report->next;
+
+		if ( queue->head == NULL )
+			queue->tail = NULL;
+
+		pthread_mutex_unlock( &queue->lock );
+
+		constats_report_run( report );
+
+		// Whoever sees the other side's state last frees the report
+		if ( __atomic_exchange_n( &report->state, CONSTATS_REPORT_DONE, __ATOMIC_ACQ_REL ) == CONSTATS_REPORT_DETACHED )
+			constats_report_free( report );
+		else
+			sem_post( &report->done );
+	}
+
+	return NULL;
+}
+
+static inline
+void constats_report_start ( void )
+{
+	pthread_t thread;
+
+	if ( pthread_create( &thread, NULL, constats_report_loop, NULL ) == 0 )
+	{
+		pthread_detach( thread );
+		constats_report_queue.started = 1;
+	}
+}
+
+/**
+ * This function allocates a pending report. It returns NULL if the report
+ * or its semaphore cannot be set up.
+ */
+static inline
+report_t* constats_report_create ( int kind, int flags )
+{
+	report_t* report = (report_t*) calloc( 1, sizeof( report_t ) );
+
+	if ( report == NULL )
+		return NULL;
+
+	report->kind  = kind;
+	report->flags = flags;
+	report->state = CONSTATS_REPORT_PENDING;
+
+	if ( sem_init( &report->done, 0, 0 ) != 0 )
+	{
+		free( report );
+		return NULL;
+	}
+
+	return report;
+}
+
+/**
+ * This function queues a report for the reporter thread. If the thread
+ * cannot be started the report is run on the calling thread instead.
+ */
+static inline
+report_t* constats_report_submit ( report_t* report )
+{
+	report_queue_t* queue = &constats_report_queue;
+
+	pthread_once( &queue->once, constats_report_start );
+
+	if ( !queue->started )
+	{
+		constats_report_run( report );
+		report->state = CONSTATS_REPORT_DONE;
+		sem_post( &report->done );
+		return report;
+	}
+
+	pthread_mutex_lock( &queue->lock );
+
+	if ( queue->tail != NULL )
+		queue->tail->next = report;
+	else
+		queue->head = report;
+
+	queue->tail = report;
+
+	pthread_cond_signal( &queue->ready );
+	pthread_mutex_unlock( &queue->lock );
+
+	return report;
+}
+
+/**
+ * This function starts a report on a sample set. It returns the handle,
+ * or NULL if the snapshot could not be allocated.
+ */
+static inline
+report_t* constats_report_samples_async ( int64_t* sample_set, uint64_t sample_size, int flags )
+{
+	report_t* report = constats_report_create( CONSTATS_REPORT_SAMPLES, flags );
+
+	if ( report == NULL )
+		return NULL;
+
+	// Without NOCOPY the report only ever frees its own copy, even when empty
+	report->size    = sample_size;
+	report->samples = ( flags & CONSTATS_REPORT_NOCOPY ) ? sample_set : NULL;
+
+	if ( !( flags & CONSTATS_REPORT_NOCOPY ) && sample_size > 0 )
+	{
+		report->samples = (int64_t*) malloc( sample_size * sizeof( int64_t ) );
+
+		if ( report->samples == NULL )
+		{
+			constats_report_free( report );
+			return NULL;
+		}
+
+		memcpy( report->samples, sample_set, sample_size * sizeof( int64_t ) );
+	}
+
+	return constats_report_submit( report );
+}
+
+/**
+ * This function starts a report on a histogram.
+ */
+static inline
+report_t* constats_report_histogram_async ( const histogram_t* hist, int flags )
+{
+	report_t* report = constats_report_create( CONSTATS_REPORT_HISTOGRAM, flags & ~CONSTATS_REPORT_NOCOPY );
+
+	if ( report == NULL )
+		return NULL;
+
+	if ( ( report->hist = (histogram_t*) malloc( sizeof( histogram_t ) ) ) == NULL )
+	{
+		constats_report_free( report );
+		return NULL;
+	}
+
+	memcpy( report->hist, hist, sizeof( histogram_t ) );
+	return constats_report_submit( report );
+}
+
+/**
+ * This function starts a report on an accumulator.
+ */
+static inline
+report_t* constats_report_accumulator_async ( const accumulator_t* acc, int flags )
+{
+	report_t* report = constats_report_create( CONSTATS_REPORT_ACCUMULATOR, flags & ~CONSTATS_REPORT_NOCOPY );
+
+	if ( report == NULL )
+		return NULL;
+
+	report->acc = *acc;
+	return constats_report_submit( report );
+}
+
+/**
+ * This function returns whether the report is done.
+ */
+static inline
+int constats_report_ready ( report_t* report )
+{
+	return __atomic_load_n( &report->state, __ATOMIC_ACQUIRE ) == CONSTATS_REPORT_DONE;
+}
+
+/**
+ * This function waits for the report, copies its statistics into stat
+ * (which may be NULL) and releases the handle. It returns the report's
+ * error code.
+ */
+static inline
+int constats_report_wait ( report_t* report, stats_t* stat )
+{
+	// Error Checking
+	if ( report == NULL )
+		return -1;
+
+	while ( sem_wait( &report->done ) != 0 );
+
+	int error_code = report->error_code;
+
+	if ( stat != NULL && error_code == 0 )
+		*stat = report->stat;
+
+	constats_report_free( report );
+	return error_code;
+}
+
+/**
+ * This function gives up the handle. The report still runs, and is
+ * released by the reporter thread once it is done.
+ */
+static inline
+void constats_report_detach ( report_t* report )
+{
+	if ( report == NULL )
+		return;
+
+	if ( __atomic_exchange_n( &report->state, CONSTATS_REPORT_DETACHED, __ATOMIC_ACQ_REL ) == CONSTATS_REPORT_DONE )
+		constats_report_free( report );
+}
+
+/**
+ * This function is constats_get_and_print_stats off the calling thread.
+ * The samples are copied before it returns. Wait on or detach the handle.
+ */
+static inline
+report_t* constats_get_and_print_stats_async ( int64_t* sample_set, uint64_t sample_size )
+{
+	return constats_report_samples_async( sample_set, sample_size, CONSTATS_REPORT_PRINT );
+}
+
+#endif
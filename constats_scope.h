@@ -0,0 +1,369 @@
+/**
+ * @File     : constats_scope.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains scoped instrumentation. CONSTATS_SCOPE( "name" )
+ * times the rest of the enclosing block and records the elapsed
+ * nanoseconds into a recorder owned by that call site. Each call site
+ * registers itself on first entry, before its clock starts, so the setup
+ * is never part of a sample. constats_scope_print_all prints statistics
+ * for every registered site.
+ *
+ * CONSTATS_SCOPE_SAMPLED( "name", N ) only times one in every N passes,
+ * counted down per thread, and CONSTATS_SCOPE_ADAPTIVE( "name" ) starts by
+ * timing every pass and halves its rate every CONSTATS_ADAPT_WINDOW
+ * samples. Sampled sites keep an estimate of the calls they represent,
+ * and their stats_t counts are scaled up to match it.
+ *
+ * Defining CONSTATS_DISABLE before including this file turns every scope
+ * macro into nothing, names and periods included, so disabled builds pay
+ * nothing for instrumentation. The analysis functions stay available.
+ *
+ * Scopes rely on the cleanup attribute, so GCC or Clang is required.
+ */
+
+#ifndef CONSTATS_SCOPE_LIB_LOCK
+#define CONSTATS_SCOPE_LIB_LOCK
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "constats.h"
+#include "constats_clock.h"
+#include "constats_recorder.h"
+
+#ifndef CONSTATS_SITE_CAPACITY
+#define CONSTATS_SITE_CAPACITY (1UL << 20)
+#endif
+
+#ifndef CONSTATS_SITE_FLAGS
+#define CONSTATS_SITE_FLAGS CONSTATS_RECORDER_PREFAULT
+#endif
+
+#ifndef CONSTATS_ADAPT_WINDOW
+#define CONSTATS_ADAPT_WINDOW (1UL << 14)
+#endif
+
+#ifndef CONSTATS_ADAPT_MAX_PERIOD
+#define CONSTATS_ADAPT_MAX_PERIOD 1024
+#endif
+
+// Sampling modes
+#define CONSTATS_SAMPLING_NONE     0	// Time every pass
+#define CONSTATS_SAMPLING_FIXED    1	// Time one in every period passes
+#define CONSTATS_SAMPLING_ADAPTIVE 2	// Double the period every CONSTATS_ADAPT_WINDOW samples
+
+// Call site states
+#define CONSTATS_SITE_UNREGISTERED 0
+#define CONSTATS_SITE_REGISTERING  1
+#define CONSTATS_SITE_READY        2
+#define CONSTATS_SITE_FAILED       3
+
+typedef struct scope_site_t
+{
+	const char* name;			// The name given to CONSTATS_SCOPE
+	const char* file;			// The file of the call site
+	int line;					// The line of the call site
+	int sampling;				// The sampling mode of the site
+	uint32_t period;			// The current sampling period
+
+	int state;					// The registration state of the site
+	double ns_per_tick;			// The tick conversion captured at registration
+	double overhead_ns;			// The clock overhead subtracted from every sample
+	recorder_t recorder;		// The elapsed times recorded at this site
+	uint64_t calls;				// The estimated passes represented, if sampled
+	uint64_t taken;				// The samples taken, which paces adaptation
+
+	struct scope_site_t* next;	// The next registered site
+
+} scope_site_t;
+
+typedef struct scope_t
+{
+	scope_site_t* site;		// The site being timed
+	uint64_t start;			// The tick count when the scope was entered
+	uint32_t period;		// The passes a sampled scope stands for
+
+} scope_t;
+
+// The list of registered call sites, newest first
+scope_site_t* constats_scope_sites = NULL;
+
+#define CONSTATS_CONCAT_(a, b) a##b
+#define CONSTATS_CONCAT(a, b)  CONSTATS_CONCAT_(a, b)
+
+#define CONSTATS_SITE_INITIALIZER(site_name, site_sampling, site_period) \
+	{ .name = (site_name), .file = __FILE__, .line = __LINE__, .sampling = (site_sampling), \
+	  .period = (site_period), .state = CONSTATS_SITE_UNREGISTERED }
+
+#ifdef CONSTATS_DISABLE
+
+#define CONSTATS_SCOPE(name)
+#define CONSTATS_SCOPE_SAMPLED(name, period)
+#define CONSTATS_SCOPE_ADAPTIVE(name)
+
+#else
+
+/**
+ * Times the rest of the enclosing block under the given name.
+ */
+#define CONSTATS_SCOPE(name)                                                              \
+	static scope_site_t CONSTATS_CONCAT(constats_site_, __LINE__) =                       \
+		CONSTATS_SITE_INITIALIZER( name, CONSTATS_SAMPLING_NONE, 1 );                     \
+	scope_t CONSTATS_CONCAT(constats_scope_, __LINE__)                                    \
+		__attribute__((cleanup(constats_scope_exit))) =                                  \
+		constats_scope_enter( &CONSTATS_CONCAT(constats_site_, __LINE__) )
+
+#define CONSTATS_SCOPE_SAMPLED_(name, sampling, period)                                   \
+	static scope_site_t CONSTATS_CONCAT(constats_site_, __LINE__) =                       \
+		CONSTATS_SITE_INITIALIZER( name, sampling, period );                              \
+	static __thread uint32_t CONSTATS_CONCAT(constats_countdown_, __LINE__) = 0;          \
+	scope_t CONSTATS_CONCAT(constats_scope_, __LINE__)                                    \
+		__attribute__((cleanup(constats_scope_exit_sampled))) =                          \
+		constats_scope_enter_sampled( &CONSTATS_CONCAT(constats_site_, __LINE__),        \
+		                              &CONSTATS_CONCAT(constats_countdown_, __LINE__) )
+
+/**
+ * Times one in every period passes through the rest of the enclosing block.
+ */
+#define CONSTATS_SCOPE_SAMPLED(name, period) \
+	CONSTATS_SCOPE_SAMPLED_( name, CONSTATS_SAMPLING_FIXED, (period) > 0 ? (period) : 1 )
+
+/**
+ * Times the rest of the enclosing block at a rate that decays as samples accumulate.
+ */
+#define CONSTATS_SCOPE_ADAPTIVE(name) \
+	CONSTATS_SCOPE_SAMPLED_( name, CONSTATS_SAMPLING_ADAPTIVE, 1 )
+
+#endif
+
+/**
+ * This function captures the clock conversion of a call site and allocates
+ * its recorder, without registering it.
+ */
+static inline
+int constats_scope_site_init ( scope_site_t* site )
+{
+	site->ns_per_tick = constats_clock_ns_per_tick();
+	site->overhead_ns = constats_clock_subtracted_ns();
+
+	return constats_recorder_init( &site->recorder, CONSTATS_SITE_CAPACITY, CONSTATS_SITE_FLAGS );
+}
+
+/**
+ * This function registers a call site, allocating its recorder. Only the
+ * first caller does the work, the others wait for it to finish so their
+ * samples are kept.
+ */
+static __attribute__((noinline))
+void constats_scope_register ( scope_site_t* site )
+{
+	int expected = CONSTATS_SITE_UNREGISTERED;
+
+	if ( !__atomic_compare_exchange_n( &site->state, &expected, CONSTATS_SITE_REGISTERING,
+	                                   0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+	{
+		while ( expected == CONSTATS_SITE_REGISTERING )
+		{
+			sched_yield();
+			expected = __atomic_load_n( &site->state, __ATOMIC_ACQUIRE );
+		}
+
+		return;
+	}
+
+	if ( constats_scope_site_init( site ) != 0 )
+	{
+		__atomic_store_n( &site->state, CONSTATS_SITE_FAILED, __ATOMIC_RELEASE );
+		return;
+	}
+
+	site->next = __atomic_load_n( &constats_scope_sites, __ATOMIC_RELAXED );
+
+	while ( !__atomic_compare_exchange_n( &constats_scope_sites, &site->next, site,
+	                                      1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+
+	__atomic_store_n( &site->state, CONSTATS_SITE_READY, __ATOMIC_RELEASE );
+}
+
+/**
+ * This function starts timing a scope, registering its site first if needed.
+ */
+static inline
+scope_t constats_scope_enter ( scope_site_t* site )
+{
+	if ( CONSTATS_UNLIKELY( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY ) )
+		constats_scope_register( site );
+
+	scope_t scope;
+	scope.site   = site;
+	scope.start  = constats_clock_ticks();
+	scope.period = 1;
+	return scope;
+}
+
+/**
+ * This function stops timing a scope and records the elapsed nanoseconds.
+ */
+static inline
+void constats_scope_exit ( scope_t* scope )
+{
+	uint64_t end = constats_clock_ticks();
+	register scope_site_t* site = scope->site;
+
+	// Only a site whose registration failed is not ready by now
+	if ( CONSTATS_UNLIKELY( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY ) )
+		return;
+
+	constats_recorder_record_shared( &site->recorder, constats_clock_elapsed_ns( end - scope->start, site->ns_per_tick, site->overhead_ns ) );
+}
+
+/**
+ * This function starts timing a sampled scope, if this thread's countdown
+ * has run out, registering its site first if needed. Skipped passes leave
+ * the scope's site NULL.
+ */
+static inline
+scope_t constats_scope_enter_sampled ( scope_site_t* site, uint32_t* countdown )
+{
+	scope_t scope;
+
+	if ( CONSTATS_LIKELY( *countdown > 1 ) )
+	{
+		--*countdown;
+		scope.site   = NULL;
+		scope.start  = 0;
+		scope.period = 0;
+		return scope;
+	}
+
+	// The period this sample was taken at is what it stands for, even if
+	// the site adapts before the scope exits
+	if ( CONSTATS_UNLIKELY( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY ) )
+		constats_scope_register( site );
+
+	*countdown   = __atomic_load_n( &site->period, __ATOMIC_RELAXED );
+	scope.period = *countdown;
+	scope.site   = site;
+	scope.start  = constats_clock_ticks();
+	return scope;
+}
+
+/**
+ * This function stops timing a sampled scope. The sample stands in for the
+ * passes counted down before it, and adaptive sites double their period
+ * once a window of samples has been taken.
+ */
+static inline
+void constats_scope_exit_sampled ( scope_t* scope )
+{
+	if ( CONSTATS_LIKELY( scope->site == NULL ) )
+		return;
+
+	uint64_t end = constats_clock_ticks();
+	register scope_site_t* site = scope->site;
+
+	if ( CONSTATS_UNLIKELY( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY ) )
+		return;
+
+	__atomic_fetch_add( &site->calls, scope->period, __ATOMIC_RELAXED );
+
+	constats_recorder_record_shared( &site->recorder, constats_clock_elapsed_ns( end - scope->start, site->ns_per_tick, site->overhead_ns ) );
+
+	if ( site->sampling != CONSTATS_SAMPLING_ADAPTIVE )
+		return;
+
+	// Every count is seen by exactly one thread, so each window adapts once
+	if ( ( __atomic_add_fetch( &site->taken, 1, __ATOMIC_RELAXED ) % CONSTATS_ADAPT_WINDOW ) == 0 )
+	{
+		uint32_t period = __atomic_load_n( &site->period, __ATOMIC_RELAXED );
+
+		if ( period < CONSTATS_ADAPT_MAX_PERIOD )
+			__atomic_compare_exchange_n( &site->period, &period, period << 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED );
+	}
+}
+
+/**
+ * This function returns the number of passes a site's samples represent.
+ */
+static inline
+uint64_t constats_scope_calls ( scope_site_t* site )
+{
+	if ( site->sampling == CONSTATS_SAMPLING_NONE )
+		return constats_recorder_size( &site->recorder ) + site->recorder.dropped;
+
+	return __atomic_load_n( &site->calls, __ATOMIC_RELAXED );
+}
+
+/**
+ * This function populates the stat data structure with the site's statistics.
+ * For sampled sites N and the outlier count are scaled to the estimated passes.
+ */
+static inline
+int constats_scope_calculate_stats ( scope_site_t* site, stats_t* stat )
+{
+	// Error Checking
+	if ( site == NULL || __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY )
+		return -1;
+
+	uint64_t size = constats_recorder_size( &site->recorder );
+	int error_code = constats_calculate_stats ( site->recorder.samples, size, stat );
+
+	if ( error_code != 0 || site->sampling == CONSTATS_SAMPLING_NONE )
+		return error_code;
+
+	// Samples that were dropped still contributed to calls
+	double scale = (double) constats_scope_calls( site ) / (double) ( size + site->recorder.dropped );
+
+	stat->N        = constats_scope_calls( site );
+	stat->outliers = (uint64_t) ( stat->outliers * scale );
+
+	return 0;
+}
+
+/**
+ * This function calculates and prints statistics of one call site.
+ */
+static inline
+int constats_scope_print ( scope_site_t* site )
+{
+	// Error Checking
+	if ( site == NULL || __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != CONSTATS_SITE_READY )
+		return -1;
+
+	stats_t stats;
+	uint64_t size  = constats_recorder_size( &site->recorder );
+	int error_code = constats_scope_calculate_stats( site, &stats );
+
+	if ( error_code != 0 )
+		return error_code;
+
+	printf ( "Scope                  : %s (%s:%d)\n", site->name, site->file, site->line );
+
+	if ( site->sampling != CONSTATS_SAMPLING_NONE )
+		printf ( "Sampled                : %lu of ~%lu passes (now 1 in %u)\n", size, stats.N, site->period );
+
+	if ( site->recorder.dropped > 0 )
+		printf ( "Dropped Samples        : %lu\n", site->recorder.dropped );
+
+	constats_clock_print_resolution_warning( site->recorder.samples, size, CONSTATS_CLOCK_TICKS );
+
+	return constats_print_stats ( site->recorder.samples, size, &stats );
+}
+
+/**
+ * This function calculates and prints statistics of every registered call site.
+ */
+static inline
+int constats_scope_print_all ( void )
+{
+	scope_site_t* site = __atomic_load_n( &constats_scope_sites, __ATOMIC_ACQUIRE );
+
+	for ( ; site != NULL; site = site->next )
+		constats_scope_print( site );
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,280 @@
+/**
+ * @File     : constats_shm.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains live stats export through POSIX shared memory. A
+ * process creates a named segment holding a fixed number of series, each
+ * a histogram_t, and records into them as it runs. Any other process can
+ * attach to the segment read-only and take consistent snapshots without
+ * a single call into the writer.
+ *
+ * Every series is guarded by a sequence lock. The writer makes the
+ * sequence odd, updates the histogram, then makes it even again. Readers
+ * copy the series and retry if the sequence was odd or changed while
+ * they copied, up to CONSTATS_SHM_TRIES times, after which the series is
+ * reported as busy; a writer that died mid-record leaves it busy for
+ * good. Writers never wait on readers. Each series must only be recorded
+ * into by one thread at a time.
+ *
+ * constats_shm_reader.c is a small tool that attaches to a segment and
+ * prints every series periodically.
+ */
+
+#ifndef CONSTATS_SHM_LIB_LOCK
+#define CONSTATS_SHM_LIB_LOCK
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "constats.h"
+#include "constats_histogram.h"
+
+#define CONSTATS_SHM_MAGIC   0x5354415453434e43UL	// "CNCSTATS"
+#define CONSTATS_SHM_VERSION 2
+
+#ifndef CONSTATS_SHM_NAME_SIZE
+#define CONSTATS_SHM_NAME_SIZE 48
+#endif
+
+// How many times a snapshot rereads a series that is being written
+#ifndef CONSTATS_SHM_TRIES
+#define CONSTATS_SHM_TRIES 1000
+#endif
+
+// Returned by constats_shm_snapshot when the series stayed mid-write
+#define CONSTATS_SHM_BUSY 1
+
+typedef struct shm_series_t
+{
+	uint64_t seq;						// The sequence lock, odd while being written
+	char name[CONSTATS_SHM_NAME_SIZE];	// The name of the series
+	histogram_t hist;					// The values recorded so far
+
+} shm_series_t;
+
+typedef struct shm_header_t
+{
+	uint64_t magic;						// CONSTATS_SHM_MAGIC once the segment is ready
+	uint32_t version;					// CONSTATS_SHM_VERSION
+	uint32_t sub_bits;					// The writer's CONSTATS_HISTOGRAM_SUB_BITS
+	uint64_t series;					// The number of series in the segment
+
+} shm_header_t;
+
+typedef struct shm_t
+{
+	shm_header_t* header;				// The mapped segment
+	shm_series_t* series;				// The series following the header
+	uint64_t size;						// The size of the mapping
+	int writable;						// Whether this process created the segment
+
+} shm_t;
+
+/**
+ * This function creates (or replaces) the named segment with room for the
+ * given number of series, all empty and unnamed. A segment already under
+ * the name is unlinked rather than resized, so processes still mapping it
+ * keep the old one instead of faulting on a shrunk one.
+ */
+static inline
+int constats_shm_create ( shm_t* shm, const char* name, uint64_t series )
+{
+	uint64_t i;
+
+	// Error Checking
+	if ( shm == NULL || name == NULL || series == 0 )
+		return -1;
+
+	shm->size     = sizeof( shm_header_t ) + series * sizeof( shm_series_t );
+	shm->writable = 1;
+
+	shm_unlink( name );
+
+	int fd = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0644 );
+
+	if ( fd < 0 )
+		return -1;
+
+	if ( ftruncate( fd, shm->size ) != 0 )
+	{
+		close( fd );
+		return -1;
+	}
+
+	void* segment = mmap( NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if ( segment == MAP_FAILED )
+		return -1;
+
+	shm->header = (shm_header_t*) segment;
+	shm->series = (shm_series_t*) ( shm->header + 1 );
+
+	// Readers check the magic last, so they never see a half built segment
+	__atomic_store_n( &shm->header->magic, 0, __ATOMIC_RELAXED );
+
+	for ( i = 0; i < series; ++i )
+	{
+		shm->series[i].seq = 0;
+		memset( shm->series[i].name, 0, CONSTATS_SHM_NAME_SIZE );
+		constats_histogram_init( &shm->series[i].hist );
+	}
+
+	shm->header->version  = CONSTATS_SHM_VERSION;
+	shm->header->sub_bits = CONSTATS_HISTOGRAM_SUB_BITS;
+	shm->header->series   = series;
+
+	__atomic_store_n( &shm->header->magic, CONSTATS_SHM_MAGIC, __ATOMIC_RELEASE );
+	return 0;
+}
+
+/**
+ * This function attaches read-only to a segment created by another process.
+ */
+static inline
+int constats_shm_attach ( shm_t* shm, const char* name )
+{
+	struct stat st;
+
+	// Error Checking
+	if ( shm == NULL || name == NULL )
+		return -1;
+
+	int fd = shm_open( name, O_RDONLY, 0 );
+
+	if ( fd < 0 )
+		return -1;
+
+	if ( fstat( fd, &st ) != 0 || (uint64_t) st.st_size < sizeof( shm_header_t ) )
+	{
+		close( fd );
+		return -1;
+	}
+
+	void* segment = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if ( segment == MAP_FAILED )
+		return -1;
+
+	shm->header   = (shm_header_t*) segment;
+	shm->series   = (shm_series_t*) ( shm->header + 1 );
+	shm->size     = st.st_size;
+	shm->writable = 0;
+
+	if ( __atomic_load_n( &shm->header->magic, __ATOMIC_ACQUIRE ) != CONSTATS_SHM_MAGIC
+	  || shm->header->version != CONSTATS_SHM_VERSION
+	  || shm->header->sub_bits != CONSTATS_HISTOGRAM_SUB_BITS
+	  || shm->size < sizeof( shm_header_t ) + shm->header->series * sizeof( shm_series_t ) )
+	{
+		munmap( segment, shm->size );
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * This function unmaps the segment. The creator also removes its name.
+ */
+static inline
+int constats_shm_detach ( shm_t* shm, const char* name )
+{
+	munmap( shm->header, shm->size );
+
+	if ( shm->writable && name != NULL )
+		shm_unlink( name );
+
+	shm->header = NULL;
+	shm->series = NULL;
+	return 0;
+}
+
+/**
+ * This function names a series.
+ */
+static inline
+int constats_shm_name ( shm_t* shm, uint64_t index, const char* name )
+{
+	// Error Checking
+	if ( !shm->writable || index >= shm->header->series )
+		return -1;
+
+	shm_series_t* series = &shm->series[index];
+
+	__atomic_store_n( &series->seq, series->seq + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	strncpy( series->name, name, CONSTATS_SHM_NAME_SIZE - 1 );
+
+	__atomic_store_n( &series->seq, series->seq + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+/**
+ * This function records one value into a series.
+ */
+static inline
+void constats_shm_record ( shm_t* shm, uint64_t index, int64_t value )
+{
+	shm_series_t* series = &shm->series[index];
+	uint64_t seq = series->seq;
+
+	__atomic_store_n( &series->seq, seq + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	constats_histogram_record( &series->hist, value );
+
+	__atomic_store_n( &series->seq, seq + 2, __ATOMIC_RELEASE );
+}
+
+/**
+ * This function copies a consistent snapshot of a series. It returns -1
+ * if the index is out of range, and CONSTATS_SHM_BUSY if the series was
+ * being written on every one of CONSTATS_SHM_TRIES tries.
+ */
+static inline
+int constats_shm_snapshot ( shm_t* shm, uint64_t index, shm_series_t* snapshot )
+{
+	// Error Checking
+	if ( index >= shm->header->series )
+		return -1;
+
+	shm_series_t* series = &shm->series[index];
+	uint64_t before;
+	uint64_t after;
+	int tries;
+
+	for ( tries = 0; tries < CONSTATS_SHM_TRIES; ++tries )
+	{
+		before = __atomic_load_n( &series->seq, __ATOMIC_ACQUIRE );
+
+		// Let a writer that was switched out mid-record finish
+		if ( before & 1 )
+		{
+			sched_yield();
+			continue;
+		}
+
+		memcpy( snapshot, series, sizeof( shm_series_t ) );
+
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+		after = __atomic_load_n( &series->seq, __ATOMIC_RELAXED );
+
+		if ( before == after )
+		{
+			snapshot->name[CONSTATS_SHM_NAME_SIZE - 1] = '\0';
+			return 0;
+		}
+	}
+
+	return CONSTATS_SHM_BUSY;
+}
+
+#endif
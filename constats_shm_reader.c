@@ -0,0 +1,79 @@
+/**
+ * @File     : constats_shm_reader.c
+ * @Author   : Abdullah Younis
+ *
+ * This tool attaches to a constats shared memory segment and prints the
+ * statistics of every named series, once or every interval milliseconds.
+ *
+ * Build : cc -O2 -o constats_shm_reader constats_shm_reader.c -lm -lrt
+ * Usage : constats_shm_reader <segment name> [interval ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "constats_shm.h"
+
+int main ( int argc, char** argv )
+{
+	shm_t shm;
+	uint64_t i;
+
+	if ( argc < 2 )
+	{
+		fprintf ( stderr, "Usage: %s <segment name> [interval ms]\n", argv[0] );
+		return 1;
+	}
+
+	long interval = argc > 2 ? atol( argv[2] ) : 0;
+
+	if ( constats_shm_attach( &shm, argv[1] ) != 0 )
+	{
+		fprintf ( stderr, "%s: cannot attach to %s\n", argv[0], argv[1] );
+		return 1;
+	}
+
+	// A series is too large for the stack
+	shm_series_t* snapshot = (shm_series_t*) malloc( sizeof( shm_series_t ) );
+
+	if ( snapshot == NULL )
+		return 1;
+
+	do
+	{
+		time_t now = time( NULL );
+		printf ( "Segment                : %s @ %s", argv[1], ctime( &now ) );
+
+		for ( i = 0; i < shm.header->series; ++i )
+		{
+			if ( constats_shm_snapshot( &shm, i, snapshot ) != 0 )
+			{
+				printf ( "Series                 : #%lu busy, its writer may have stopped\n", i );
+				continue;
+			}
+
+			if ( snapshot->name[0] == '\0' )
+				continue;
+
+			printf ( "Series                 : %s\n", snapshot->name );
+
+			if ( snapshot->hist.N == 0 )
+				printf ( "Sample Size            : 0\n" );
+			else
+				constats_histogram_print_stats( &snapshot->hist );
+		}
+
+		fflush( stdout );
+
+		if ( interval > 0 )
+		{
+			struct timespec ts = { interval / 1000, ( interval % 1000 ) * 1000000 };
+			nanosleep( &ts, NULL );
+		}
+	} while ( interval > 0 );
+
+	free( snapshot );
+	constats_shm_detach( &shm, NULL );
+	return 0;
+}
@@ -0,0 +1,404 @@
+/**
+ * @File     : constats_signal.h
+ * @Author   : Abdullah Younis
+ *
+ * This library dumps the current statistics of a running program when it
+ * receives a signal, without stopping it: register the recorders,
+ * histograms and accumulators to watch, install the handler, then
+ * `kill -USR1 <pid>`.
+ *
+ * Everything the handler does is async-signal-safe. The statistics are
+ * computed with the allocation-free constats routines, the text is
+ * formatted by hand into a stack buffer, and each line leaves through a
+ * single write(2). Nothing touches stdio, so a dump cannot deadlock on a
+ * stdout lock held by the interrupted thread; it may interleave with
+ * output that stdio still has buffered.
+ *
+ * Recorders are read up to the samples published on entry and histograms
+ * and accumulators are copied first, so a dump taken in the middle of a
+ * record may miss that one sample but never reads past the valid data.
+ * A recorder whose writers keep a slot half written through every retry
+ * is reported as in progress instead of waited for. Histograms are copied
+ * into one of CONSTATS_SIGNAL_SNAPSHOTS buffers, each claimed with an
+ * atomic exchange, so dumps running at once on different threads, or a
+ * dump interrupted by another, never share one; if all are taken the
+ * histogram is reported as busy.
+ * Watch things only while no signal can arrive, as registration is not
+ * itself signal-safe.
+ */
+
+#ifndef CONSTATS_SIGNAL_LIB_LOCK
+#define CONSTATS_SIGNAL_LIB_LOCK
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_histogram.h"
+#include "constats_recorder.h"
+
+#ifndef CONSTATS_SIGNAL_TARGETS
+#define CONSTATS_SIGNAL_TARGETS 32
+#endif
+
+// How many times a dump rereads a recorder that is being written
+#ifndef CONSTATS_SIGNAL_TRIES
+#define CONSTATS_SIGNAL_TRIES 1000
+#endif
+
+// How many histogram copies can be in use at once
+#ifndef CONSTATS_SIGNAL_SNAPSHOTS
+#define CONSTATS_SIGNAL_SNAPSHOTS 4
+#endif
+
+// Target kinds
+#define CONSTATS_SIGNAL_RECORDER    1
+#define CONSTATS_SIGNAL_HISTOGRAM   2
+#define CONSTATS_SIGNAL_ACCUMULATOR 3
+
+typedef struct signal_target_t
+{
+	const char* name;		// The name printed above the statistics
+	int kind;				// What target points to
+	void* target;			// The watched recorder, histogram or accumulator
+
+} signal_target_t;
+
+typedef struct signal_buffer_t
+{
+	char data[256];			// The line being built
+	uint64_t length;		// The number of bytes in data
+
+} signal_buffer_t;
+
+signal_target_t constats_signal_targets[CONSTATS_SIGNAL_TARGETS];
+uint64_t constats_signal_target_count = 0;
+int constats_signal_fd = STDOUT_FILENO;
+
+// Copies taken by the handler, too large for a signal stack
+histogram_t constats_signal_hist_snapshots[CONSTATS_SIGNAL_SNAPSHOTS];
+int constats_signal_hist_claimed[CONSTATS_SIGNAL_SNAPSHOTS];
+
+/**
+ * This function claims a free histogram copy, or returns NULL if every
+ * one is in use. It never waits.
+ */
+static inline
+histogram_t* constats_signal_claim_snapshot ( void )
+{
+	int i;
+
+	for ( i = 0; i < CONSTATS_SIGNAL_SNAPSHOTS; ++i )
+		if ( __atomic_exchange_n( &constats_signal_hist_claimed[i], 1, __ATOMIC_ACQUIRE ) == 0 )
+			return &constats_signal_hist_snapshots[i];
+
+	return NULL;
+}
+
+/**
+ * This function hands a histogram copy back.
+ */
+static inline
+void constats_signal_release_snapshot ( histogram_t* snapshot )
+{
+	__atomic_store_n( &constats_signal_hist_claimed[snapshot - constats_signal_hist_snapshots], 0, __ATOMIC_RELEASE );
+}
+
+/**
+ * This function appends a string to the line.
+ */
+static inline
+void constats_signal_put_str ( signal_buffer_t* buf, const char* str )
+{
+	while ( *str != '\0' && buf->length < sizeof( buf->data ) )
+		buf->data[buf->length++] = *str++;
+}
+
+/**
+ * This function appends an unsigned integer to the line.
+ */
+static inline
+void constats_signal_put_uint ( signal_buffer_t* buf, uint64_t value )
+{
+	char digits[20];
+	int count = 0;
+
+	do
+	{
+		digits[count++] = DTOC( value % 10 );
+		value /= 10;
+	} while ( value > 0 );
+
+	while ( count > 0 && buf->length < sizeof( buf->data ) )
+		buf->data[buf->length++] = digits[--count];
+}
+
+/**
+ * This function appends a signed integer to the line.
+ */
+static inline
+void constats_signal_put_int ( signal_buffer_t* buf, int64_t value )
+{
+	if ( value < 0 )
+	{
+		constats_signal_put_str( buf, "-" );
+		constats_signal_put_uint( buf, (uint64_t) 0 - (uint64_t) value );
+		return;
+	}
+
+	constats_signal_put_uint( buf, value );
+}
+
+/**
+ * This function appends a double rounded to an integer, like "%.0f".
+ */
+static inline
+void constats_signal_put_double ( signal_buffer_t* buf, double value )
+{
+	if ( value != value )
+		constats_signal_put_str( buf, "nan" );
+	else if ( value >= 9.2e18 || value <= -9.2e18 )
+		constats_signal_put_str( buf, value > 0 ? "inf" : "-inf" );
+	else
+		constats_signal_put_int( buf, (int64_t) ( value < 0 ? value - 0.5 : value + 0.5 ) );
+}
+
+/**
+ * This function writes the line out and empties it.
+ */
+static inline
+void constats_signal_flush ( signal_buffer_t* buf )
+{
+	const char* bytes = buf->data;
+	uint64_t size = buf->length;
+
+	while ( size > 0 )
+	{
+		ssize_t written = write( constats_signal_fd, bytes, size );
+
+		if ( written < 0 && errno == EINTR )
+			continue;
+
+		if ( written <= 0 )
+			break;
+
+		bytes += written;
+		size  -= written;
+	}
+
+	buf->length = 0;
+}
+
+/**
+ * This function writes one "label : value" line with an integer value.
+ */
+static inline
+void constats_signal_int_line ( signal_buffer_t* buf, const char* label, int64_t value )
+{
+	constats_signal_put_str( buf, label );
+	constats_signal_put_int( buf, value );
+	constats_signal_put_str( buf, "\n" );
+	constats_signal_flush( buf );
+}
+
+/**
+ * This function writes one "label : value" line with a rounded double value.
+ */
+static inline
+void constats_signal_double_line ( signal_buffer_t* buf, const char* label, double value )
+{
+	constats_signal_put_str( buf, label );
+	constats_signal_put_double( buf, value );
+	constats_signal_put_str( buf, "\n" );
+	constats_signal_flush( buf );
+}
+
+/**
+ * This function writes the statistics in the layout of constats_print_stats.
+ */
+static inline
+void constats_signal_write_stats ( signal_buffer_t* buf, stats_t* stat )
+{
+	constats_signal_int_line( buf, "Sample Size            : ", stat->N );
+	constats_signal_double_line( buf, "Average value          : ", stat->mean );
+	constats_signal_int_line( buf, "Minimum value          : ", stat->min );
+	constats_signal_int_line( buf, "Maximum value          : ", stat->max );
+	constats_signal_double_line( buf, "Standard Deviation     : ", stat->stdev );
+	constats_signal_double_line( buf, "Mean Absolute Deviation: ", stat->abdev );
+	constats_signal_int_line( buf, "Outlier Count   : ", stat->outliers );
+
+	if ( stat->outliers > 0 )
+	{
+		constats_signal_put_str( buf, "Without Outliers:\n" );
+		constats_signal_double_line( buf, "\tAverage value          : ", stat->norm_mean );
+		constats_signal_int_line( buf, "\tMinimum value          : ", stat->norm_min );
+		constats_signal_int_line( buf, "\tMaximum value          : ", stat->norm_max );
+		constats_signal_double_line( buf, "\tStandard Deviation     : ", stat->norm_stdev );
+		constats_signal_double_line( buf, "\tMean Absolute Deviation: ", stat->norm_abdev );
+	}
+}
+
+/**
+ * This function writes the current statistics of every watched target.
+ * It is async-signal-safe, and may also be called directly.
+ */
+static inline
+void constats_signal_dump ( void )
+{
+	signal_buffer_t buf;
+	stats_t stat;
+	uint64_t i;
+
+	buf.length = 0;
+
+	histogram_t* snapshot = NULL;
+
+	for ( i = 0; i < constats_signal_target_count; ++i )
+	{
+		signal_target_t* target = &constats_signal_targets[i];
+		int error_code = -1;
+
+		constats_signal_put_str( &buf, "-------------------------------------------------------------------------------\n" );
+		constats_signal_put_str( &buf, "Series                 : " );
+		constats_signal_put_str( &buf, target->name );
+		constats_signal_put_str( &buf, "\n" );
+		constats_signal_flush( &buf );
+
+		if ( target->kind == CONSTATS_SIGNAL_RECORDER )
+		{
+			recorder_t* recorder = (recorder_t*) target->target;
+			uint64_t size;
+			int tries;
+
+			// The interrupted thread may be the writer, so never wait for it
+			for ( tries = 0; tries < CONSTATS_SIGNAL_TRIES; ++tries )
+				if ( constats_recorder_try_size( recorder, &size ) == 0 )
+					break;
+
+			if ( tries == CONSTATS_SIGNAL_TRIES )
+			{
+				constats_signal_put_str( &buf, "Recording in progress, try again\n" );
+				constats_signal_flush( &buf );
+				continue;
+			}
+
+			error_code = constats_calculate_stats( recorder->samples, size, &stat );
+
+			if ( recorder->dropped > 0 )
+				constats_signal_int_line( &buf, "Dropped Samples        : ", recorder->dropped );
+		}
+		else if ( target->kind == CONSTATS_SIGNAL_HISTOGRAM )
+		{
+			if ( snapshot == NULL && ( snapshot = constats_signal_claim_snapshot() ) == NULL )
+			{
+				constats_signal_put_str( &buf, "Dump in progress elsewhere, try again\n" );
+				constats_signal_flush( &buf );
+				continue;
+			}
+
+			memcpy( snapshot, target->target, sizeof( histogram_t ) );
+			error_code = constats_histogram_calculate_stats( snapshot, &stat );
+		}
+		else if ( target->kind == CONSTATS_SIGNAL_ACCUMULATOR )
+		{
+			accumulator_t snapshot = *(accumulator_t*) target->target;
+			error_code = constats_accumulator_calculate_stats( &snapshot, &stat );
+		}
+
+		if ( error_code != 0 )
+		{
+			constats_signal_int_line( &buf, "Sample Size            : ", 0 );
+			continue;
+		}
+
+		constats_signal_write_stats( &buf, &stat );
+
+		if ( target->kind == CONSTATS_SIGNAL_HISTOGRAM )
+		{
+			constats_signal_int_line( &buf, "p50     : ", constats_histogram_percentile( snapshot, 50 ) );
+			constats_signal_int_line( &buf, "p99     : ", constats_histogram_percentile( snapshot, 99 ) );
+			constats_signal_int_line( &buf, "p99.9   : ", constats_histogram_percentile( snapshot, 99.9 ) );
+		}
+	}
+
+	if ( snapshot != NULL )
+		constats_signal_release_snapshot( snapshot );
+
+	constats_signal_put_str( &buf, "-------------------------------------------------------------------------------\n" );
+	constats_signal_flush( &buf );
+}
+
+/**
+ * This function is the signal handler.
+ */
+static inline
+void constats_signal_handler ( int signo )
+{
+	int saved_errno = errno;
+	(void) signo;
+
+	constats_signal_dump();
+
+	errno = saved_errno;
+}
+
+/**
+ * This function adds a target to the dump.
+ */
+static inline
+int constats_signal_watch ( const char* name, int kind, void* target )
+{
+	// Error Checking
+	if ( name == NULL || target == NULL || constats_signal_target_count >= CONSTATS_SIGNAL_TARGETS )
+		return -1;
+
+	signal_target_t* slot = &constats_signal_targets[constats_signal_target_count];
+	slot->name   = name;
+	slot->kind   = kind;
+	slot->target = target;
+
+	// Publish the target only once it is complete
+	__atomic_store_n( &constats_signal_target_count, constats_signal_target_count + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+static inline
+int constats_signal_watch_recorder ( const char* name, recorder_t* recorder )
+{
+	return constats_signal_watch( name, CONSTATS_SIGNAL_RECORDER, recorder );
+}
+
+static inline
+int constats_signal_watch_histogram ( const char* name, histogram_t* hist )
+{
+	return constats_signal_watch( name, CONSTATS_SIGNAL_HISTOGRAM, hist );
+}
+
+static inline
+int constats_signal_watch_accumulator ( const char* name, accumulator_t* acc )
+{
+	return constats_signal_watch( name, CONSTATS_SIGNAL_ACCUMULATOR, acc );
+}
+
+/**
+ * This function installs the dump as the handler of signo, usually
+ * SIGUSR1. Interrupted system calls are restarted.
+ */
+static inline
+int constats_signal_install ( int signo )
+{
+	struct sigaction action;
+
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = constats_signal_handler;
+	action.sa_flags   = SA_RESTART;
+	sigemptyset( &action.sa_mask );
+
+	return sigaction( signo, &action, NULL );
+}
+
+#endif
@@ -0,0 +1,543 @@
+/**
+ * @File     : constats_table.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a compact report for many series at once: one
+ * row per series with its size, mean, standard deviation, median, 99th
+ * percentile, maximum and outlier count, instead of a full
+ * constats_print_stats block each. Rows can be sorted by any column.
+ *
+ * The whole table is formatted into one buffer with the constats
+ * formatters and leaves through a single write(2), so printing ten
+ * thousand series costs one syscall. Values follow CONSTATS_PRINT_UNIT
+ * and CONSTATS_PRINT_PRECISION like the other reports; sample columns
+ * stay integers, so they print and sort exactly.
+ */
+
+#ifndef CONSTATS_TABLE_LIB_LOCK
+#define CONSTATS_TABLE_LIB_LOCK
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constats.h"
+#include "constats_histogram.h"
+
+// Table columns
+#define CONSTATS_COLUMN_NAME     0
+#define CONSTATS_COLUMN_N        1
+#define CONSTATS_COLUMN_MEAN     2
+#define CONSTATS_COLUMN_STDEV    3
+#define CONSTATS_COLUMN_P50      4
+#define CONSTATS_COLUMN_P99      5
+#define CONSTATS_COLUMN_MAX      6
+#define CONSTATS_COLUMN_OUTLIERS 7
+#define CONSTATS_COLUMNS         8
+
+// Sort flags
+#define CONSTATS_SORT_DESCENDING 0x1
+
+#ifndef CONSTATS_TABLE_CELL_WIDTH
+#define CONSTATS_TABLE_CELL_WIDTH 12
+#endif
+
+#ifndef CONSTATS_TABLE_NAME_WIDTH
+#define CONSTATS_TABLE_NAME_WIDTH 40
+#endif
+
+typedef struct table_row_t
+{
+	const char* name;		// The name of the series, not copied
+	stats_t stat;			// The statistics of the series
+	int64_t p50;			// The median
+	int64_t p99;			// The 99th percentile
+
+} table_row_t;
+
+typedef struct table_t
+{
+	table_row_t* rows;		// The rows, in display order
+	uint64_t count;			// The number of rows
+	uint64_t capacity;		// The number of rows allocated
+
+	int64_t* scratch;		// Room to select percentiles without reordering samples
+	uint64_t scratch_size;	// The number of samples scratch can hold
+
+} table_t;
+
+typedef struct table_key_t
+{
+	double value;			// The sort key of a numeric column
+	int64_t exact;			// The exact key of an integer column, 0 otherwise
+	const char* name;		// The sort key of the name column
+	uint64_t index;			// The row, which also breaks ties
+
+} table_key_t;
+
+/**
+ * This function prepares an empty table.
+ */
+static inline
+void constats_table_init ( table_t* table )
+{
+	memset( table, 0, sizeof( table_t ) );
+}
+
+/**
+ * This function releases the table's memory.
+ */
+static inline
+void constats_table_destroy ( table_t* table )
+{
+	free( table->rows );
+	free( table->scratch );
+	memset( table, 0, sizeof( table_t ) );
+}
+
+/**
+ * This function appends an empty row, or returns NULL.
+ */
+static inline
+table_row_t* constats_table_append ( table_t* table, const char* name )
+{
+	if ( table->count == table->capacity )
+	{
+		uint64_t capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+		table_row_t* rows = (table_row_t*) realloc( table->rows, capacity * sizeof( table_row_t ) );
+
+		if ( rows == NULL )
+			return NULL;
+
+		table->rows     = rows;
+		table->capacity = capacity;
+	}
+
+	table_row_t* row = &table->rows[table->count++];
+	memset( row, 0, sizeof( table_row_t ) );
+	row->name = name;
+	return row;
+}
+
+/**
+ * This function returns the k-th smallest sample, partially reordering
+ * the samples in [low, high] around it.
+ */
+static inline
+int64_t constats_table_select ( int64_t* samples, uint64_t low, uint64_t high, uint64_t k )
+{
+	while ( low < high )
+	{
+		uint64_t middle = low + ( high - low ) / 2;
+		int64_t pivot   = samples[middle];
+
+		// Median of three keeps sorted input from going quadratic
+		if ( ( samples[low] < pivot ) != ( samples[low] < samples[high] ) )
+			pivot = samples[low];
+		else if ( ( samples[high] < pivot ) != ( samples[high] < samples[low] ) )
+			pivot = samples[high];
+
+		uint64_t i = low;
+		uint64_t j = high;
+
+		while ( i <= j )
+		{
+			while ( samples[i] < pivot )
+				++i;
+
+			while ( samples[j] > pivot )
+				--j;
+
+			if ( i <= j )
+			{
+				int64_t swap = samples[i];
+				samples[i]   = samples[j];
+				samples[j]   = swap;
+
+				++i;
+
+				if ( j == 0 )
+					break;
+
+				--j;
+			}
+		}
+
+		if ( k <= j )
+			high = j;
+		else if ( k >= i )
+			low = i;
+		else
+			return samples[k];
+	}
+
+	return samples[k];
+}
+
+/**
+ * This function returns the rank, counted from 0, of the sample below
+ * which the given percentage fall, as constats_histogram_percentile counts it.
+ */
+static inline
+uint64_t constats_table_rank ( uint64_t sample_size, double percentile )
+{
+	uint64_t rank = (uint64_t) ceil( percentile / 100 * sample_size );
+	return rank == 0 ? 0 : rank - 1;
+}
+
+/**
+ * This function adds a row for a sample set. The percentiles are exact;
+ * the samples are left untouched.
+ */
+static inline
+int constats_table_add_samples ( table_t* table, const char* name, int64_t* sample_set, uint64_t sample_size )
+{
+	// Error Checking
+	if ( table == NULL || name == NULL || sample_size == 0 )
+		return -1;
+
+	if ( sample_size > table->scratch_size )
+	{
+		int64_t* scratch = (int64_t*) realloc( table->scratch, sample_size * sizeof( int64_t ) );
+
+		if ( scratch == NULL )
+			return -1;
+
+		table->scratch      = scratch;
+		table->scratch_size = sample_size;
+	}
+
+	table_row_t* row = constats_table_append( table, name );
+
+	if ( row == NULL )
+		return -1;
+
+	constats_calculate_stats( sample_set, sample_size, &row->stat );
+	memcpy( table->scratch, sample_set, sample_size * sizeof( int64_t ) );
+
+	// The first selection leaves everything above the median to its right
+	uint64_t p50 = constats_table_rank( sample_size, 50 );
+	uint64_t p99 = constats_table_rank( sample_size, 99 );
+
+	row->p50 = constats_table_select( table->scratch, 0, sample_size - 1, p50 );
+	row->p99 = constats_table_select( table->scratch, p50, sample_size - 1, p99 );
+	return 0;
+}
+
+/**
+ * This function adds a row for a histogram.
+ */
+static inline
+int constats_table_add_histogram ( table_t* table, const char* name, const histogram_t* hist )
+{
+	stats_t stat;
+
+	// Error Checking
+	if ( table == NULL || name == NULL || constats_histogram_calculate_stats( hist, &stat ) != 0 )
+		return -1;
+
+	table_row_t* row = constats_table_append( table, name );
+
+	if ( row == NULL )
+		return -1;
+
+	row->stat = stat;
+	row->p50  = constats_histogram_percentile( hist, 50 );
+	row->p99  = constats_histogram_percentile( hist, 99 );
+	return 0;
+}
+
+/**
+ * This function returns a row's value in a numeric column.
+ */
+static inline
+double constats_table_value ( const table_row_t* row, int column )
+{
+	switch ( column )
+	{
+		case CONSTATS_COLUMN_N:        return row->stat.N;
+		case CONSTATS_COLUMN_MEAN:     return row->stat.mean;
+		case CONSTATS_COLUMN_STDEV:    return row->stat.stdev;
+		case CONSTATS_COLUMN_P50:      return row->p50;
+		case CONSTATS_COLUMN_P99:      return row->p99;
+		case CONSTATS_COLUMN_MAX:      return row->stat.max;
+		case CONSTATS_COLUMN_OUTLIERS: return row->stat.outliers;
+	}
+
+	return 0;
+}
+
+/**
+ * This function returns a row's value in an integer column, or 0 for the
+ * other columns. It orders rows a double key cannot tell apart.
+ */
+static inline
+int64_t constats_table_exact ( const table_row_t* row, int column )
+{
+	switch ( column )
+	{
+		case CONSTATS_COLUMN_N:        return row->stat.N;
+		case CONSTATS_COLUMN_P50:      return row->p50;
+		case CONSTATS_COLUMN_P99:      return row->p99;
+		case CONSTATS_COLUMN_MAX:      return row->stat.max;
+		case CONSTATS_COLUMN_OUTLIERS: return row->stat.outliers;
+	}
+
+	return 0;
+}
+
+/**
+ * This function orders numeric keys. NaN sorts above every number and
+ * equal to itself, so the order stays total.
+ */
+static inline
+int constats_table_compare_values ( const void* a, const void* b )
+{
+	const table_key_t* x = (const table_key_t*) a;
+	const table_key_t* y = (const table_key_t*) b;
+	int x_nan = x->value != x->value;
+	int y_nan = y->value != y->value;
+
+	if ( x_nan != y_nan )
+		return x_nan - y_nan;
+
+	if ( !x_nan && x->value != y->value )
+		return x->value < y->value ? -1 : 1;
+
+	if ( x->exact != y->exact )
+		return x->exact < y->exact ? -1 : 1;
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static inline
+int constats_table_compare_names ( const void* a, const void* b )
+{
+	const table_key_t* x = (const table_key_t*) a;
+	const table_key_t* y = (const table_key_t*) b;
+	int order = strcmp( x->name, y->name );
+
+	if ( order != 0 )
+		return order;
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/**
+ * This function sorts the rows by a column. Equal rows keep their order.
+ */
+static inline
+int constats_table_sort ( table_t* table, int column, int flags )
+{
+	uint64_t i;
+
+	// Error Checking
+	if ( column < 0 || column >= CONSTATS_COLUMNS )
+		return -1;
+
+	if ( table->count < 2 )
+		return 0;
+
+	// Sort small keys, then move each row once
+	table_key_t* keys   = (table_key_t*) malloc( table->count * sizeof( table_key_t ) );
+	table_row_t* sorted = (table_row_t*) malloc( table->count * sizeof( table_row_t ) );
+
+	if ( keys == NULL || sorted == NULL )
+	{
+		free( keys );
+		free( sorted );
+		return -1;
+	}
+
+	// Descending order reads the keys backwards, so ties are numbered backwards too
+	for ( i = 0; i < table->count; ++i )
+	{
+		keys[i].value = constats_table_value( &table->rows[i], column );
+		keys[i].exact = constats_table_exact( &table->rows[i], column );
+		keys[i].name  = table->rows[i].name;
+		keys[i].index = flags & CONSTATS_SORT_DESCENDING ? table->count - 1 - i : i;
+	}
+
+	qsort( keys, table->count, sizeof( table_key_t ),
+	       column == CONSTATS_COLUMN_NAME ? constats_table_compare_names : constats_table_compare_values );
+
+	for ( i = 0; i < table->count; ++i )
+	{
+		table_key_t* key = &keys[flags & CONSTATS_SORT_DESCENDING ? table->count - 1 - i : i];
+		sorted[i] = table->rows[flags & CONSTATS_SORT_DESCENDING ? table->count - 1 - key->index : key->index];
+	}
+
+	free( table->rows );
+	free( keys );
+
+	table->rows     = sorted;
+	table->capacity = table->count;
+	return 0;
+}
+
+/**
+ * This function right-aligns text in a cell followed by a space.
+ */
+static inline
+char* constats_table_cell ( char* cursor, const char* text, uint64_t length )
+{
+	uint64_t width = CONSTATS_TABLE_CELL_WIDTH;
+
+	if ( length > width )
+		length = width;
+
+	memset( cursor, ' ', width + 1 - length );
+	memcpy( cursor + width + 1 - length, text, length );
+	return cursor + width + 1;
+}
+
+/**
+ * This function formats a count into a cell.
+ */
+static inline
+char* constats_table_count ( char* cursor, uint64_t value )
+{
+	*cursor++ = ' ';
+	constats_format_field( value, cursor, CONSTATS_TABLE_CELL_WIDTH, CONSTATS_FORMAT_RIGHT );
+	return cursor + CONSTATS_TABLE_CELL_WIDTH;
+}
+
+/**
+ * This function formats a statistic into a cell, truncating it with a
+ * suffix if it is too wide.
+ */
+static inline
+char* constats_table_stat ( char* cursor, double value )
+{
+	char text[CONSTATS_FORMAT_MAX];
+	uint64_t length = constats_format_stat( value, text );
+
+	if ( length <= CONSTATS_TABLE_CELL_WIDTH )
+		return constats_table_cell( cursor, text, length );
+
+	*cursor++ = ' ';
+	constats_format_field( value, cursor, CONSTATS_TABLE_CELL_WIDTH, CONSTATS_FORMAT_RIGHT );
+	return cursor + CONSTATS_TABLE_CELL_WIDTH;
+}
+
+/**
+ * This function formats a sample into a cell like constats_table_stat,
+ * without passing it through a double.
+ */
+static inline
+char* constats_table_sample ( char* cursor, int64_t value )
+{
+	char text[CONSTATS_FORMAT_MAX];
+	uint64_t length = constats_format_sample( value, text );
+
+	if ( length <= CONSTATS_TABLE_CELL_WIDTH )
+		return constats_table_cell( cursor, text, length );
+
+	*cursor++ = ' ';
+	constats_format_field( value, cursor, CONSTATS_TABLE_CELL_WIDTH, CONSTATS_FORMAT_RIGHT );
+	return cursor + CONSTATS_TABLE_CELL_WIDTH;
+}
+
+/**
+ * This function formats the table into a newly allocated buffer, setting
+ * length to its size. The caller frees the buffer.
+ */
+static inline
+char* constats_table_render ( table_t* table, uint64_t* length )
+{
+	static const char* headers[CONSTATS_COLUMNS] = { "series", "N", "mean", "stdev", "p50", "p99", "max", "outliers" };
+	uint64_t name_width = 6;
+	uint64_t i;
+	int c;
+
+	for ( i = 0; i < table->count; ++i )
+	{
+		uint64_t width = strlen( table->rows[i].name );
+
+		if ( width > name_width )
+			name_width = width;
+	}
+
+	if ( name_width > CONSTATS_TABLE_NAME_WIDTH )
+		name_width = CONSTATS_TABLE_NAME_WIDTH;
+
+	uint64_t row_size = name_width + ( CONSTATS_COLUMNS - 1 ) * ( CONSTATS_TABLE_CELL_WIDTH + 1 ) + 1;
+	char* buffer = (char*) malloc( ( table->count + 1 ) * row_size );
+
+	if ( buffer == NULL )
+		return NULL;
+
+	char* cursor = buffer;
+
+	memset( cursor, ' ', name_width );
+	memcpy( cursor, headers[0], strlen( headers[0] ) );
+	cursor += name_width;
+
+	for ( c = 1; c < CONSTATS_COLUMNS; ++c )
+		cursor = constats_table_cell( cursor, headers[c], strlen( headers[c] ) );
+
+	*cursor++ = '\n';
+
+	for ( i = 0; i < table->count; ++i )
+	{
+		table_row_t* row = &table->rows[i];
+		uint64_t name_length = strlen( row->name );
+
+		if ( name_length > name_width )
+			name_length = name_width;
+
+		memcpy( cursor, row->name, name_length );
+		memset( cursor + name_length, ' ', name_width - name_length );
+		cursor += name_width;
+
+		cursor = constats_table_count( cursor, row->stat.N );
+		cursor = constats_table_stat( cursor, row->stat.mean );
+		cursor = constats_table_stat( cursor, row->stat.stdev );
+		cursor = constats_table_sample( cursor, row->p50 );
+		cursor = constats_table_sample( cursor, row->p99 );
+		cursor = constats_table_sample( cursor, row->stat.max );
+		cursor = constats_table_count( cursor, row->stat.outliers );
+		*cursor++ = '\n';
+	}
+
+	*length = cursor - buffer;
+	return buffer;
+}
+
+/**
+ * This function prints the table to the given file descriptor with a
+ * single write, repeated only if the descriptor takes a partial write.
+ */
+static inline
+int constats_table_print ( table_t* table, int fd )
+{
+	uint64_t length;
+	char* buffer = constats_table_render( table, &length );
+
+	if ( buffer == NULL )
+		return -1;
+
+	char* bytes = buffer;
+
+	while ( length > 0 )
+	{
+		ssize_t written = write( fd, bytes, length );
+
+		if ( written < 0 && errno == EINTR )
+			continue;
+
+		if ( written <= 0 )
+			break;
+
+		bytes  += written;
+		length -= written;
+	}
+
+	free( buffer );
+	return length == 0 ? 0 : -1;
+}
+
+#endif
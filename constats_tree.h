@@ -0,0 +1,556 @@
+/**
+ * @File     : constats_tree.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains hierarchical scope timing. CONSTATS_TREE_SCOPE( "name" )
+ * times the rest of the enclosing block like CONSTATS_SCOPE, but keeps a
+ * per-thread stack of open scopes so each pass is attributed to a node in
+ * a call tree. Every node accumulates its inclusive time, and its
+ * exclusive time, which leaves out the time spent in child scopes.
+ *
+ * Nodes keep sums of ticks taken about their first sample rather than a
+ * running mean, so recording adds and multiplies but never divides, and
+ * stays accurate far from zero. A scope costs two clock reads plus a few
+ * nanoseconds of bookkeeping; bench_tree prints both. Where a clock read
+ * is slow, as the TSC is under some hypervisors at ~20 ns, the reads
+ * alone exceed 20 ns per scope.
+ *
+ * Each thread owns its tree and records without atomics or locks. Nodes
+ * come from a per-thread pool allocated on the thread's first scope. When
+ * a thread exits its tree is kept, so its times are still printed, and is
+ * handed on to the next thread that opens its first scope. Memory grows
+ * with the most threads timing at once, not with every thread ever run.
+ * constats_tree_print_all merges the trees of every thread and prints
+ * the result, and should be called while the timed threads are quiet.
+ *
+ * Scopes rely on the cleanup attribute, so GCC or Clang is required.
+ * Defining CONSTATS_DISABLE turns CONSTATS_TREE_SCOPE into nothing.
+ */
+
+#ifndef CONSTATS_TREE_LIB_LOCK
+#define CONSTATS_TREE_LIB_LOCK
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_clock.h"
+#include "constats_recorder.h"
+
+#ifndef CONSTATS_TREE_MAX_DEPTH
+#define CONSTATS_TREE_MAX_DEPTH 64
+#endif
+
+#ifndef CONSTATS_TREE_MAX_NODES
+#define CONSTATS_TREE_MAX_NODES 4096
+#endif
+
+typedef struct tree_site_t
+{
+	const char* name;				// The name given to CONSTATS_TREE_SCOPE
+
+} tree_site_t;
+
+typedef struct tree_sums_t
+{
+	uint64_t N;						// The number of samples added
+	int64_t shift;					// The first sample, which the sums are taken about
+	int64_t sum;					// The sum of the samples less the shift
+	double sum_sq;					// The sum of the squares of the samples less the shift
+	int64_t min;					// The minimum sample
+	int64_t max;					// The maximum sample
+
+} tree_sums_t;
+
+typedef struct tree_node_t
+{
+	const tree_site_t* site;		// The call site of the node, NULL for the root
+	struct tree_node_t* parent;		// The enclosing node
+	struct tree_node_t* child;		// The first child node
+	struct tree_node_t* sibling;	// The next node with the same parent
+
+	tree_sums_t inclusive;			// Ticks spent in the scope
+	tree_sums_t exclusive;			// Ticks spent in the scope but not its children
+
+} tree_node_t;
+
+typedef struct tree_frame_t
+{
+	tree_node_t* node;				// The node of the open scope
+	uint64_t start;					// The tick count when the scope was entered
+	uint64_t child_ticks;			// The ticks spent in closed child scopes
+
+} tree_frame_t;
+
+typedef struct tree_thread_t
+{
+	tree_node_t* nodes;				// The node pool, nodes[0] is the root
+	uint64_t used;					// The number of pool nodes handed out
+	uint64_t overflow;				// Scopes not timed because a limit was hit
+
+	int depth;						// The index of the innermost open frame
+	tree_frame_t stack[CONSTATS_TREE_MAX_DEPTH];
+
+	int exited;						// Set once the owner exited, until another thread takes it
+	struct tree_thread_t* next;		// The next registered thread
+
+} tree_thread_t;
+
+typedef struct tree_scope_t
+{
+	tree_thread_t* thread;			// The thread that pushed a frame, NULL if none
+
+} tree_scope_t;
+
+// The list of threads that have opened a tree scope, newest first
+tree_thread_t* constats_tree_threads = NULL;
+
+// The calling thread's tree
+__thread tree_thread_t* constats_tree_self = NULL;
+
+// Releases a thread's tree when it exits
+pthread_key_t constats_tree_key;
+pthread_once_t constats_tree_key_once = PTHREAD_ONCE_INIT;
+
+#define CONSTATS_TREE_CONCAT_(a, b) a##b
+#define CONSTATS_TREE_CONCAT(a, b)  CONSTATS_TREE_CONCAT_(a, b)
+
+#ifdef CONSTATS_DISABLE
+
+#define CONSTATS_TREE_SCOPE(name)
+
+#else
+
+/**
+ * Times the rest of the enclosing block as a node of the calling thread's tree.
+ */
+#define CONSTATS_TREE_SCOPE(name)                                                          \
+	static const tree_site_t CONSTATS_TREE_CONCAT(constats_tree_site_, __LINE__) = { name }; \
+	static __thread tree_node_t* CONSTATS_TREE_CONCAT(constats_tree_cache_, __LINE__) = NULL; \
+	tree_scope_t CONSTATS_TREE_CONCAT(constats_tree_scope_, __LINE__)                       \
+		__attribute__((cleanup(constats_tree_exit))) =                                     \
+		constats_tree_enter( &CONSTATS_TREE_CONCAT(constats_tree_site_, __LINE__),         \
+		                     &CONSTATS_TREE_CONCAT(constats_tree_cache_, __LINE__) )
+
+#endif
+
+/**
+ * This function empties the sums.
+ */
+static inline
+void constats_tree_sums_init ( tree_sums_t* sums )
+{
+	sums->N      = 0;
+	sums->shift  = 0;
+	sums->sum    = 0;
+	sums->sum_sq = 0;
+	sums->min    = INF;
+	sums->max    = NINF;
+}
+
+/**
+ * This function adds one sample to the sums.
+ */
+static inline
+void constats_tree_sums_add ( tree_sums_t* sums, int64_t sample )
+{
+	if ( CONSTATS_UNLIKELY( sums->N == 0 ) )
+		sums->shift = sample;
+
+	int64_t delta = sample - sums->shift;
+
+	sums->N++;
+	sums->sum    += delta;
+	sums->sum_sq += (double) delta * (double) delta;
+
+	if ( sample < sums->min )
+		sums->min = sample;
+
+	if ( sample > sums->max )
+		sums->max = sample;
+}
+
+/**
+ * This function adds every sample in src to dst, moving src's sums onto
+ * dst's shift.
+ */
+static inline
+void constats_tree_sums_merge ( tree_sums_t* dst, const tree_sums_t* src )
+{
+	// Error Checking
+	if ( src->N == 0 )
+		return;
+
+	if ( dst->N == 0 )
+	{
+		*dst = *src;
+		return;
+	}
+
+	int64_t delta = src->shift - dst->shift;
+
+	dst->sum_sq += src->sum_sq + 2.0 * (double) delta * (double) src->sum
+	             + (double) delta * (double) delta * (double) src->N;
+	dst->sum    += src->sum + delta * (int64_t) src->N;
+	dst->N      += src->N;
+
+	if ( src->min < dst->min )
+		dst->min = src->min;
+
+	if ( src->max > dst->max )
+		dst->max = src->max;
+}
+
+/**
+ * This function converts the sums to an accumulator.
+ */
+static inline
+void constats_tree_sums_accumulator ( const tree_sums_t* sums, accumulator_t* acc )
+{
+	constats_accumulator_init( acc );
+
+	if ( sums->N == 0 )
+		return;
+
+	double offset = (double) sums->sum / (double) sums->N;
+	double m2     = sums->sum_sq - offset * (double) sums->sum;
+
+	acc->N    = sums->N;
+	acc->mean = sums->shift + offset;
+	acc->m2   = m2 > 0 ? m2 : 0;
+	acc->min  = sums->min;
+	acc->max  = sums->max;
+}
+
+/**
+ * This function runs as a thread exits, leaving its tree to the next
+ * thread that attaches.
+ */
+static inline
+void constats_tree_detach ( void* arg )
+{
+	tree_thread_t* self = (tree_thread_t*) arg;
+
+	// A later destructor that opens a scope attaches again
+	constats_tree_self = NULL;
+	__atomic_store_n( &self->exited, 1, __ATOMIC_RELEASE );
+}
+
+static inline
+void constats_tree_key_create ( void )
+{
+	pthread_key_create( &constats_tree_key, constats_tree_detach );
+}
+
+/**
+ * This function gives the calling thread the tree of an exited thread, or
+ * creates a new tree and registers it.
+ */
+static __attribute__((noinline))
+tree_thread_t* constats_tree_attach ( void )
+{
+	tree_thread_t* self;
+
+	pthread_once( &constats_tree_key_once, constats_tree_key_create );
+
+	for ( self = __atomic_load_n( &constats_tree_threads, __ATOMIC_ACQUIRE ); self != NULL; self = self->next )
+	{
+		int exited = 1;
+
+		if ( __atomic_load_n( &self->exited, __ATOMIC_RELAXED )
+		  && __atomic_compare_exchange_n( &self->exited, &exited, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+		{
+			self->depth = 0;
+			pthread_setspecific( constats_tree_key, self );
+			constats_tree_self = self;
+			return self;
+		}
+	}
+
+	self = (tree_thread_t*) calloc( 1, sizeof( tree_thread_t ) );
+
+	if ( self == NULL )
+		return NULL;
+
+	self->nodes = (tree_node_t*) calloc( CONSTATS_TREE_MAX_NODES, sizeof( tree_node_t ) );
+
+	if ( self->nodes == NULL )
+	{
+		free( self );
+		return NULL;
+	}
+
+	constats_tree_sums_init( &self->nodes[0].inclusive );
+	constats_tree_sums_init( &self->nodes[0].exclusive );
+
+	self->used          = 1;
+	self->stack[0].node = &self->nodes[0];
+
+	self->next = __atomic_load_n( &constats_tree_threads, __ATOMIC_RELAXED );
+
+	while ( !__atomic_compare_exchange_n( &constats_tree_threads, &self->next, self,
+	                                      1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+
+	pthread_setspecific( constats_tree_key, self );
+	constats_tree_self = self;
+	return self;
+}
+
+/**
+ * This function finds the child of parent for the given site, taking a
+ * node from the pool if this is the first time the site ran under parent.
+ */
+static __attribute__((noinline))
+tree_node_t* constats_tree_child ( tree_thread_t* self, tree_node_t* parent, const tree_site_t* site )
+{
+	tree_node_t* node;
+
+	for ( node = parent->child; node != NULL; node = node->sibling )
+		if ( node->site == site )
+			return node;
+
+	if ( self->used >= CONSTATS_TREE_MAX_NODES )
+		return NULL;
+
+	node = &self->nodes[self->used++];
+	node->site    = site;
+	node->parent  = parent;
+	node->sibling = parent->child;
+	parent->child = node;
+
+	constats_tree_sums_init( &node->inclusive );
+	constats_tree_sums_init( &node->exclusive );
+
+	return node;
+}
+
+/**
+ * This function opens a scope on the calling thread's stack. The cache
+ * remembers the node this site used last on this thread, which is the
+ * right one whenever the parent is unchanged.
+ */
+static inline
+tree_scope_t constats_tree_enter ( const tree_site_t* site, tree_node_t** cache )
+{
+	tree_scope_t scope;
+	register tree_thread_t* self = constats_tree_self;
+
+	scope.thread = NULL;
+
+	if ( CONSTATS_UNLIKELY( self == NULL ) && ( self = constats_tree_attach() ) == NULL )
+		return scope;
+
+	if ( CONSTATS_UNLIKELY( self->depth >= CONSTATS_TREE_MAX_DEPTH - 1 ) )
+	{
+		self->overflow++;
+		return scope;
+	}
+
+	register tree_frame_t* top = &self->stack[self->depth];
+	register tree_node_t* node = *cache;
+
+	if ( CONSTATS_UNLIKELY( node == NULL || node->parent != top->node ) )
+	{
+		node = constats_tree_child( self, top->node, site );
+
+		if ( node == NULL )
+		{
+			self->overflow++;
+			return scope;
+		}
+
+		*cache = node;
+	}
+
+	++top;
+	++self->depth;
+	top->node        = node;
+	top->child_ticks = 0;
+	top->start       = constats_clock_ticks();
+
+	scope.thread = self;
+	return scope;
+}
+
+/**
+ * This function closes the innermost scope, charging its time to the node
+ * and to the enclosing frame's child time.
+ */
+static inline
+void constats_tree_exit ( tree_scope_t* scope )
+{
+	uint64_t end = constats_clock_ticks();
+	register tree_thread_t* self = scope->thread;
+
+	if ( CONSTATS_UNLIKELY( self == NULL ) )
+		return;
+
+	register tree_frame_t* top = &self->stack[self->depth--];
+	uint64_t elapsed = end - top->start;
+
+	constats_tree_sums_add( &top->node->inclusive, elapsed );
+	constats_tree_sums_add( &top->node->exclusive, elapsed - top->child_ticks );
+
+	( top - 1 )->child_ticks += elapsed;
+}
+
+/**
+ * This function populates the stat data structure with a node's inclusive
+ * (or exclusive) time, converted from ticks to nanoseconds.
+ */
+static inline
+int constats_tree_calculate_stats ( const tree_node_t* node, int exclusive, stats_t* stat )
+{
+	accumulator_t acc;
+	constats_tree_sums_accumulator( exclusive ? &node->exclusive : &node->inclusive, &acc );
+
+	int error_code = constats_accumulator_calculate_stats( &acc, stat );
+
+	if ( error_code != 0 )
+		return error_code;
+
+	double ns_per_tick = constats_clock_ns_per_tick();
+
+	stat->mean  *= ns_per_tick;
+	stat->stdev *= ns_per_tick;
+	stat->min    = (int64_t) ( stat->min * ns_per_tick );
+	stat->max    = (int64_t) ( stat->max * ns_per_tick );
+
+	stat->norm_mean  = stat->mean;
+	stat->norm_stdev = stat->stdev;
+	stat->norm_min   = stat->min;
+	stat->norm_max   = stat->max;
+
+	return 0;
+}
+
+/**
+ * This function merges the children of src into dst, matching nodes by
+ * call site. New nodes are allocated with calloc.
+ */
+static inline
+int constats_tree_merge ( tree_node_t* dst, const tree_node_t* src )
+{
+	const tree_node_t* src_child;
+
+	for ( src_child = src->child; src_child != NULL; src_child = src_child->sibling )
+	{
+		tree_node_t* dst_child;
+
+		for ( dst_child = dst->child; dst_child != NULL; dst_child = dst_child->sibling )
+			if ( dst_child->site == src_child->site )
+				break;
+
+		if ( dst_child == NULL )
+		{
+			dst_child = (tree_node_t*) calloc( 1, sizeof( tree_node_t ) );
+
+			if ( dst_child == NULL )
+				return -1;
+
+			dst_child->site    = src_child->site;
+			dst_child->parent  = dst;
+			dst_child->sibling = dst->child;
+			dst->child         = dst_child;
+
+			constats_tree_sums_init( &dst_child->inclusive );
+			constats_tree_sums_init( &dst_child->exclusive );
+		}
+
+		constats_tree_sums_merge( &dst_child->inclusive, &src_child->inclusive );
+		constats_tree_sums_merge( &dst_child->exclusive, &src_child->exclusive );
+
+		if ( constats_tree_merge( dst_child, src_child ) != 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * This function frees the children of a merged tree.
+ */
+static inline
+void constats_tree_free ( tree_node_t* node )
+{
+	tree_node_t* child = node->child;
+
+	while ( child != NULL )
+	{
+		tree_node_t* sibling = child->sibling;
+		constats_tree_free( child );
+		free( child );
+		child = sibling;
+	}
+
+	node->child = NULL;
+}
+
+/**
+ * This function prints one line per node, children indented under their parent.
+ */
+static inline
+int constats_tree_print ( const tree_node_t* node, int depth )
+{
+	const tree_node_t* child;
+
+	for ( child = node->child; child != NULL; child = child->sibling )
+	{
+		stats_t incl;
+		stats_t excl;
+
+		if ( constats_tree_calculate_stats( child, 0, &incl ) != 0
+		  || constats_tree_calculate_stats( child, 1, &excl ) != 0 )
+			continue;
+
+		int indent = depth * 2 < 24 ? depth * 2 : 24;
+
+		printf ( "%*s%-*.*s %10lu %12.0f %12.0f %12.0f %12.0f\n", indent, "", 30 - indent, 30 - indent,
+		         child->site->name, incl.N, incl.mean, incl.stdev, excl.mean, excl.stdev );
+
+		constats_tree_print( child, depth + 1 );
+	}
+
+	return 0;
+}
+
+/**
+ * This function merges every thread's tree and prints it.
+ */
+static inline
+int constats_tree_print_all ( void )
+{
+	tree_node_t root;
+	tree_thread_t* thread;
+	uint64_t overflow = 0;
+
+	memset( &root, 0, sizeof( tree_node_t ) );
+
+	for ( thread = __atomic_load_n( &constats_tree_threads, __ATOMIC_ACQUIRE ); thread != NULL; thread = thread->next )
+	{
+		overflow += thread->overflow;
+
+		if ( constats_tree_merge( &root, &thread->nodes[0] ) != 0 )
+		{
+			constats_tree_free( &root );
+			return -1;
+		}
+	}
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+	printf ( "%-30s %10s %12s %12s %12s %12s\n", "Scope (ns)", "Calls", "Incl Mean", "Incl Stdev", "Excl Mean", "Excl Stdev" );
+	constats_tree_print( &root, 0 );
+
+	if ( overflow > 0 )
+		printf ( "Untimed Scopes         : %lu (raise CONSTATS_TREE_MAX_DEPTH or CONSTATS_TREE_MAX_NODES)\n", overflow );
+
+	printf ( "-------------------------------------------------------------------------------\n" );
+
+	constats_tree_free( &root );
+	return 0;
+}
+
+#endif
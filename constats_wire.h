@@ -0,0 +1,382 @@
+/**
+ * @File     : constats_wire.h
+ * @Author   : Abdullah Younis
+ *
+ * This library contains a compact, versioned binary encoding of
+ * accumulators and histograms, for moving partial aggregates between
+ * processes and files. Encodings are independent of the host's byte order
+ * and word size. They can be decoded into a caller-provided struct, or
+ * merged straight from the buffer into an existing aggregate, and neither
+ * path allocates. A buffer is fully validated before anything is merged,
+ * so a truncated or corrupt buffer leaves the destination untouched. A
+ * buffer must hold exactly one encoding: varints that overflow 64 bits,
+ * trailing bytes, and histograms whose buckets do not add up to N, or do
+ * not span min to max, are all rejected.
+ *
+ * Layout (varint = LEB128, zigzag = signed varint, f64 = little endian IEEE 754):
+ *   header      : 'C' 'S' version kind
+ *   accumulator : varint N, f64 mean, f64 m2, zigzag min, zigzag max
+ *   histogram   : u8 sub_bits, varint N, f64 mean, f64 m2, zigzag min,
+ *                 zigzag max, varint buckets, then per non-empty bucket
+ *                 varint gap from the previous bucket and varint count
+ */
+
+#ifndef CONSTATS_WIRE_LIB_LOCK
+#define CONSTATS_WIRE_LIB_LOCK
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_histogram.h"
+
+#define CONSTATS_WIRE_VERSION 2
+
+// Encoded kinds
+#define CONSTATS_WIRE_ACCUMULATOR 1
+#define CONSTATS_WIRE_HISTOGRAM   2
+
+#define CONSTATS_WIRE_HEADER_SIZE 4
+#define CONSTATS_WIRE_VARINT_MAX  10
+
+// The largest possible encodings
+#define CONSTATS_WIRE_ACCUMULATOR_MAX ( CONSTATS_WIRE_HEADER_SIZE + 3 * CONSTATS_WIRE_VARINT_MAX + 16 )
+#define CONSTATS_WIRE_HISTOGRAM_MAX   ( CONSTATS_WIRE_HEADER_SIZE + 1 + 4 * CONSTATS_WIRE_VARINT_MAX + 16 \
+                                      + 2 * CONSTATS_WIRE_VARINT_MAX * CONSTATS_HISTOGRAM_BUCKETS )
+
+typedef struct wire_t
+{
+	uint8_t* data;		// The buffer
+	uint64_t size;		// The size of the buffer
+	uint64_t pos;		// The next byte to read or write
+	int error;			// Set once the buffer ran out or held something invalid
+
+} wire_t;
+
+static inline
+void constats_wire_put_byte ( wire_t* wire, uint8_t byte )
+{
+	if ( wire->pos >= wire->size )
+	{
+		wire->error = 1;
+		return;
+	}
+
+	wire->data[wire->pos++] = byte;
+}
+
+static inline
+void constats_wire_put_varint ( wire_t* wire, uint64_t value )
+{
+	while ( value >= 0x80 )
+	{
+		constats_wire_put_byte( wire, (uint8_t) ( value | 0x80 ) );
+		value >>= 7;
+	}
+
+	constats_wire_put_byte( wire, (uint8_t) value );
+}
+
+static inline
+void constats_wire_put_zigzag ( wire_t* wire, int64_t value )
+{
+	constats_wire_put_varint( wire, ( (uint64_t) value << 1 ) ^ (uint64_t) ( value >> 63 ) );
+}
+
+static inline
+void constats_wire_put_double ( wire_t* wire, double value )
+{
+	uint64_t bits;
+	int i;
+
+	memcpy( &bits, &value, sizeof( bits ) );
+
+	for ( i = 0; i < 8; ++i )
+		constats_wire_put_byte( wire, (uint8_t) ( bits >> ( 8 * i ) ) );
+}
+
+static inline
+uint8_t constats_wire_get_byte ( wire_t* wire )
+{
+	if ( wire->pos >= wire->size )
+	{
+		wire->error = 1;
+		return 0;
+	}
+
+	return wire->data[wire->pos++];
+}
+
+static inline
+uint64_t constats_wire_get_varint ( wire_t* wire )
+{
+	uint64_t value = 0;
+	int shift;
+
+	for ( shift = 0; shift < 63; shift += 7 )
+	{
+		uint8_t byte = constats_wire_get_byte( wire );
+		value |= (uint64_t) ( byte & 0x7f ) << shift;
+
+		if ( !( byte & 0x80 ) )
+			return value;
+	}
+
+	// The tenth byte holds the last bit, anything more overflows
+	uint8_t byte = constats_wire_get_byte( wire );
+
+	if ( byte > 1 )
+	{
+		wire->error = 1;
+		return 0;
+	}
+
+	return value | (uint64_t) byte << 63;
+}
+
+static inline
+int64_t constats_wire_get_zigzag ( wire_t* wire )
+{
+	uint64_t value = constats_wire_get_varint( wire );
+	return (int64_t) ( value >> 1 ) ^ -(int64_t) ( value & 1 );
+}
+
+static inline
+double constats_wire_get_double ( wire_t* wire )
+{
+	uint64_t bits = 0;
+	double value;
+	int i;
+
+	for ( i = 0; i < 8; ++i )
+		bits |= (uint64_t) constats_wire_get_byte( wire ) << ( 8 * i );
+
+	memcpy( &value, &bits, sizeof( value ) );
+	return value;
+}
+
+static inline
+void constats_wire_put_header ( wire_t* wire, uint8_t kind )
+{
+	constats_wire_put_byte( wire, 'C' );
+	constats_wire_put_byte( wire, 'S' );
+	constats_wire_put_byte( wire, CONSTATS_WIRE_VERSION );
+	constats_wire_put_byte( wire, kind );
+}
+
+/**
+ * This function returns the kind of the encoding in the buffer, or -1 if
+ * it is not a supported constats encoding.
+ */
+static inline
+int constats_wire_kind ( const uint8_t* buffer, uint64_t size )
+{
+	if ( size < CONSTATS_WIRE_HEADER_SIZE || buffer[0] != 'C' || buffer[1] != 'S'
+	  || buffer[2] != CONSTATS_WIRE_VERSION )
+		return -1;
+
+	return buffer[3];
+}
+
+/**
+ * This function encodes an accumulator into buffer, setting length to the
+ * number of bytes used. CONSTATS_WIRE_ACCUMULATOR_MAX bytes always suffice.
+ */
+static inline
+int constats_wire_encode_accumulator ( const accumulator_t* acc, uint8_t* buffer, uint64_t size, uint64_t* length )
+{
+	wire_t wire = { buffer, size, 0, 0 };
+
+	constats_wire_put_header( &wire, CONSTATS_WIRE_ACCUMULATOR );
+	constats_wire_put_varint( &wire, acc->N );
+	constats_wire_put_double( &wire, acc->mean );
+	constats_wire_put_double( &wire, acc->m2 );
+	constats_wire_put_zigzag( &wire, acc->min );
+	constats_wire_put_zigzag( &wire, acc->max );
+
+	*length = wire.pos;
+	return wire.error ? -1 : 0;
+}
+
+/**
+ * This function adds the accumulator encoded in buffer to dst. Like a
+ * histogram, an accumulator from elsewhere is checked before it is merged:
+ * the moments must be finite, m2 not negative, and min no more than max
+ * unless it is empty.
+ */
+static inline
+int constats_wire_merge_accumulator ( accumulator_t* dst, const uint8_t* buffer, uint64_t size )
+{
+	wire_t wire = { (uint8_t*) buffer, size, CONSTATS_WIRE_HEADER_SIZE, 0 };
+	accumulator_t src;
+
+	if ( constats_wire_kind( buffer, size ) != CONSTATS_WIRE_ACCUMULATOR )
+		return -1;
+
+	src.N      = constats_wire_get_varint( &wire );
+	src.mean   = constats_wire_get_double( &wire );
+	src.m2     = constats_wire_get_double( &wire );
+	src.min    = constats_wire_get_zigzag( &wire );
+	src.max    = constats_wire_get_zigzag( &wire );
+
+	if ( wire.error || wire.pos != size || !isfinite( src.mean ) || !isfinite( src.m2 ) || src.m2 < 0
+	  || ( src.N > 0 && src.min > src.max ) )
+		return -1;
+
+	constats_accumulator_merge( dst, &src );
+	return 0;
+}
+
+/**
+ * This function decodes the accumulator encoded in buffer.
+ */
+static inline
+int constats_wire_decode_accumulator ( accumulator_t* acc, const uint8_t* buffer, uint64_t size )
+{
+	constats_accumulator_init( acc );
+	return constats_wire_merge_accumulator( acc, buffer, size );
+}
+
+/**
+ * This function encodes a histogram into buffer, setting length to the
+ * number of bytes used. Only non-empty buckets are written, so typical
+ * encodings are a few hundred bytes; CONSTATS_WIRE_HISTOGRAM_MAX always suffices.
+ */
+static inline
+int constats_wire_encode_histogram ( const histogram_t* hist, uint8_t* buffer, uint64_t size, uint64_t* length )
+{
+	wire_t wire = { buffer, size, 0, 0 };
+	register uint64_t i;
+	uint64_t buckets = 0;
+	uint64_t next = 0;
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS; ++i )
+		buckets += hist->counts[i] != 0;
+
+	constats_wire_put_header( &wire, CONSTATS_WIRE_HISTOGRAM );
+	constats_wire_put_byte( &wire, CONSTATS_HISTOGRAM_SUB_BITS );
+	constats_wire_put_varint( &wire, hist->N );
+	constats_wire_put_double( &wire, hist->mean );
+	constats_wire_put_double( &wire, hist->m2 );
+	constats_wire_put_zigzag( &wire, hist->min );
+	constats_wire_put_zigzag( &wire, hist->max );
+	constats_wire_put_varint( &wire, buckets );
+
+	for ( i = 0; i < CONSTATS_HISTOGRAM_BUCKETS && !wire.error; ++i )
+	{
+		if ( hist->counts[i] == 0 )
+			continue;
+
+		constats_wire_put_varint( &wire, i - next );
+		constats_wire_put_varint( &wire, hist->counts[i] );
+		next = i + 1;
+	}
+
+	*length = wire.pos;
+	return wire.error ? -1 : 0;
+}
+
+/**
+ * This function checks the buckets of an encoded histogram against the N,
+ * min and max encoded before them. It returns -1 if they disagree.
+ */
+static inline
+int constats_wire_check_buckets ( wire_t* wire, uint64_t buckets, uint64_t N, int64_t min, int64_t max )
+{
+	uint64_t index = 0;
+	uint64_t total = 0;
+	uint64_t first = 0;
+	uint64_t i;
+
+	for ( i = 0; i < buckets && !wire->error; ++i )
+	{
+		uint64_t gap   = constats_wire_get_varint( wire );
+		uint64_t count = constats_wire_get_varint( wire );
+
+		if ( gap >= CONSTATS_HISTOGRAM_BUCKETS - index || count == 0 || count > UINT64_MAX - total )
+			return -1;
+
+		index += gap;
+		total += count;
+
+		if ( i == 0 )
+			first = index;
+
+		index++;
+	}
+
+	if ( wire->error || total != N )
+		return -1;
+
+	if ( N == 0 )
+		return 0;
+
+	// index is one past the last bucket
+	if ( min < 0 || min > max || constats_histogram_index( min ) != first || constats_histogram_index( max ) != index - 1 )
+		return -1;
+
+	return 0;
+}
+
+/**
+ * This function adds the buckets of an encoded histogram to dst. The
+ * buckets must already have passed constats_wire_check_buckets.
+ */
+static inline
+void constats_wire_walk_buckets ( wire_t* wire, uint64_t buckets, histogram_t* dst )
+{
+	uint64_t index = 0;
+	uint64_t i;
+
+	for ( i = 0; i < buckets; ++i )
+	{
+		index += constats_wire_get_varint( wire );
+		dst->counts[index++] += constats_wire_get_varint( wire );
+	}
+}
+
+/**
+ * This function adds the histogram encoded in buffer to dst.
+ */
+static inline
+int constats_wire_merge_histogram ( histogram_t* dst, const uint8_t* buffer, uint64_t size )
+{
+	wire_t wire = { (uint8_t*) buffer, size, CONSTATS_WIRE_HEADER_SIZE, 0 };
+
+	if ( constats_wire_kind( buffer, size ) != CONSTATS_WIRE_HISTOGRAM
+	  || constats_wire_get_byte( &wire ) != CONSTATS_HISTOGRAM_SUB_BITS )
+		return -1;
+
+	uint64_t N     = constats_wire_get_varint( &wire );
+	double mean    = constats_wire_get_double( &wire );
+	double m2      = constats_wire_get_double( &wire );
+	int64_t min    = constats_wire_get_zigzag( &wire );
+	int64_t max    = constats_wire_get_zigzag( &wire );
+	uint64_t count = constats_wire_get_varint( &wire );
+	uint64_t start = wire.pos;
+
+	// Validate every bucket before touching dst
+	if ( wire.error || !isfinite( mean ) || !isfinite( m2 ) || m2 < 0
+	  || constats_wire_check_buckets( &wire, count, N, min, max ) != 0 || wire.pos != size )
+		return -1;
+
+	wire.pos = start;
+	constats_wire_walk_buckets( &wire, count, dst );
+	constats_histogram_merge_moments( dst, N, mean, m2, min, max );
+
+	return 0;
+}
+
+/**
+ * This function decodes the histogram encoded in buffer.
+ */
+static inline
+int constats_wire_decode_histogram ( histogram_t* hist, const uint8_t* buffer, uint64_t size )
+{
+	constats_histogram_init( hist );
+	return constats_wire_merge_histogram( hist, buffer, size );
+}
+
+#endif
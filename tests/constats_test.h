@@ -0,0 +1,28 @@
+/**
+ * @File     : constats_test.h
+ * @Author   : Abdullah Younis
+ *
+ * This file contains the checks the tests are written with. A test is a
+ * program that returns nonzero when any check failed.
+ */
+
+#ifndef CONSTATS_TEST_LIB_LOCK
+#define CONSTATS_TEST_LIB_LOCK
+
+#include <stdio.h>
+
+static int constats_test_failures = 0;
+
+#define CHECK(x) \
+	do \
+	{ \
+		if ( !(x) ) \
+		{ \
+			fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+			constats_test_failures++; \
+		} \
+	} while ( 0 )
+
+#define TEST_RESULT() ( constats_test_failures == 0 ? 0 : 1 )
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * @File     : test_accumulator.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the streaming accumulator against the batch statistics,
+ * including samples far from zero, merges and wire round trips.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "constats.h"
+#include "constats_accumulator.h"
+#include "constats_wire.h"
+#include "constats_test.h"
+
+#define SAMPLES 100000
+#define PARTS   7
+
+int64_t samples[SAMPLES];
+
+static int close_to ( double a, double b )
+{
+	return fabs( a - b ) <= 1e-6 * fabs( b );
+}
+
+int main ( void )
+{
+	accumulator_t whole, parts[PARTS], merged, decoded;
+	uint8_t buffer[CONSTATS_WIRE_ACCUMULATOR_MAX];
+	uint64_t length;
+	stats_t batch, stat;
+	uint64_t i;
+
+	// 1e9 plus or minus 10, where a sum of squares loses every digit
+	srand( 1 );
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = 1000000000 + rand() % 21 - 10;
+
+	constats_accumulator_init( &whole );
+	for ( i = 0; i < PARTS; ++i )
+		constats_accumulator_init( &parts[i] );
+
+	for ( i = 0; i < SAMPLES; ++i )
+	{
+		constats_accumulator_add( &whole, samples[i] );
+		constats_accumulator_add( &parts[i * PARTS / SAMPLES], samples[i] );
+	}
+
+	CHECK( constats_calculate_stats( samples, SAMPLES, &batch ) == 0 );
+	CHECK( constats_accumulator_calculate_stats( &whole, &stat ) == 0 );
+	CHECK( stat.N == SAMPLES );
+	CHECK( close_to( stat.mean, batch.mean ) );
+	CHECK( close_to( stat.stdev, batch.stdev ) );
+	CHECK( batch.stdev > 6 && batch.stdev < 6.1 );
+	CHECK( stat.min == batch.min && stat.max == batch.max );
+
+	// Merged out of order, through an empty accumulator and the wire
+	constats_accumulator_init( &merged );
+	for ( i = PARTS; i-- > 0; )
+	{
+		CHECK( constats_wire_encode_accumulator( &parts[i], buffer, sizeof( buffer ), &length ) == 0 );
+		CHECK( constats_wire_merge_accumulator( &merged, buffer, length ) == 0 );
+	}
+
+	CHECK( constats_accumulator_calculate_stats( &merged, &stat ) == 0 );
+	CHECK( stat.N == SAMPLES );
+	CHECK( close_to( stat.mean, batch.mean ) );
+	CHECK( close_to( stat.stdev, batch.stdev ) );
+	CHECK( stat.min == batch.min && stat.max == batch.max );
+
+	CHECK( constats_wire_encode_accumulator( &whole, buffer, sizeof( buffer ), &length ) == 0 );
+	CHECK( constats_wire_decode_accumulator( &decoded, buffer, length ) == 0 );
+	CHECK( decoded.N == whole.N && decoded.mean == whole.mean && decoded.m2 == whole.m2 );
+	CHECK( decoded.min == whole.min && decoded.max == whole.max );
+
+	// An empty accumulator merges as nothing, both ways
+	constats_accumulator_init( &merged );
+	constats_accumulator_merge( &merged, &whole );
+	constats_accumulator_init( &decoded );
+	constats_accumulator_merge( &merged, &decoded );
+	CHECK( merged.N == whole.N && merged.mean == whole.mean && merged.m2 == whole.m2 );
+	CHECK( constats_accumulator_calculate_stats( &decoded, &stat ) == -1 );
+
+	return TEST_RESULT();
+}
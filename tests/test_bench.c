@@ -0,0 +1,69 @@
+/**
+ * @File     : test_bench.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the thread-scalability sweep, including a sweep whose
+ * threads cannot be started.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Every thread creation goes through create_thread, which fails on demand
+static int create_thread ( pthread_t* thread, const pthread_attr_t* attr, void* (*fn)( void* ), void* arg );
+#define CONSTATS_BENCH_THREAD_CREATE create_thread
+
+#include "constats_bench.h"
+#include "constats_test.h"
+
+#define THREADS    3
+#define ITERATIONS 1000
+
+// The number of threads that may start before creation fails, -1 for no limit
+static int allowed = -1;
+
+static int create_thread ( pthread_t* thread, const pthread_attr_t* attr, void* (*fn)( void* ), void* arg )
+{
+	if ( allowed == 0 )
+		return -1;
+
+	if ( allowed > 0 )
+		--allowed;
+
+	return pthread_create( thread, attr, fn, arg );
+}
+
+uint64_t sink;
+
+static void work ( void* arg )
+{
+	(void) arg;
+	__atomic_fetch_add( &sink, 1, __ATOMIC_RELAXED );
+}
+
+int main ( void )
+{
+	scaling_point_t points[THREADS];
+	int i;
+
+	CHECK( constats_bench_scaling( work, NULL, ITERATIONS, THREADS, points ) == 0 );
+
+	for ( i = 0; i < THREADS; ++i )
+	{
+		CHECK( points[i].threads == i + 1 );
+		CHECK( points[i].stats.N == (uint64_t) ( i + 1 ) * ITERATIONS );
+		CHECK( points[i].seconds > 0 && points[i].throughput > 0 );
+	}
+
+	CHECK( points[0].efficiency == 1 );
+
+	CHECK( sink == 6 * ITERATIONS );
+
+	// The 1 and 2 thread runs start 3 threads, the third thread of the
+	// 3 thread run fails, and the two already waiting must be released
+	allowed = 4;
+	CHECK( constats_bench_scaling( work, NULL, ITERATIONS, THREADS, points ) == -1 );
+	CHECK( allowed == 0 );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,95 @@
+/**
+ * @File     : test_checkpoint.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that checkpoints and file backed recorders survive a
+ * reopen, and that opening refuses files it did not set up instead of
+ * overwriting them.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "constats_checkpoint.h"
+#include "constats_test.h"
+
+static const char foreign[] = "not a checkpoint, and not to be overwritten\n";
+
+static void write_file ( const char* path, const void* data, uint64_t size )
+{
+	FILE* file = fopen( path, "w" );
+	fwrite( data, 1, size, file );
+	fclose( file );
+}
+
+static int file_holds ( const char* path, const void* data, uint64_t size )
+{
+	char buffer[256];
+	FILE* file = fopen( path, "r" );
+	uint64_t got = fread( buffer, 1, sizeof( buffer ), file );
+
+	fclose( file );
+	return got == size && memcmp( buffer, data, size ) == 0;
+}
+
+int main ( void )
+{
+	char path[64];
+	checkpoint_t cp;
+	accumulator_t acc, restored;
+	recorder_t recorder;
+	static char zeros[8192];
+	int i;
+
+	snprintf ( path, sizeof( path ), "/tmp/constats_test_%d.ckpt", (int) getpid() );
+
+	// A foreign file is refused and left as it was
+	write_file( path, foreign, sizeof( foreign ) );
+	CHECK( constats_checkpoint_open( &cp, path, CONSTATS_WIRE_ACCUMULATOR_MAX, 0 ) == -1 );
+	CHECK( constats_checkpoint_recorder_open( &recorder, path, 100, 0 ) == -1 );
+	CHECK( file_holds( path, foreign, sizeof( foreign ) ) );
+
+	// An empty file is set up, and a checkpoint survives a reopen
+	write_file( path, "", 0 );
+	CHECK( constats_checkpoint_open( &cp, path, CONSTATS_WIRE_ACCUMULATOR_MAX, 0 ) == 0 );
+	CHECK( cp.header->page_size == constats_recorder_page_size() );
+
+	constats_accumulator_init( &acc );
+	constats_accumulator_init( &restored );
+	for ( i = 0; i < 10; ++i )
+		constats_accumulator_add( &acc, 1000000000 + i );
+
+	CHECK( constats_checkpoint_save_accumulator( &cp, &acc ) == 0 );
+	CHECK( constats_checkpoint_close( &cp ) == 0 );
+
+	CHECK( constats_checkpoint_open( &cp, path, 1, 0 ) == 0 );
+	CHECK( constats_checkpoint_restore_accumulator( &cp, &restored ) == 0 );
+	CHECK( restored.N == acc.N && restored.mean == acc.mean && restored.m2 == acc.m2 );
+	CHECK( constats_checkpoint_close( &cp ) == 0 );
+
+	// A checkpoint is not a recording
+	CHECK( constats_checkpoint_recorder_open( &recorder, path, 100, 0 ) == -1 );
+	unlink( path );
+
+	// A recording resumes, and only at its own capacity
+	CHECK( constats_checkpoint_recorder_open( &recorder, path, 100, 0 ) == 0 );
+	for ( i = 0; i < 10; ++i )
+		constats_recorder_record( &recorder, i );
+
+	CHECK( constats_checkpoint_recorder_close( &recorder, 0 ) == 0 );
+	CHECK( constats_checkpoint_recorder_open( &recorder, path, 200, 0 ) == -1 );
+	CHECK( constats_checkpoint_open( &cp, path, 1, 0 ) == -1 );
+	CHECK( constats_checkpoint_recorder_open( &recorder, path, 100, 0 ) == 0 );
+	CHECK( constats_recorder_size( &recorder ) == 10 && recorder.samples[9] == 9 );
+	CHECK( constats_checkpoint_recorder_close( &recorder, 0 ) == 0 );
+
+	// A zeroed header is a set up that never finished
+	write_file( path, zeros, sizeof( zeros ) );
+	CHECK( constats_checkpoint_recorder_open( &recorder, path, 100, 0 ) == 0 );
+	CHECK( constats_recorder_size( &recorder ) == 0 );
+	CHECK( constats_checkpoint_recorder_close( &recorder, 0 ) == 0 );
+
+	unlink( path );
+	return TEST_RESULT();
+}
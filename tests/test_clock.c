@@ -0,0 +1,70 @@
+/**
+ * @File     : test_clock.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that subtracting overhead calibrates before main, that
+ * threads racing the first calibration all see a finished one, and the
+ * overhead subtraction and near-resolution count it feeds.
+ */
+
+#define CONSTATS_SUBTRACT_OVERHEAD
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constats_clock.h"
+#include "constats_test.h"
+
+#define THREADS 4
+
+static void* read_calibration ( void* arg )
+{
+	clock_calibration_t* cal = constats_clock_calibration( CONSTATS_CLOCK_MONOTONIC );
+	*(int*) arg = cal->available && cal->overhead_ns > 0 && cal->resolution_ns > 0;
+	return NULL;
+}
+
+int main ( void )
+{
+	pthread_t threads[THREADS];
+	int complete[THREADS];
+	clock_calibration_t cal;
+	int i;
+
+	// The calibration ran at startup, so asking for it is cheap
+	uint64_t start  = constats_clock_ns();
+	double overhead = constats_clock_subtracted_ns();
+	CHECK( constats_clock_ns() - start < 1000000 );
+	CHECK( overhead == constats_clock_calibration( CONSTATS_CLOCK_TICKS )->overhead_ns );
+
+	for ( i = 0; i < THREADS; ++i )
+		pthread_create( &threads[i], NULL, read_calibration, &complete[i] );
+
+	for ( i = 0; i < THREADS; ++i )
+	{
+		pthread_join( threads[i], NULL );
+		CHECK( complete[i] );
+	}
+
+	CHECK( constats_clock_calibrate( CONSTATS_CLOCK_SOURCES, &cal ) == -1 );
+	CHECK( constats_clock_calibrate( CONSTATS_CLOCK_MONOTONIC, NULL ) == -1 );
+	CHECK( constats_clock_calibrate( CONSTATS_CLOCK_TICKS, &cal ) == 0 );
+	CHECK( strcmp( cal.name, "ticks" ) == 0 );
+	CHECK( cal.available && cal.overhead_ns > 0 && cal.resolution_ns > 0 );
+
+	// Subtracting the overhead never goes below 0
+	int64_t samples[] = { 5, 10, 15, -3, 1000 };
+	constats_clock_subtract_overhead( samples, 5, 10 );
+	CHECK( samples[0] == 0 && samples[1] == 0 && samples[2] == 5 && samples[3] == 0 && samples[4] == 990 );
+
+	CHECK( constats_clock_elapsed_ns( 10, 1.0, 20 ) == 0 );
+	CHECK( constats_clock_elapsed_ns( 100, 2.0, 50 ) == 150 );
+
+	// Only samples under CONSTATS_RESOLUTION_FACTOR steps are flagged
+	double limit = CONSTATS_RESOLUTION_FACTOR * constats_clock_calibration( CONSTATS_CLOCK_MONOTONIC )->resolution_ns;
+	int64_t durations[] = { 0, (int64_t) ( limit / 2 ), (int64_t) limit + 1, 1000000000000 };
+	CHECK( constats_clock_count_near_resolution( durations, 4, CONSTATS_CLOCK_MONOTONIC ) == 2 );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+/**
+ * @File     : test_cpp.cpp
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the C++ interface: serial policies and spans give the
+ * C routine's result bit for bit, and parallel policies on a pool with
+ * several workers agree with it to the last few bits. Forward ranges are
+ * walked in place with the same result, and input ranges stream through
+ * the accumulator without losing digits far from zero.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <ranges>
+#include <sstream>
+#include <vector>
+
+#include "constats.hpp"
+
+#if defined( __GNUC__ )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wregister"
+#endif
+
+#include "constats_test.h"
+
+#if defined( __GNUC__ )
+#pragma GCC diagnostic pop
+#endif
+
+static bool identical ( const stats_t& a, const stats_t& b )
+{
+	return std::memcmp( &a, &b, sizeof( stats_t ) ) == 0;
+}
+
+static bool close_to ( double a, double b )
+{
+	return std::fabs( a - b ) <= 1e-9 * std::fabs( b ) + 1e-9;
+}
+
+static bool agrees ( const stats_t& a, const stats_t& b )
+{
+	return a.N == b.N && a.min == b.min && a.max == b.max && a.outliers == b.outliers
+	    && a.tolerance == b.tolerance && a.norm_min == b.norm_min && a.norm_max == b.norm_max
+	    && close_to( a.mean, b.mean ) && close_to( a.stdev, b.stdev ) && close_to( a.abdev, b.abdev )
+	    && close_to( a.norm_mean, b.norm_mean ) && close_to( a.norm_stdev, b.norm_stdev )
+	    && close_to( a.norm_abdev, b.norm_abdev );
+}
+
+int main ( void )
+{
+	std::vector<int64_t> samples( 1 << 21 );
+	stats_t expected = {};
+	pool_t pool;
+
+	std::srand( 5 );
+	for ( auto& sample : samples )
+		sample = 1000000000 + std::rand() % 1000 - ( std::rand() % 1000 == 0 ? 100000 : 0 );
+
+	CHECK( constats_calculate_stats( samples.data(), samples.size(), &expected ) == 0 );
+
+	CHECK( identical( constats::calculate_stats( samples ), expected ) );
+	CHECK( identical( constats::calculate_stats( std::execution::seq, samples ), expected ) );
+	CHECK( identical( constats::calculate_stats( std::execution::unseq, samples ), expected ) );
+
+	// Above the parallel threshold, on three workers besides this thread
+	CHECK( constats_pool_create( &pool, 3 ) == 0 );
+	CHECK( constats_pool_threads( &pool ) == 4 );
+	CHECK( samples.size() >= 4 * CONSTATS_PARALLEL_THRESHOLD );
+
+	for ( int round = 0; round < 10; ++round )
+	{
+		stats_t par       = constats::calculate_stats( std::execution::par, samples, &pool );
+		stats_t par_unseq = constats::calculate_stats( std::execution::par_unseq, samples, &pool );
+
+		CHECK( agrees( par, expected ) );
+		CHECK( agrees( par_unseq, expected ) );
+		CHECK( identical( par, par_unseq ) );
+	}
+
+	CHECK( constats_pool_destroy( &pool ) == 0 );
+
+	stats_t empty = constats::calculate_stats( std::execution::par, std::vector<int64_t>() );
+	CHECK( empty.N == 0 );
+
+	// Forward ranges that are not int64_t spans take the range passes
+	std::vector<int32_t> narrow( 100000 );
+	std::vector<int64_t> wide, filtered;
+
+	for ( auto& sample : narrow )
+		sample = std::rand() % 100000 - ( std::rand() % 100 == 0 ? 10000000 : 0 );
+
+	wide.assign( narrow.begin(), narrow.end() );
+	auto odd = [] ( int64_t sample ) { return sample % 2 != 0; };
+
+	for ( int64_t sample : wide )
+		if ( odd( sample ) )
+			filtered.push_back( sample );
+
+	CHECK( constats_calculate_stats( wide.data(), wide.size(), &expected ) == 0 );
+	CHECK( identical( constats::calculate_stats( narrow ), expected ) );
+	CHECK( identical( constats::calculate_stats( wide | std::views::transform( [] ( int64_t x ) { return x; } ) ), expected ) );
+
+	CHECK( constats_calculate_stats( filtered.data(), filtered.size(), &expected ) == 0 );
+	CHECK( identical( constats::calculate_stats( wide | std::views::filter( odd ) ), expected ) );
+
+	// An input range of 1e9 plus or minus 10, read once
+	std::stringstream text;
+	wide.clear();
+
+	for ( int i = 0; i < 100000; ++i )
+	{
+		wide.push_back( 1000000000 + std::rand() % 21 - 10 );
+		text << wide.back() << ' ';
+	}
+
+	CHECK( constats_calculate_stats( wide.data(), wide.size(), &expected ) == 0 );
+	stats_t streamed = constats::calculate_stats( std::views::istream<int64_t>( text ) );
+
+	CHECK( streamed.N == expected.N && streamed.min == expected.min && streamed.max == expected.max );
+	CHECK( std::fabs( streamed.mean - expected.mean ) <= 1e-6 * expected.mean );
+	CHECK( std::fabs( streamed.stdev - expected.stdev ) <= 1e-6 * expected.stdev );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,118 @@
+/**
+ * @File     : test_daemon.c
+ * @Author   : Abdullah Younis
+ *
+ * This file runs the aggregation daemon given on the command line and
+ * checks that valid batches and histograms are merged, an inconsistent
+ * histogram, a query with a payload and unknown or daemon-only message
+ * types are refused, a client leaving mid-query is survived, and the
+ * daemon's own user can shut it down.
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+#include "constats_daemon.h"
+#include "constats_test.h"
+
+histogram_t hist;
+
+// Sends a message the daemon must refuse and checks that it hung up
+static int refused ( const char* path, uint32_t type, const void* payload, uint64_t length )
+{
+	char byte;
+	int fd = constats_daemon_connect( path );
+
+	if ( fd < 0 )
+		return 0;
+
+	// The daemon may hang up before the payload is sent, and hanging up on
+	// unread payload resets the connection instead of ending it
+	int closed = constats_daemon_send( fd, type, payload, length ) != 0 || read( fd, &byte, 1 ) <= 0;
+	close( fd );
+	return closed;
+}
+
+int main ( int argc, char** argv )
+{
+	char path[64];
+	int64_t samples[100];
+	stats_t stat;
+	char byte;
+	int status;
+	int fd = -1;
+	int i;
+
+	if ( argc < 2 )
+		return 1;
+
+	snprintf ( path, sizeof( path ), "/tmp/constats_test_%d.sock", (int) getpid() );
+
+	pid_t daemon = fork();
+
+	if ( daemon == 0 )
+	{
+		execl( argv[1], argv[1], path, (char*) NULL );
+		_exit( 127 );
+	}
+
+	// Writes to a connection the daemon refused must fail, not kill the test
+	signal( SIGPIPE, SIG_IGN );
+
+	for ( i = 0; i < 500 && ( fd = constats_daemon_connect( path ) ) < 0; ++i )
+		usleep( 10000 );
+
+	CHECK( fd >= 0 );
+
+	if ( fd < 0 )
+	{
+		kill( daemon, SIGKILL );
+		return TEST_RESULT();
+	}
+
+	for ( i = 0; i < 100; ++i )
+		samples[i] = i + 1;
+
+	CHECK( constats_daemon_send_samples( fd, samples, 100 ) == 0 );
+	CHECK( constats_daemon_query( fd, &stat, NULL ) == 0 && stat.N == 100 );
+
+	// A histogram whose buckets do not add up to N closes its connection
+	constats_histogram_init( &hist );
+	for ( i = 0; i < 10; ++i )
+		constats_histogram_record( &hist, 1000 + i );
+
+	hist.N++;
+	int bad = constats_daemon_connect( path );
+	CHECK( constats_daemon_send_histogram( bad, &hist ) == 0 );
+	CHECK( read( bad, &byte, 1 ) == 0 );
+	close( bad );
+
+	CHECK( constats_daemon_query( fd, &stat, NULL ) == 0 && stat.N == 100 );
+
+	// A query's payload would be read as the next message
+	CHECK( refused( path, CONSTATS_MSG_QUERY, samples, sizeof( daemon_msg_t ) ) );
+	CHECK( refused( path, CONSTATS_MSG_STATS, samples, 8 ) );
+	CHECK( refused( path, 0, NULL, 0 ) );
+	CHECK( refused( path, 99, samples, 8 ) );
+
+	CHECK( constats_daemon_query( fd, &stat, NULL ) == 0 && stat.N == 100 );
+
+	// A client leaving before its answer does not take the daemon with it
+	int gone = constats_daemon_connect( path );
+	CHECK( constats_daemon_send( gone, CONSTATS_MSG_QUERY, NULL, 0 ) == 0 );
+	close( gone );
+
+	CHECK( constats_daemon_query( fd, &stat, NULL ) == 0 && stat.N == 100 );
+
+	hist.N--;
+	CHECK( constats_daemon_send_histogram( fd, &hist ) == 0 );
+	CHECK( constats_daemon_query( fd, &stat, NULL ) == 0 && stat.N == 110 && stat.max == 1009 );
+
+	CHECK( constats_daemon_send( fd, CONSTATS_MSG_SHUTDOWN, NULL, 0 ) == 0 );
+	CHECK( waitpid( daemon, &status, 0 ) == daemon && WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+	close( fd );
+
+	return TEST_RESULT();
+}
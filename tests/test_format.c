@@ -0,0 +1,205 @@
+/**
+ * @File     : test_format.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that constats_format_double prints the digits printf's
+ * "%.*f" prints, including values on and next to decimal ties, and that
+ * units scale and round up into the next step. It also checks fixed width
+ * fields against a plain reference at every width, and the '#' fill of
+ * columns whose fields are too narrow.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_test.h"
+
+static int matches_printf ( double value, int precision )
+{
+	char expected[400];
+	char formatted[CONSTATS_FORMAT_MAX];
+
+	snprintf( expected, sizeof( expected ), "%.*f", precision, value );
+	uint64_t length = constats_format_double( value, formatted, precision, CONSTATS_UNIT_NONE );
+
+	if ( length == strlen( expected ) && strcmp( formatted, expected ) == 0 )
+		return 1;
+
+	fprintf( stderr, "%.17g at %d: \"%s\", printf gives \"%s\"\n", value, precision, formatted, expected );
+	return 0;
+}
+
+static int formats_as ( double value, int precision, int unit, const char* expected )
+{
+	char formatted[CONSTATS_FORMAT_MAX];
+
+	return constats_format_double( value, formatted, precision, unit ) == strlen( expected )
+	    && strcmp( formatted, expected ) == 0;
+}
+
+/**
+ * This function formats a field the slow way: the printf digits, cut three
+ * at a time until they fit beside a suffix, left aligned.
+ */
+static int reference_field ( int64_t value, char* buf, uint64_t width )
+{
+	static const char suffixes[] = "KMGTPE";
+	char digits[32];
+	uint64_t dropped;
+
+	uint64_t sign   = value < 0;
+	uint64_t length = snprintf( digits, sizeof( digits ), "%" PRId64, value ) - sign;
+
+	for ( dropped = 0; dropped < length; dropped += 3 )
+	{
+		uint64_t used = sign + length - dropped + ( dropped > 0 );
+
+		if ( used > width )
+			continue;
+
+		memset( buf, ' ', width );
+		memcpy( buf, digits, sign + length - dropped );
+
+		if ( dropped > 0 )
+			buf[used - 1] = suffixes[dropped / 3 - 1];
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static int field_matches ( int64_t value, uint64_t width )
+{
+	char expected[32];
+	char field[32];
+	char right[32];
+	char truncated[32];
+
+	int expected_code = reference_field( value, expected, width );
+
+	if ( constats_format_field( value, field, width, 0 ) != expected_code
+	  || constats_format_field( value, right, width, CONSTATS_FORMAT_RIGHT ) != expected_code
+	  || constats_truncate( value, truncated, width ) != expected_code )
+		return 0;
+
+	if ( expected_code != 0 )
+		return 1;
+
+	// The right aligned field is the left aligned one with its padding moved
+	uint64_t used = width;
+
+	while ( used > 0 && expected[used - 1] == ' ' )
+		--used;
+
+	return memcmp( field, expected, width ) == 0 && memcmp( truncated, expected, width ) == 0
+	    && memcmp( right + width - used, expected, used ) == 0;
+}
+
+int main ( void )
+{
+	static const double values[] =
+	{
+		0, 0.5, 1.5, 2.5, 0.125, 0.375, 0.015, 0.95, 1.885, 2.675, 1.005, 0.045,
+		999.9999999995, 4503599627370495.5, 9007199254740993.0, 1e18, 9.999e18,
+		18446744073709549568.0, 123456789.987654321, 1e-10, 5e-10, 0.0000000005
+	};
+
+	uint64_t i, mismatches = 0;
+	int precision;
+
+	for ( i = 0; i < sizeof( values ) / sizeof( values[0] ); ++i )
+		for ( precision = 0; precision <= 9; ++precision )
+		{
+			CHECK( matches_printf( values[i], precision ) );
+			CHECK( matches_printf( -values[i], precision ) );
+		}
+
+	// Decimal ties at every precision and their neighbours
+	srand( 3 );
+	for ( i = 0; i < 1000000; ++i )
+	{
+		precision = rand() % 10;
+		double value = ( rand() % 2000000 * 10 + 5 ) / (double) constats_powers_of_ten[precision + 1];
+
+		switch ( rand() % 3 )
+		{
+			case 0: value = nextafter( value, 0 ); break;
+			case 1: value = nextafter( value, INFINITY ); break;
+		}
+
+		mismatches += !matches_printf( value, precision );
+	}
+
+	// Any magnitude printf prints within the limit
+	for ( i = 0; i < 1000000; ++i )
+	{
+		precision = rand() % 10;
+		double value = ldexp( (double) rand() / RAND_MAX, rand() % 124 - 60 );
+		mismatches += !matches_printf( value, precision );
+	}
+
+	CHECK( mismatches == 0 );
+
+	CHECK( formats_as( NAN, 2, CONSTATS_UNIT_NONE, "nan" ) );
+	CHECK( formats_as( -INFINITY, 2, CONSTATS_UNIT_TIME, "-inf" ) );
+	CHECK( formats_as( 1e30, 2, CONSTATS_UNIT_NONE, "1.00e+30" ) );
+	CHECK( formats_as( 999.96, 1, CONSTATS_UNIT_TIME, "1.0 us" ) );
+	CHECK( formats_as( 999.94, 1, CONSTATS_UNIT_TIME, "999.9 ns" ) );
+	CHECK( formats_as( 1536, 1, CONSTATS_UNIT_BYTES, "1.5 KB" ) );
+	CHECK( formats_as( 1048575, 0, CONSTATS_UNIT_BYTES, "1 MB" ) );
+	CHECK( formats_as( 2.5e6, 0, CONSTATS_UNIT_SI, "2M" ) );
+	CHECK( formats_as( 3.5e21, 1, CONSTATS_UNIT_SI, "3500.0E" ) );
+
+	// Every width from 1 to 20 at powers of ten, their neighbours and the ends
+	uint64_t width, fields = 0;
+	mismatches = 0;
+
+	for ( width = 1; width <= 20; ++width )
+	{
+		for ( i = 0; i < 19; ++i )
+		{
+			int64_t power = (int64_t) constats_powers_of_ten[i];
+
+			mismatches += !field_matches( power, width ) + !field_matches( power - 1, width ) + !field_matches( power + 1, width );
+			mismatches += !field_matches( -power, width ) + !field_matches( 1 - power, width ) + !field_matches( -1 - power, width );
+			fields += 6;
+		}
+
+		mismatches += !field_matches( 0, width ) + !field_matches( INT64_MAX, width ) + !field_matches( INT64_MIN, width );
+		fields += 3;
+
+		for ( i = 0; i < 10000; ++i, ++fields )
+			mismatches += !field_matches( ( (int64_t) rand() << 32 | rand() ) >> ( rand() % 63 ), width );
+	}
+
+	CHECK( fields > 200000 && mismatches == 0 );
+
+	char field[32];
+
+	CHECK( constats_format_field( 0, field, 1, 0 ) == 0 && field[0] == '0' );
+	CHECK( constats_format_field( -5, field, 1, 0 ) == -1 );
+	CHECK( constats_format_field( 5, field, 0, 0 ) == -1 );
+	CHECK( constats_format_field( 1234, field, 2, 0 ) == 0 && memcmp( field, "1K", 2 ) == 0 );
+	CHECK( constats_format_field( 12345, field, 2, 0 ) == -1 );
+	CHECK( constats_format_field( -1234, field, 3, 0 ) == 0 && memcmp( field, "-1K", 3 ) == 0 );
+	CHECK( constats_format_field( INT64_MIN, field, 20, 0 ) == 0 && memcmp( field, "-9223372036854775808", 20 ) == 0 );
+	CHECK( constats_format_field( INT64_MIN, field, 19, 0 ) == 0 && memcmp( field, "-9223372036854775K ", 19 ) == 0 );
+	CHECK( constats_format_field( INT64_MIN, field, 3, 0 ) == 0 && memcmp( field, "-9E", 3 ) == 0 );
+	CHECK( constats_format_field( INT64_MAX, field, 2, 0 ) == 0 && memcmp( field, "9E", 2 ) == 0 );
+	CHECK( constats_format_field( 42, field, 5, CONSTATS_FORMAT_RIGHT ) == 0 && memcmp( field, "   42", 5 ) == 0 );
+
+	// Fields too narrow for their value are filled with '#'
+	int64_t column[] = { 1, 123456, -5, -12345 };
+
+	CHECK( constats_format_column( column, 4, field, 2, '|', 0 ) == 12 );
+	CHECK( memcmp( field, "1 |##|-5|##|", 12 ) == 0 );
+	CHECK( constats_format_column( column, 4, field, 4, ',', CONSTATS_FORMAT_RIGHT ) == 20 );
+	CHECK( memcmp( field, "   1,123K,  -5,-12K,", 20 ) == 0 );
+
+	return TEST_RESULT();
+}
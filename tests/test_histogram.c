@@ -0,0 +1,137 @@
+/**
+ * @File     : test_histogram.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the histogram's mean and deviation against the batch
+ * statistics, including values far from zero, merges and wire round trips,
+ * and that correcting for coordinated omission matches recording every
+ * back-filled value one at a time.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_histogram.h"
+#include "constats_wire.h"
+#include "constats_test.h"
+
+#define SAMPLES 100000
+#define PARTS   5
+
+int64_t samples[SAMPLES];
+histogram_t whole, parts[PARTS], merged, decoded, repeated, corrected, expected;
+uint8_t buffer[CONSTATS_WIRE_HISTOGRAM_MAX];
+
+static int close_to ( double a, double b )
+{
+	return fabs( a - b ) <= 1e-6 * fabs( b );
+}
+
+int main ( void )
+{
+	uint64_t length;
+	stats_t batch, stat;
+	uint64_t i;
+
+	// 1e9 plus or minus 10, where a sum of squares loses every digit
+	srand( 2 );
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = 1000000000 + rand() % 21 - 10;
+
+	constats_histogram_init( &whole );
+	for ( i = 0; i < PARTS; ++i )
+		constats_histogram_init( &parts[i] );
+
+	for ( i = 0; i < SAMPLES; ++i )
+	{
+		constats_histogram_record( &whole, samples[i] );
+		constats_histogram_record( &parts[i * PARTS / SAMPLES], samples[i] );
+	}
+
+	CHECK( constats_calculate_stats( samples, SAMPLES, &batch ) == 0 );
+	CHECK( constats_histogram_calculate_stats( &whole, &stat ) == 0 );
+	CHECK( stat.N == SAMPLES );
+	CHECK( close_to( stat.mean, batch.mean ) );
+	CHECK( close_to( stat.stdev, batch.stdev ) );
+	CHECK( stat.min == batch.min && stat.max == batch.max );
+
+	// Merged through the wire, out of order
+	constats_histogram_init( &merged );
+	for ( i = PARTS; i-- > 0; )
+	{
+		CHECK( constats_wire_encode_histogram( &parts[i], buffer, sizeof( buffer ), &length ) == 0 );
+		CHECK( constats_wire_merge_histogram( &merged, buffer, length ) == 0 );
+	}
+
+	CHECK( constats_histogram_calculate_stats( &merged, &stat ) == 0 );
+	CHECK( stat.N == SAMPLES );
+	CHECK( close_to( stat.mean, batch.mean ) );
+	CHECK( close_to( stat.stdev, batch.stdev ) );
+
+	constats_histogram_init( &merged );
+	for ( i = 0; i < PARTS; ++i )
+		constats_histogram_merge( &merged, &parts[i] );
+
+	CHECK( close_to( merged.mean, whole.mean ) && close_to( merged.m2, whole.m2 ) );
+
+	CHECK( constats_wire_encode_histogram( &whole, buffer, sizeof( buffer ), &length ) == 0 );
+	CHECK( constats_wire_decode_histogram( &decoded, buffer, length ) == 0 );
+	CHECK( decoded.N == whole.N && decoded.mean == whole.mean && decoded.m2 == whole.m2 );
+	CHECK( memcmp( decoded.counts, whole.counts, sizeof( whole.counts ) ) == 0 );
+
+	// Only consistent histograms validate
+	CHECK( constats_histogram_validate( &whole ) == 0 );
+	decoded.min = 0;
+	CHECK( constats_histogram_validate( &decoded ) == -1 );
+	decoded.min = whole.min;
+	decoded.counts[0] = 1;
+	CHECK( constats_histogram_validate( &decoded ) == -1 );
+	decoded.N++;
+	CHECK( constats_histogram_validate( &decoded ) == -1 );
+
+	// Recording n copies is the same as recording one n times
+	constats_histogram_init( &repeated );
+	constats_histogram_record_n( &repeated, 1000000007, 3 );
+	constats_histogram_record_n( &repeated, 999999990, 0 );
+	constats_histogram_record_n( &repeated, 999999995, 5 );
+	CHECK( constats_histogram_calculate_stats( &repeated, &stat ) == 0 );
+	CHECK( stat.N == 8 && stat.min == 999999995 && stat.max == 1000000007 );
+	CHECK( close_to( stat.mean, ( 3 * 1000000007.0 + 5 * 999999995.0 ) / 8 ) );
+	CHECK( close_to( stat.stdev, sqrt( 15.0 / 64 ) * 12 ) );
+
+	// Back-filling a bucket at a time matches back-filling a value at a time
+	static const int64_t stalls[][2] = { { 5, 10 }, { 10, 10 }, { 11, 10 }, { 1000, 1 }, { 123456, 7 }, { 10000000, 333 } };
+
+	for ( i = 0; i < sizeof( stalls ) / sizeof( stalls[0] ); ++i )
+	{
+		int64_t missing;
+
+		constats_histogram_init( &corrected );
+		constats_histogram_init( &expected );
+
+		constats_histogram_record( &corrected, 3 );
+		constats_histogram_record( &expected, 3 );
+		constats_histogram_record_corrected( &corrected, stalls[i][0], stalls[i][1] );
+		constats_histogram_record( &expected, stalls[i][0] );
+
+		for ( missing = stalls[i][0] - stalls[i][1]; missing >= stalls[i][1]; missing -= stalls[i][1] )
+			constats_histogram_record( &expected, missing );
+
+		CHECK( corrected.N == expected.N && corrected.min == expected.min && corrected.max == expected.max );
+		CHECK( memcmp( corrected.counts, expected.counts, sizeof( corrected.counts ) ) == 0 );
+		CHECK( close_to( corrected.mean, expected.mean ) && close_to( corrected.m2, expected.m2 ) );
+		CHECK( constats_histogram_validate( &corrected ) == 0 );
+	}
+
+	// A stall of a million million intervals is back-filled at once
+	constats_histogram_init( &corrected );
+	constats_histogram_record_corrected( &corrected, 1000000000000, 1 );
+	CHECK( corrected.N == 1000000000000 && corrected.min == 1 && corrected.max == 1000000000000 );
+	CHECK( close_to( corrected.mean, 500000000000.5 ) );
+	CHECK( constats_histogram_validate( &corrected ) == 0 );
+
+	return TEST_RESULT();
+}
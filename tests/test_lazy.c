@@ -0,0 +1,84 @@
+/**
+ * @File     : test_lazy.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that every field of a lazy_stats_t matches
+ * constats_calculate_stats bit for bit, whichever fields are asked for
+ * first, and that a NULL or unbound lazy_stats_t is an error.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats.h"
+#include "constats_lazy.h"
+#include "constats_test.h"
+
+#define SAMPLES 10000
+
+int64_t samples[SAMPLES];
+
+/**
+ * This function returns whether every field in fields matches.
+ */
+static int same_fields ( const stats_t* a, const stats_t* b, uint64_t fields )
+{
+	#define SAME(flag, field) ( !( fields & (flag) ) || memcmp( &a->field, &b->field, sizeof( a->field ) ) == 0 )
+
+	return a->N == b->N
+	    && SAME( CONSTATS_FIELD_MEAN, mean ) && SAME( CONSTATS_FIELD_STDEV, stdev )
+	    && SAME( CONSTATS_FIELD_ABDEV, abdev ) && SAME( CONSTATS_FIELD_MIN, min )
+	    && SAME( CONSTATS_FIELD_MAX, max ) && SAME( CONSTATS_FIELD_TOLERANCE, tolerance )
+	    && SAME( CONSTATS_FIELD_OUTLIERS, outliers ) && SAME( CONSTATS_FIELD_NORM_MEAN, norm_mean )
+	    && SAME( CONSTATS_FIELD_NORM_STDEV, norm_stdev ) && SAME( CONSTATS_FIELD_NORM_ABDEV, norm_abdev )
+	    && SAME( CONSTATS_FIELD_NORM_MIN, norm_min ) && SAME( CONSTATS_FIELD_NORM_MAX, norm_max );
+
+	#undef SAME
+}
+
+int main ( void )
+{
+	lazy_stats_t lazy;
+	stats_t expected;
+	uint64_t first, i;
+	double mean;
+	int64_t max;
+
+	srand( 7 );
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = 1000000000 + rand() % 1000 - ( rand() % 100 == 0 ? 1000000 : 0 );
+
+	CHECK( constats_calculate_stats( samples, SAMPLES, &expected ) == 0 );
+
+	// Every mask, then everything else on top of it
+	for ( first = 0; first <= CONSTATS_FIELD_ALL; ++first )
+	{
+		CHECK( constats_lazy_init( &lazy, samples, SAMPLES ) == 0 );
+		CHECK( constats_lazy_request( &lazy, first ) == 0 );
+		CHECK( ( lazy.ready & first ) == first );
+		CHECK( same_fields( &lazy.stat, &expected, first ) );
+
+		const stats_t* stat = constats_lazy_get( &lazy, CONSTATS_FIELD_ALL );
+		CHECK( stat != NULL && same_fields( stat, &expected, CONSTATS_FIELD_ALL ) );
+	}
+
+	CHECK( constats_lazy_init( &lazy, samples, SAMPLES ) == 0 );
+	CHECK( constats_lazy_mean( &lazy, &mean ) == 0 && mean == expected.mean );
+	CHECK( constats_lazy_max( &lazy, &max ) == 0 && max == expected.max );
+	CHECK( constats_lazy_mean( &lazy, NULL ) == -1 );
+
+	// Errors instead of crashes
+	CHECK( constats_lazy_init( NULL, samples, SAMPLES ) == -1 );
+	CHECK( constats_lazy_init( &lazy, NULL, SAMPLES ) == -1 );
+	CHECK( constats_lazy_init( &lazy, samples, 0 ) == -1 );
+	CHECK( constats_lazy_request( NULL, CONSTATS_FIELD_ALL ) == -1 );
+	CHECK( constats_lazy_get( NULL, CONSTATS_FIELD_MEAN ) == NULL );
+	CHECK( constats_lazy_mean( NULL, &mean ) == -1 );
+
+	memset( &lazy, 0, sizeof( lazy ) );
+	CHECK( constats_lazy_stdev( &lazy, &mean ) == -1 );
+	CHECK( constats_lazy_norm_max( &lazy, &max ) == -1 );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,73 @@
+/**
+ * @File     : test_perf.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests counter scopes: threads that exit must not leak their
+ * counters, and counter sites must not also print as scope sites. It
+ * passes without a PMU, where no counters open.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "constats_perf.h"
+#include "constats_test.h"
+
+#define THREADS 64
+#define PASSES  10
+
+static uint64_t open_fds ( void )
+{
+	DIR* dir = opendir( "/proc/self/fd" );
+	uint64_t count = 0;
+
+	if ( dir == NULL )
+		return 0;
+
+	while ( readdir( dir ) != NULL )
+		count++;
+
+	closedir( dir );
+	return count;
+}
+
+static void* worker ( void* arg )
+{
+	int i;
+	(void) arg;
+
+	for ( i = 0; i < PASSES; ++i )
+	{
+		CONSTATS_SCOPE_COUNTERS( "counted" );
+	}
+
+	return NULL;
+}
+
+int main ( void )
+{
+	pthread_t thread;
+	stats_t stat;
+	uint64_t before;
+	int i;
+
+	// Register the site first, so later threads allocate nothing that lasts
+	worker( NULL );
+	before = open_fds();
+
+	for ( i = 0; i < THREADS; ++i )
+	{
+		CHECK( pthread_create( &thread, NULL, worker, NULL ) == 0 );
+		pthread_join( thread, NULL );
+	}
+
+	CHECK( open_fds() == before );
+
+	CHECK( constats_perf_sites != NULL && constats_perf_sites->next == NULL );
+	CHECK( constats_scope_sites == NULL );
+	CHECK( constats_scope_calculate_stats( &constats_perf_sites->scope, &stat ) == 0 );
+	CHECK( stat.N == ( THREADS + 1 ) * PASSES );
+
+	return TEST_RESULT();
+}
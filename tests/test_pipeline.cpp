@@ -0,0 +1,90 @@
+/**
+ * @File     : test_pipeline.cpp
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the streaming stats stage: snapshots come every period
+ * samples and once more at the end, and the streamed mean and deviation
+ * of samples far from zero match the batch statistics.
+ */
+
+#include <cmath>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <vector>
+
+#include "constats_pipeline.hpp"
+
+#if defined( __GNUC__ )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wregister"
+#endif
+
+#include "constats_test.h"
+
+#if defined( __GNUC__ )
+#pragma GCC diagnostic pop
+#endif
+
+#define SAMPLES 100500
+#define BATCH   1000
+#define PERIOD  10000
+
+// A coroutine that runs to completion as soon as it is called
+struct task
+{
+	struct promise_type
+	{
+		task get_return_object ( ) { return {}; }
+		std::suspend_never initial_suspend ( ) noexcept { return {}; }
+		std::suspend_never final_suspend ( ) noexcept { return {}; }
+		void return_void ( ) noexcept { }
+		void unhandled_exception ( ) noexcept { std::terminate(); }
+	};
+};
+
+static constats::async_generator<std::vector<int64_t>> batches ( const std::vector<int64_t>& samples )
+{
+	for ( size_t begin = 0; begin < samples.size(); begin += BATCH )
+	{
+		size_t end = begin + BATCH < samples.size() ? begin + BATCH : samples.size();
+		co_yield std::vector<int64_t>( samples.begin() + begin, samples.begin() + end );
+	}
+}
+
+static task collect ( const std::vector<int64_t>& samples, std::vector<stats_t>& snapshots )
+{
+	auto stats = constats::stats_stage( batches( samples ), PERIOD );
+
+	while ( const stats_t* snapshot = co_await stats.next() )
+		snapshots.push_back( *snapshot );
+}
+
+int main ( void )
+{
+	std::vector<int64_t> samples( SAMPLES );
+	std::vector<stats_t> snapshots;
+	stats_t batch;
+
+	// 1e9 plus or minus 10, where a sum of squares loses every digit
+	std::srand( 6 );
+	for ( auto& sample : samples )
+		sample = 1000000000 + std::rand() % 21 - 10;
+
+	collect( samples, snapshots );
+
+	CHECK( snapshots.size() == SAMPLES / PERIOD + 1 );
+
+	for ( size_t i = 0; i < snapshots.size(); ++i )
+		CHECK( snapshots[i].N == ( i + 1 < snapshots.size() ? ( i + 1 ) * PERIOD : SAMPLES ) );
+
+	CHECK( constats_calculate_stats( samples.data(), samples.size(), &batch ) == 0 );
+
+	const stats_t& last = snapshots.back();
+	CHECK( last.min == batch.min && last.max == batch.max );
+	CHECK( std::fabs( last.mean - batch.mean ) <= 1e-6 * batch.mean );
+	CHECK( std::fabs( last.stdev - batch.stdev ) <= 1e-6 * batch.stdev );
+
+	return TEST_RESULT();
+}
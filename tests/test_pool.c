@@ -0,0 +1,200 @@
+/**
+ * @File     : test_pool.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the pool with several workers: every chunk runs once,
+ * including jobs posted before the workers have started,
+ * parallel calls nested inside a job run serially instead of deadlocking,
+ * whether the outer chunk runs on a worker or on the submitting thread,
+ * threads with nothing to steal sleep instead of spinning, and the
+ * parallel, batch and grouped stats agree with the serial ones.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CONSTATS_POOL_THREADS 3
+
+#include "constats.h"
+#include "constats_parallel.h"
+#include "constats_pool.h"
+#include "constats_test.h"
+
+#define CHUNKS  64
+#define INNER   16
+#define SAMPLES ( 1 << 20 )
+#define GROUPS  7
+
+pool_t pool;
+uint64_t runs[CHUNKS];
+uint64_t inner_runs[CHUNKS];
+int64_t samples[SAMPLES];
+uint64_t parallel_nests;
+uint32_t groups[SAMPLES];
+int64_t grouped[SAMPLES];
+
+static void count_inner ( void* arg, uint64_t begin, uint64_t end, uint64_t chunk )
+{
+	(void) begin;
+	(void) end;
+	(void) chunk;
+
+	__atomic_fetch_add( (uint64_t*) arg, 1, __ATOMIC_RELAXED );
+}
+
+static void nest ( void* arg, uint64_t begin, uint64_t end, uint64_t chunk )
+{
+	pool_t* target = (pool_t*) arg;
+	(void) end;
+
+	__atomic_fetch_add( &runs[begin], 1, __ATOMIC_RELAXED );
+
+	// A nested call sees one thread and finishes on this one
+	if ( constats_pool_threads( target ) != 1 )
+		__atomic_fetch_add( &parallel_nests, 1, __ATOMIC_RELAXED );
+
+	constats_pool_for( target, INNER, 1, count_inner, &inner_runs[chunk] );
+}
+
+static int close_to ( double a, double b );
+
+static void sleep_first ( void* arg, uint64_t begin, uint64_t end, uint64_t chunk )
+{
+	(void) arg;
+	(void) begin;
+	(void) end;
+
+	if ( chunk == 0 )
+		usleep( 200000 );
+}
+
+static double seconds ( clockid_t clock )
+{
+	struct timespec now;
+	clock_gettime( clock, &now );
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static int same_stats ( const stats_t* a, const stats_t* b )
+{
+	return a->N == b->N && a->min == b->min && a->max == b->max
+	    && a->outliers == b->outliers && a->tolerance == b->tolerance
+	    && close_to( a->mean, b->mean ) && close_to( a->stdev, b->stdev )
+	    && close_to( a->norm_mean, b->norm_mean ) && close_to( a->norm_stdev, b->norm_stdev );
+}
+
+static int close_to ( double a, double b )
+{
+	return fabs( a - b ) <= 1e-9 * fabs( b ) + 1e-9;
+}
+
+int main ( void )
+{
+	stats_t serial, parallel, batch[GROUPS], expected[GROUPS];
+	uint64_t offsets[GROUPS + 1];
+	uint64_t i, g;
+	int round;
+
+	// A deadlock fails the test instead of hanging it
+	alarm( 60 );
+
+	// Jobs posted before the workers get to wait for them
+	for ( round = 0; round < 200; ++round )
+	{
+		uint64_t count = 0;
+
+		CHECK( constats_pool_create( &pool, 3 ) == 0 );
+		CHECK( constats_pool_for( &pool, CHUNKS, 1, count_inner, &count ) == 0 );
+		CHECK( count == CHUNKS );
+		CHECK( constats_pool_destroy( &pool ) == 0 );
+	}
+
+	CHECK( constats_pool_create( &pool, 3 ) == 0 );
+	CHECK( pool.size == 3 );
+	CHECK( constats_pool_threads( &pool ) == 4 );
+	CHECK( constats_pool_threads( NULL ) == 4 );
+
+	// Nested on the same pool and on the process-wide one
+	for ( round = 0; round < 100; ++round )
+	{
+		pool_t* target = round % 2 ? &pool : NULL;
+
+		memset( runs, 0, sizeof( runs ) );
+		memset( inner_runs, 0, sizeof( inner_runs ) );
+
+		CHECK( constats_pool_for( round % 4 < 2 ? &pool : NULL, CHUNKS, 1, nest, target ) == 0 );
+
+		for ( i = 0; i < CHUNKS; ++i )
+			CHECK( runs[i] == 1 && inner_runs[i] == INNER );
+	}
+
+	CHECK( parallel_nests == 0 );
+
+	// The submitting thread is back to parallel calls afterwards
+	CHECK( constats_pool_threads( &pool ) == 4 );
+
+	srand( 4 );
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = 1000000000 + rand() % 1000 - ( rand() % 1000 == 0 ? 100000 : 0 );
+
+	CHECK( constats_calculate_stats( samples, SAMPLES, &serial ) == 0 );
+
+	for ( round = 0; round < 10; ++round )
+	{
+		CHECK( constats_calculate_stats_parallel( samples, SAMPLES, &parallel, &pool ) == 0 );
+		CHECK( same_stats( &parallel, &serial ) );
+	}
+
+	// Segments of very different sizes, one of them empty
+	offsets[0] = 0;
+	for ( g = 0; g < GROUPS; ++g )
+		offsets[g + 1] = g == 2 ? offsets[g] : g + 1 == GROUPS ? SAMPLES : offsets[g] + ( SAMPLES >> ( g + 1 ) );
+
+	CHECK( constats_calculate_stats_batch( samples, offsets, GROUPS, batch, &pool ) == 0 );
+
+	for ( g = 0; g < GROUPS; ++g )
+	{
+		if ( offsets[g + 1] == offsets[g] )
+		{
+			CHECK( batch[g].N == 0 );
+			continue;
+		}
+
+		CHECK( constats_calculate_stats( samples + offsets[g], offsets[g + 1] - offsets[g], &expected[g] ) == 0 );
+		CHECK( same_stats( &batch[g], &expected[g] ) );
+	}
+
+	// Groups interleaved through the samples
+	for ( i = 0; i < SAMPLES; ++i )
+		groups[i] = i % 3 == 0 ? 0 : rand() % GROUPS;
+
+	CHECK( constats_calculate_stats_grouped( samples, groups, SAMPLES, GROUPS, batch, &pool ) == 0 );
+
+	for ( g = 0; g < GROUPS; ++g )
+	{
+		uint64_t count = 0;
+
+		for ( i = 0; i < SAMPLES; ++i )
+			if ( groups[i] == g )
+				grouped[count++] = samples[i];
+
+		CHECK( constats_calculate_stats( grouped, count, &expected[g] ) == 0 );
+		CHECK( same_stats( &batch[g], &expected[g] ) );
+	}
+
+	// Three threads wait out one long chunk without burning the CPU
+	double wall = seconds( CLOCK_MONOTONIC );
+	double cpu  = seconds( CLOCK_PROCESS_CPUTIME_ID );
+
+	CHECK( constats_pool_for( &pool, 2, 1, sleep_first, NULL ) == 0 );
+
+	wall = seconds( CLOCK_MONOTONIC ) - wall;
+	cpu  = seconds( CLOCK_PROCESS_CPUTIME_ID ) - cpu;
+	CHECK( wall >= 0.2 && cpu < 0.05 );
+
+	CHECK( constats_pool_destroy( &pool ) == 0 );
+	return TEST_RESULT();
+}
@@ -0,0 +1,108 @@
+/**
+ * @File     : test_recorder.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the sample recorder, including readers racing shared
+ * writers.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "constats_recorder.h"
+#include "constats_test.h"
+
+#define WRITERS   4
+#define PER_WRITE 200000
+
+recorder_t shared;
+int writers_done = 0;
+
+static void* writer ( void* arg )
+{
+	int64_t base = (int64_t) (uintptr_t) arg * PER_WRITE;
+	int64_t i;
+
+	for ( i = 0; i < PER_WRITE; ++i )
+		constats_recorder_record_shared( &shared, base + i );
+
+	return NULL;
+}
+
+static void* reader ( void* unused )
+{
+	(void) unused;
+
+	// Every reported slot must already hold a sample, never the -1 fill
+	while ( !__atomic_load_n( &writers_done, __ATOMIC_ACQUIRE ) )
+	{
+		uint64_t size = constats_recorder_size( &shared );
+		uint64_t i;
+
+		for ( i = 0; i < size; ++i )
+			if ( __atomic_load_n( &shared.samples[i], __ATOMIC_RELAXED ) < 0 )
+			{
+				CHECK( !"an unwritten slot was reported" );
+				return NULL;
+			}
+	}
+
+	return NULL;
+}
+
+static void test_shared ( void )
+{
+	pthread_t threads[WRITERS];
+	pthread_t watcher;
+	uint64_t i;
+
+	CHECK( constats_recorder_init( &shared, WRITERS * PER_WRITE - 1000, 0 ) == 0 );
+	memset( shared.samples, 0xff, shared.capacity * sizeof( int64_t ) );
+
+	pthread_create( &watcher, NULL, reader, NULL );
+
+	for ( i = 0; i < WRITERS; ++i )
+		pthread_create( &threads[i], NULL, writer, (void*) (uintptr_t) i );
+
+	for ( i = 0; i < WRITERS; ++i )
+		pthread_join( threads[i], NULL );
+
+	__atomic_store_n( &writers_done, 1, __ATOMIC_RELEASE );
+	pthread_join( watcher, NULL );
+
+	uint64_t size;
+	CHECK( constats_recorder_try_size( &shared, &size ) == 0 );
+	CHECK( size == shared.capacity );
+	CHECK( constats_recorder_size( &shared ) == shared.capacity );
+	CHECK( shared.dropped == 1000 );
+
+	constats_recorder_reset( &shared );
+	CHECK( constats_recorder_size( &shared ) == 0 );
+	constats_recorder_destroy( &shared );
+}
+
+static void test_single ( void )
+{
+	recorder_t recorder;
+	uint64_t size;
+	int64_t i;
+
+	CHECK( constats_recorder_init( &recorder, 100, CONSTATS_RECORDER_PREFAULT ) == 0 );
+
+	for ( i = 0; i < 150; ++i )
+		constats_recorder_record( &recorder, i );
+
+	CHECK( constats_recorder_try_size( &recorder, &size ) == 0 );
+	CHECK( size == 100 );
+	CHECK( recorder.dropped == 50 );
+	CHECK( recorder.samples[99] == 99 );
+
+	constats_recorder_destroy( &recorder );
+}
+
+int main ( void )
+{
+	test_single();
+	test_shared();
+	return TEST_RESULT();
+}
@@ -0,0 +1,158 @@
+/**
+ * @File     : test_report.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests background reports: waiting for each kind, detaching
+ * before and after the report is done, reading samples in place with
+ * CONSTATS_REPORT_NOCOPY, samples changed after submitting, and many
+ * threads submitting at once.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "constats_report.h"
+#include "constats_test.h"
+
+#define SLOW     2000000
+#define SAMPLES  1000
+#define THREADS  8
+#define REPORTS  50
+
+int64_t slow[SLOW];
+int64_t samples[SAMPLES];
+histogram_t hist;
+accumulator_t acc;
+
+// Keeps the reporter thread busy, so reports queued after it wait
+static report_t* submit_slow ( void )
+{
+	return constats_report_samples_async( slow, SLOW, CONSTATS_REPORT_NOCOPY );
+}
+
+static void* submit_many ( void* arg )
+{
+	int64_t offset = (int64_t) (intptr_t) arg * 1000;
+	int64_t set[10];
+	stats_t stat;
+	int i, j;
+
+	for ( i = 0; i < REPORTS; ++i )
+	{
+		for ( j = 0; j < 10; ++j )
+			set[j] = offset + i + j;
+
+		report_t* report = constats_report_samples_async( set, 10, 0 );
+
+		// The samples were copied, so the set can be reused at once
+		for ( j = 0; j < 10; ++j )
+			set[j] = -1;
+
+		if ( report == NULL || constats_report_wait( report, &stat ) != 0
+		  || stat.N != 10 || stat.mean != offset + i + 4.5 )
+			return (void*) 1;
+	}
+
+	return NULL;
+}
+
+int main ( void )
+{
+	pthread_t threads[THREADS];
+	report_t* report;
+	stats_t stat;
+	void* result;
+	int i;
+
+	srand( 4 );
+	for ( i = 0; i < SLOW; ++i )
+		slow[i] = rand() % 1000;
+
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = i + 1;
+
+	// Every kind of report can be waited for
+	report = constats_report_samples_async( samples, SAMPLES, 0 );
+	CHECK( report != NULL && report->samples != samples );
+	CHECK( constats_report_wait( report, &stat ) == 0 );
+	CHECK( stat.N == SAMPLES && stat.mean == 500.5 && stat.min == 1 && stat.max == SAMPLES );
+
+	constats_histogram_init( &hist );
+	constats_accumulator_init( &acc );
+
+	for ( i = 0; i < SAMPLES; ++i )
+	{
+		constats_histogram_record( &hist, samples[i] );
+		constats_accumulator_add( &acc, samples[i] );
+	}
+
+	CHECK( constats_report_wait( constats_report_histogram_async( &hist, 0 ), &stat ) == 0 );
+	CHECK( stat.N == SAMPLES && stat.mean == 500.5 );
+	CHECK( constats_report_wait( constats_report_accumulator_async( &acc, 0 ), &stat ) == 0 );
+	CHECK( stat.N == SAMPLES && stat.mean == 500.5 );
+
+	CHECK( constats_report_wait( constats_report_samples_async( samples, 0, 0 ), &stat ) == -1 );
+	CHECK( constats_report_wait( NULL, &stat ) == -1 );
+
+	// Samples, the histogram and the accumulator are snapshotted on submit
+	report_t* blocker = submit_slow();
+	report_t* copied  = constats_report_samples_async( samples, SAMPLES, 0 );
+	report_t* hist_report = constats_report_histogram_async( &hist, 0 );
+	report_t* acc_report  = constats_report_accumulator_async( &acc, 0 );
+
+	CHECK( !constats_report_ready( copied ) );
+
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = 0;
+
+	constats_histogram_record_n( &hist, 0, SAMPLES );
+	constats_accumulator_add( &acc, 0 );
+
+	CHECK( constats_report_wait( copied, &stat ) == 0 && stat.mean == 500.5 );
+	CHECK( constats_report_wait( hist_report, &stat ) == 0 && stat.N == SAMPLES );
+	CHECK( constats_report_wait( acc_report, &stat ) == 0 && stat.N == SAMPLES );
+	CHECK( constats_report_wait( blocker, &stat ) == 0 && stat.N == SLOW );
+
+	// NOCOPY reads the samples in place, so it sees what is there when it runs
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = i + 1;
+
+	blocker = submit_slow();
+	report  = constats_report_samples_async( samples, SAMPLES, CONSTATS_REPORT_NOCOPY );
+	CHECK( report->samples == samples );
+
+	for ( i = 0; i < SAMPLES; ++i )
+		samples[i] = 7;
+
+	CHECK( constats_report_wait( report, &stat ) == 0 && stat.mean == 7 );
+	CHECK( constats_report_wait( blocker, NULL ) == 0 );
+
+	// A report detached while pending is freed by the reporter once done
+	blocker = submit_slow();
+	report  = constats_report_samples_async( samples, SAMPLES, 0 );
+	CHECK( !constats_report_ready( report ) );
+	constats_report_detach( report );
+	constats_report_detach( blocker );
+
+	// A report detached once done is freed by its owner
+	report = constats_report_samples_async( samples, SAMPLES, 0 );
+
+	while ( !constats_report_ready( report ) )
+		sched_yield();
+
+	constats_report_detach( report );
+	constats_report_detach( NULL );
+
+	// Reports from many threads at once each get their own result
+	for ( i = 0; i < THREADS; ++i )
+		pthread_create( &threads[i], NULL, submit_many, (void*) (intptr_t) i );
+
+	for ( i = 0; i < THREADS; ++i )
+	{
+		pthread_join( threads[i], &result );
+		CHECK( result == NULL );
+	}
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,120 @@
+/**
+ * @File     : test_scope.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that a site's registration is neither timed nor loses
+ * samples, and that sampled scopes account for every pass, including
+ * passes whose site adapted while they were being timed.
+ */
+
+#define CONSTATS_ADAPT_WINDOW 64
+#define CONSTATS_SITE_CAPACITY (1UL << 16)
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "constats_scope.h"
+#include "constats_test.h"
+
+#define THREADS 4
+#define PASSES  20000
+
+static scope_site_t* find_site ( const char* name )
+{
+	scope_site_t* site;
+
+	for ( site = constats_scope_sites; site != NULL; site = site->next )
+		if ( strcmp( site->name, name ) == 0 )
+			return site;
+
+	return NULL;
+}
+
+static pthread_barrier_t barrier;
+
+static void* first_pass ( void* unused )
+{
+	(void) unused;
+	pthread_barrier_wait( &barrier );
+
+	CONSTATS_SCOPE( "raced" );
+
+	// Let the other threads reach the site while it registers
+	sched_yield();
+	return NULL;
+}
+
+static void fixed_pass ( void )
+{
+	CONSTATS_SCOPE_SAMPLED( "fixed", 8 );
+}
+
+static void* adaptive_passes ( void* unused )
+{
+	int i;
+	(void) unused;
+
+	for ( i = 0; i < PASSES; ++i )
+	{
+		CONSTATS_SCOPE_ADAPTIVE( "adaptive" );
+
+		// Let other threads enter, exit and adapt while this pass is timed
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+int main ( void )
+{
+	pthread_t threads[THREADS];
+	stats_t stat;
+	int i;
+
+	// Threads losing the race to register a site still record their pass,
+	// even while the winner spends over 10 ms measuring the tick rate
+	pthread_barrier_init( &barrier, NULL, THREADS );
+
+	for ( i = 0; i < THREADS; ++i )
+		pthread_create( &threads[i], NULL, first_pass, NULL );
+
+	for ( i = 0; i < THREADS; ++i )
+		pthread_join( threads[i], NULL );
+
+	scope_site_t* raced_site = find_site( "raced" );
+	CHECK( raced_site != NULL );
+	CHECK( constats_recorder_size( &raced_site->recorder ) == THREADS );
+	CHECK( raced_site->recorder.dropped == 0 );
+
+	for ( i = 0; i < 100000; ++i )
+		fixed_pass();
+
+	scope_site_t* fixed_site = find_site( "fixed" );
+	CHECK( fixed_site != NULL );
+
+	CHECK( constats_scope_calls( fixed_site ) == 100000 );
+	CHECK( constats_scope_calculate_stats( fixed_site, &stat ) == 0 );
+	CHECK( stat.N == 100000 );
+
+	for ( i = 0; i < THREADS; ++i )
+		pthread_create( &threads[i], NULL, adaptive_passes, NULL );
+
+	for ( i = 0; i < THREADS; ++i )
+		pthread_join( threads[i], NULL );
+
+	scope_site_t* adaptive_site = find_site( "adaptive" );
+	CHECK( adaptive_site != NULL );
+
+	// Each thread's last sample stands for at most one period of passes
+	// that had not happened yet
+	uint64_t calls = constats_scope_calls( adaptive_site );
+	CHECK( calls >= THREADS * PASSES );
+	CHECK( calls < THREADS * PASSES + THREADS * CONSTATS_ADAPT_MAX_PERIOD );
+
+	// Every full window of samples doubled the period once
+	uint64_t windows = adaptive_site->taken / CONSTATS_ADAPT_WINDOW;
+	CHECK( adaptive_site->period == ( windows < 10 ? 1U << windows : CONSTATS_ADAPT_MAX_PERIOD ) );
+
+	return TEST_RESULT();
+}
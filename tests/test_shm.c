@@ -0,0 +1,135 @@
+/**
+ * @File     : test_shm.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests shared memory export: values written are read back
+ * through a second mapping, replacing a segment leaves old mappings
+ * intact, segments of another geometry are refused, and snapshots retry
+ * a series being written but give up on one whose writer stopped.
+ */
+
+// Enough tries to outlast a writer asleep for a millisecond
+#define CONSTATS_SHM_TRIES 1000000
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "constats_shm.h"
+#include "constats_test.h"
+
+#define SERIES 2
+
+shm_t writer, reader, replaced;
+shm_series_t snapshot;
+char name[64];
+
+static void sleep_ms ( long ms )
+{
+	struct timespec ts = { 0, ms * 1000000 };
+	nanosleep( &ts, NULL );
+}
+
+// Finishes the write that main left half done
+static void* finish_write ( void* unused )
+{
+	(void) unused;
+	sleep_ms( 1 );
+
+	constats_histogram_record( &writer.series[1].hist, 7 );
+	__atomic_store_n( &writer.series[1].seq, writer.series[1].seq + 1, __ATOMIC_RELEASE );
+	return NULL;
+}
+
+// Writes a segment header by hand, attaches to it and cleans up
+static int attach_forged ( uint32_t sub_bits, uint64_t series, uint64_t size )
+{
+	char forged[64];
+	shm_header_t header = { CONSTATS_SHM_MAGIC, CONSTATS_SHM_VERSION, sub_bits, series };
+	shm_t shm;
+
+	snprintf( forged, sizeof( forged ), "/constats_test_forged_%d", (int) getpid() );
+
+	int fd = shm_open( forged, O_CREAT | O_RDWR, 0600 );
+
+	if ( fd < 0 || ftruncate( fd, size ) != 0 || pwrite( fd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+		return -2;
+
+	close( fd );
+
+	int error_code = constats_shm_attach( &shm, forged );
+
+	if ( error_code == 0 )
+		constats_shm_detach( &shm, NULL );
+
+	shm_unlink( forged );
+	return error_code;
+}
+
+int main ( void )
+{
+	pthread_t thread;
+	uint64_t size = sizeof( shm_header_t ) + SERIES * sizeof( shm_series_t );
+	int i;
+
+	snprintf( name, sizeof( name ), "/constats_test_shm_%d", (int) getpid() );
+
+	// Values written are read back through a read-only mapping
+	CHECK( constats_shm_create( &writer, name, SERIES ) == 0 );
+	CHECK( constats_shm_name( &writer, 0, "latency" ) == 0 );
+
+	for ( i = 1; i <= 100; ++i )
+		constats_shm_record( &writer, 0, i );
+
+	CHECK( constats_shm_attach( &reader, name ) == 0 );
+	CHECK( reader.header->series == SERIES );
+	CHECK( constats_shm_name( &reader, 1, "read only" ) == -1 );
+	CHECK( constats_shm_snapshot( &reader, SERIES, &snapshot ) == -1 );
+
+	CHECK( constats_shm_snapshot( &reader, 0, &snapshot ) == 0 );
+	CHECK( strcmp( snapshot.name, "latency" ) == 0 );
+	CHECK( snapshot.hist.N == 100 && snapshot.hist.min == 1 && snapshot.hist.max == 100 );
+	CHECK( snapshot.hist.mean == 50.5 );
+	CHECK( constats_histogram_validate( &snapshot.hist ) == 0 );
+
+	CHECK( constats_shm_snapshot( &reader, 1, &snapshot ) == 0 );
+	CHECK( snapshot.name[0] == '\0' && snapshot.hist.N == 0 );
+
+	// A snapshot taken while a write is under way waits for it to finish
+	__atomic_store_n( &writer.series[1].seq, writer.series[1].seq + 1, __ATOMIC_RELEASE );
+	pthread_create( &thread, NULL, finish_write, NULL );
+
+	CHECK( constats_shm_snapshot( &reader, 1, &snapshot ) == 0 );
+	CHECK( snapshot.hist.N == 1 && snapshot.hist.max == 7 );
+	pthread_join( thread, NULL );
+
+	// A writer that stopped mid-record leaves the series busy, not hung
+	__atomic_store_n( &writer.series[1].seq, writer.series[1].seq + 1, __ATOMIC_RELEASE );
+	CHECK( constats_shm_snapshot( &reader, 1, &snapshot ) == CONSTATS_SHM_BUSY );
+	CHECK( constats_shm_snapshot( &reader, 0, &snapshot ) == 0 );
+
+	// Creating the name again leaves the old segment whole for its readers
+	CHECK( constats_shm_create( &replaced, name, 1 ) == 0 );
+	CHECK( constats_shm_snapshot( &reader, 0, &snapshot ) == 0 );
+	CHECK( snapshot.hist.N == 100 );
+
+	constats_shm_detach( &reader, NULL );
+	CHECK( constats_shm_attach( &reader, name ) == 0 );
+	CHECK( reader.header->series == 1 );
+	CHECK( constats_shm_snapshot( &reader, 0, &snapshot ) == 0 && snapshot.hist.N == 0 );
+
+	// Segments of another geometry are refused
+	CHECK( attach_forged( CONSTATS_HISTOGRAM_SUB_BITS, SERIES, size ) == 0 );
+	CHECK( attach_forged( CONSTATS_HISTOGRAM_SUB_BITS + 1, SERIES, size ) == -1 );
+	CHECK( attach_forged( CONSTATS_HISTOGRAM_SUB_BITS, SERIES + 1, size ) == -1 );
+	CHECK( attach_forged( CONSTATS_HISTOGRAM_SUB_BITS, SERIES, sizeof( shm_header_t ) - 1 ) == -1 );
+
+	constats_shm_detach( &reader, NULL );
+	constats_shm_detach( &writer, NULL );
+	constats_shm_detach( &replaced, name );
+	CHECK( constats_shm_attach( &reader, name ) == -1 );
+
+	return TEST_RESULT();
+}
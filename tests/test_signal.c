@@ -0,0 +1,121 @@
+/**
+ * @File     : test_signal.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests the signal dump, including dumps running at once on
+ * several threads, which must each work from their own histogram copy.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constats_signal.h"
+#include "constats_test.h"
+
+#define THREADS 4
+#define DUMPS   200
+
+histogram_t low, high;
+accumulator_t acc;
+
+static void* dumper ( void* arg )
+{
+	int i;
+	(void) arg;
+
+	for ( i = 0; i < DUMPS; ++i )
+		constats_signal_dump();
+
+	return NULL;
+}
+
+// Counts the lines starting with prefix, and those whose value is not one of two
+static void count_lines ( const char* path, const char* prefix, int64_t a, int64_t b, int* lines, int* wrong )
+{
+	char line[256];
+	FILE* file = fopen( path, "r" );
+
+	*lines = *wrong = 0;
+
+	while ( fgets( line, sizeof( line ), file ) != NULL )
+	{
+		if ( strncmp( line, prefix, strlen( prefix ) ) != 0 )
+			continue;
+
+		int64_t value = atoll( line + strlen( prefix ) );
+		( *lines )++;
+		*wrong += value != a && value != b;
+	}
+
+	fclose( file );
+}
+
+int main ( void )
+{
+	pthread_t threads[THREADS];
+	histogram_t* claimed[CONSTATS_SIGNAL_SNAPSHOTS];
+	char path[64];
+	int lines, wrong;
+	int i;
+
+	snprintf ( path, sizeof( path ), "/tmp/constats_test_%d.dump", (int) getpid() );
+	constats_signal_fd = open( path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644 );
+	CHECK( constats_signal_fd >= 0 );
+
+	constats_histogram_init( &low );
+	constats_histogram_init( &high );
+	constats_accumulator_init( &acc );
+
+	for ( i = 0; i < 1000; ++i )
+	{
+		constats_histogram_record( &low, 100 );
+		constats_histogram_record( &high, 1000000 );
+		constats_accumulator_add( &acc, 7 );
+	}
+
+	CHECK( constats_signal_watch_histogram( "low", &low ) == 0 );
+	CHECK( constats_signal_watch_histogram( "high", &high ) == 0 );
+	CHECK( constats_signal_watch_accumulator( "acc", &acc ) == 0 );
+
+	// Every line comes from one whole, unshared copy
+	for ( i = 0; i < THREADS; ++i )
+		CHECK( pthread_create( &threads[i], NULL, dumper, NULL ) == 0 );
+
+	for ( i = 0; i < THREADS; ++i )
+		pthread_join( threads[i], NULL );
+
+	count_lines( path, "p50     : ", 100, 1000000, &lines, &wrong );
+	CHECK( lines == 2 * THREADS * DUMPS && wrong == 0 );
+
+	count_lines( path, "Average value          : ", 100, 1000000, &lines, &wrong );
+	CHECK( lines == 3 * THREADS * DUMPS && wrong == THREADS * DUMPS );
+
+	// With every copy taken, histograms are reported busy instead
+	for ( i = 0; i < CONSTATS_SIGNAL_SNAPSHOTS; ++i )
+		CHECK( ( claimed[i] = constats_signal_claim_snapshot() ) != NULL );
+
+	CHECK( constats_signal_claim_snapshot() == NULL );
+
+	CHECK( ftruncate( constats_signal_fd, 0 ) == 0 );
+	constats_signal_dump();
+	count_lines( path, "Dump in progress elsewhere", 0, 0, &lines, &wrong );
+	CHECK( lines == 2 );
+
+	for ( i = 0; i < CONSTATS_SIGNAL_SNAPSHOTS; ++i )
+		constats_signal_release_snapshot( claimed[i] );
+
+	// And through a real signal
+	CHECK( ftruncate( constats_signal_fd, 0 ) == 0 );
+	CHECK( constats_signal_install( SIGUSR1 ) == 0 );
+	raise( SIGUSR1 );
+	count_lines( path, "p50     : ", 100, 1000000, &lines, &wrong );
+	CHECK( lines == 2 && wrong == 0 );
+
+	close( constats_signal_fd );
+	unlink( path );
+	return TEST_RESULT();
+}
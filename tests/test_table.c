@@ -0,0 +1,69 @@
+/**
+ * @File     : test_table.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that the table prints and sorts sample columns above
+ * 2^53 exactly, and that NaN statistics sort in a consistent order.
+ */
+
+// For memmem
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONSTATS_TABLE_CELL_WIDTH 20
+
+#include "constats.h"
+#include "constats_table.h"
+#include "constats_test.h"
+
+int main ( void )
+{
+	static const double means[] = { 1, NAN, 0, NAN, 2, -1, NAN };
+	static const char* names[] = { "a", "b", "c", "d", "e", "f", "g" };
+	static const char* ascending[] = { "f", "c", "a", "e", "b", "d", "g" };
+	static const char* descending[] = { "b", "d", "g", "e", "a", "c", "f" };
+
+	int64_t above[1] = { ( (int64_t) 1 << 53 ) + 1 };
+	int64_t below[1] = { (int64_t) 1 << 53 };
+	table_t table;
+	uint64_t length, i;
+
+	// 2^53 + 1 rounds to 2^53 as a double
+	constats_table_init( &table );
+	CHECK( constats_table_add_samples( &table, "above", above, 1 ) == 0 );
+	CHECK( constats_table_add_samples( &table, "below", below, 1 ) == 0 );
+
+	char* text = constats_table_render( &table, &length );
+	CHECK( text != NULL && memmem( text, length, "9007199254740993", 16 ) != NULL );
+	free( text );
+
+	for ( i = CONSTATS_COLUMN_P50; i <= CONSTATS_COLUMN_MAX; ++i )
+	{
+		CHECK( constats_table_sort( &table, i, 0 ) == 0 );
+		CHECK( strcmp( table.rows[0].name, "below" ) == 0 );
+		CHECK( constats_table_sort( &table, i, CONSTATS_SORT_DESCENDING ) == 0 );
+		CHECK( strcmp( table.rows[0].name, "above" ) == 0 );
+	}
+
+	constats_table_destroy( &table );
+
+	// NaN sorts above every number, in the order it was added
+	constats_table_init( &table );
+	for ( i = 0; i < sizeof( means ) / sizeof( means[0] ); ++i )
+		constats_table_append( &table, names[i] )->stat.mean = means[i];
+
+	CHECK( constats_table_sort( &table, CONSTATS_COLUMN_MEAN, 0 ) == 0 );
+	for ( i = 0; i < table.count; ++i )
+		CHECK( strcmp( table.rows[i].name, ascending[i] ) == 0 );
+
+	CHECK( constats_table_sort( &table, CONSTATS_COLUMN_MEAN, CONSTATS_SORT_DESCENDING ) == 0 );
+	for ( i = 0; i < table.count; ++i )
+		CHECK( strcmp( table.rows[i].name, descending[i] ) == 0 );
+
+	constats_table_destroy( &table );
+	return TEST_RESULT();
+}
@@ -0,0 +1,106 @@
+/**
+ * @File     : test_tree.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests that node sums stay accurate far from zero and merge
+ * exactly, and hierarchical scope timing across many short-lived
+ * threads, whose trees must be reused rather than leaked.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constats_tree.h"
+#include "constats_test.h"
+
+#define ROUNDS  50
+#define THREADS 4
+#define PASSES  100
+
+static void* worker ( void* arg )
+{
+	int i;
+	(void) arg;
+
+	for ( i = 0; i < PASSES; ++i )
+	{
+		CONSTATS_TREE_SCOPE( "outer" );
+		{
+			CONSTATS_TREE_SCOPE( "inner" );
+		}
+	}
+
+	return NULL;
+}
+
+int main ( void )
+{
+	pthread_t threads[THREADS];
+	tree_thread_t* thread;
+	tree_node_t root;
+	tree_sums_t whole, low, high;
+	accumulator_t acc;
+	stats_t stat;
+	uint64_t records = 0;
+	int round, i;
+
+	// 1e9 +- 10, uniform, has a deviation of sqrt( 440 / 12 ), split in two
+	// halves whose first samples differ
+	constats_tree_sums_init( &whole );
+	constats_tree_sums_init( &low );
+	constats_tree_sums_init( &high );
+
+	for ( i = 0; i < 105000; ++i )
+	{
+		int64_t sample = 1000000000 + i % 21 - 10;
+
+		constats_tree_sums_add( &whole, sample );
+		constats_tree_sums_add( i < 50000 ? &low : &high, sample );
+	}
+
+	constats_tree_sums_accumulator( &whole, &acc );
+	CHECK( constats_accumulator_calculate_stats( &acc, &stat ) == 0 );
+	CHECK( stat.N == 105000 && stat.min == 1000000000 - 10 && stat.max == 1000000000 + 10 );
+	CHECK( fabs( stat.mean - 1000000000 ) < 1e-6 );
+	CHECK( fabs( stat.stdev - sqrt( 440.0 / 12 ) ) < 1e-6 );
+
+	constats_tree_sums_merge( &low, &high );
+	CHECK( low.N == whole.N && low.sum == whole.sum && low.sum_sq == whole.sum_sq );
+	CHECK( low.min == whole.min && low.max == whole.max );
+
+	for ( round = 0; round < ROUNDS; ++round )
+	{
+		for ( i = 0; i < THREADS; ++i )
+			CHECK( pthread_create( &threads[i], NULL, worker, NULL ) == 0 );
+
+		for ( i = 0; i < THREADS; ++i )
+			pthread_join( threads[i], NULL );
+	}
+
+	for ( thread = constats_tree_threads; thread != NULL; thread = thread->next )
+	{
+		CHECK( thread->exited );
+		records++;
+	}
+
+	CHECK( records >= 1 && records <= THREADS );
+
+	// Every exited thread's passes are still there
+	memset( &root, 0, sizeof( tree_node_t ) );
+	for ( thread = constats_tree_threads; thread != NULL; thread = thread->next )
+		CHECK( constats_tree_merge( &root, &thread->nodes[0] ) == 0 );
+
+	CHECK( root.child != NULL && root.child->sibling == NULL );
+	CHECK( root.child->inclusive.N == ROUNDS * THREADS * PASSES );
+	CHECK( root.child->child != NULL && root.child->child->inclusive.N == ROUNDS * THREADS * PASSES );
+
+	constats_tree_free( &root );
+
+	// The main thread takes a record of its own
+	worker( NULL );
+	CHECK( constats_tree_self != NULL && !constats_tree_self->exited );
+
+	return TEST_RESULT();
+}
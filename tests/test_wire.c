@@ -0,0 +1,113 @@
+/**
+ * @File     : test_wire.c
+ * @Author   : Abdullah Younis
+ *
+ * This file tests wire round trips at the edges of every field, and that
+ * overflowing, trailing, truncated and inconsistent buffers are rejected
+ * without touching the destination, accumulators and histograms alike.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constats_wire.h"
+#include "constats_test.h"
+
+histogram_t hist, decoded, before;
+uint8_t buffer[CONSTATS_WIRE_HISTOGRAM_MAX + 1];
+
+// N, mean, m2, min and max that no accumulator of two samples can have
+accumulator_t inconsistent[] =
+{
+	{ 2, 5, 1, 10, 1 }, { 2, 5, -1, 1, 10 }, { 2, NAN, 1, 1, 10 },
+	{ 2, 5, NAN, 1, 10 }, { 2, INFINITY, 1, 1, 10 }, { 2, 5, -INFINITY, 1, 10 },
+};
+
+int main ( void )
+{
+	accumulator_t acc, out;
+	accumulator_t dst = { 3, 2, 2, 1, 3 };
+	uint64_t length;
+	uint64_t i;
+
+	// Extreme field values survive the trip
+	acc.N    = UINT64_MAX;
+	acc.mean = -1.5e300;
+	acc.m2   = 0;
+	acc.min  = INT64_MIN;
+	acc.max  = INT64_MAX;
+
+	CHECK( constats_wire_encode_accumulator( &acc, buffer, CONSTATS_WIRE_ACCUMULATOR_MAX, &length ) == 0 );
+	CHECK( length == CONSTATS_WIRE_ACCUMULATOR_MAX );
+	CHECK( constats_wire_decode_accumulator( &out, buffer, length ) == 0 );
+	CHECK( out.N == acc.N && out.mean == acc.mean && out.min == acc.min && out.max == acc.max );
+
+	// A tenth varint byte above 1 overflows 64 bits
+	CHECK( buffer[CONSTATS_WIRE_HEADER_SIZE + 9] == 1 );
+	buffer[CONSTATS_WIRE_HEADER_SIZE + 9] = 2;
+	CHECK( constats_wire_decode_accumulator( &out, buffer, length ) == -1 );
+	buffer[CONSTATS_WIRE_HEADER_SIZE + 9] = 0x81;
+	CHECK( constats_wire_decode_accumulator( &out, buffer, length ) == -1 );
+	buffer[CONSTATS_WIRE_HEADER_SIZE + 9] = 1;
+
+	// Trailing bytes and every truncation are rejected
+	buffer[length] = 0;
+	CHECK( constats_wire_decode_accumulator( &out, buffer, length + 1 ) == -1 );
+
+	for ( i = 0; i < length; ++i )
+		CHECK( constats_wire_decode_accumulator( &out, buffer, i ) == -1 );
+
+	// Inconsistent moments and ranges are rejected before merging
+	for ( i = 0; i < sizeof( inconsistent ) / sizeof( inconsistent[0] ); ++i )
+	{
+		CHECK( constats_wire_encode_accumulator( &inconsistent[i], buffer, CONSTATS_WIRE_ACCUMULATOR_MAX, &length ) == 0 );
+		CHECK( constats_wire_merge_accumulator( &dst, buffer, length ) == -1 );
+		CHECK( dst.N == 3 && dst.mean == 2 && dst.m2 == 2 && dst.min == 1 && dst.max == 3 );
+	}
+
+	// An empty accumulator keeps its inverted range
+	constats_accumulator_init( &acc );
+	CHECK( constats_wire_encode_accumulator( &acc, buffer, CONSTATS_WIRE_ACCUMULATOR_MAX, &length ) == 0 );
+	CHECK( constats_wire_merge_accumulator( &dst, buffer, length ) == 0 && dst.N == 3 );
+
+	// Histograms, from empty to values at both ends of the range
+	constats_histogram_init( &hist );
+	CHECK( constats_wire_encode_histogram( &hist, buffer, sizeof( buffer ), &length ) == 0 );
+	CHECK( constats_wire_decode_histogram( &decoded, buffer, length ) == 0 );
+	CHECK( decoded.N == 0 && decoded.min == INF && decoded.max == NINF );
+
+	constats_histogram_record( &hist, 0 );
+	constats_histogram_record( &hist, 127 );
+	constats_histogram_record_n( &hist, 1000000, 1000 );
+	constats_histogram_record( &hist, INT64_MAX );
+
+	CHECK( constats_wire_encode_histogram( &hist, buffer, sizeof( buffer ), &length ) == 0 );
+	CHECK( constats_wire_decode_histogram( &decoded, buffer, length ) == 0 );
+	CHECK( memcmp( &decoded, &hist, sizeof( histogram_t ) ) == 0 );
+
+	memcpy( &before, &decoded, sizeof( histogram_t ) );
+
+	buffer[length] = 0;
+	CHECK( constats_wire_merge_histogram( &decoded, buffer, length + 1 ) == -1 );
+
+	for ( i = 0; i < length; ++i )
+		CHECK( constats_wire_merge_histogram( &decoded, buffer, i ) == -1 );
+
+	CHECK( memcmp( &decoded, &before, sizeof( histogram_t ) ) == 0 );
+
+	// N that disagrees with the buckets, or a min outside them
+	hist.N++;
+	CHECK( constats_wire_encode_histogram( &hist, buffer, sizeof( buffer ), &length ) == 0 );
+	CHECK( constats_wire_merge_histogram( &decoded, buffer, length ) == -1 );
+	hist.N--;
+
+	hist.min = 1;
+	CHECK( constats_wire_encode_histogram( &hist, buffer, sizeof( buffer ), &length ) == 0 );
+	CHECK( constats_wire_merge_histogram( &decoded, buffer, length ) == -1 );
+	hist.min = 0;
+
+	CHECK( memcmp( &decoded, &before, sizeof( histogram_t ) ) == 0 );
+
+	return TEST_RESULT();
+}